@@ -60,6 +60,8 @@ SOFTWARE.
 #include "experiments/vary_sample_buffer.h"
 #include "experiments/Independence_Experiment.h"
 #include "experiments/query_latency_experiment.h"
+#include "experiments/tlb_experiment.h"
+#include "experiments/block_size_sweep.h"
 
 #define ENABLE_NAIVE
 #define ENABLE_SAMPLE
@@ -71,16 +73,6 @@ constexpr size_t NODE_SAMPLE_SIZE = 16;
 
 #define BOOST_NO_EXCEPTION
 
-/*
- * cache system disk cache
- */
-const char * clear_cache_cmd = "/uusoc/scratch/magpie17/robertc/clearCache > /dev/null";
-void clear_cache()
-{
-    auto unused = system(clear_cache_cmd);
-    // TODO clear block manager cache when implemented
-}
-
 namespace bg = boost::geometry;
 namespace bt = boost::timer;
 
@@ -93,7 +85,7 @@ constexpr size_t memory_use = 52L * 1024 * 1024 * 1024;
 int main(int argc, char ** argv)
 {
     if (argc == 1)
-        std::cerr << "give options for which experiments to run\n query_file_osm_a=[eblrs] (e=estimation test, b=baseline, l=level sampling, r=range query, s=random shuffle)\n query_file_geo_a=[eblrs] (e=estimation test, b=baseline, l=level sampling, r=range query, s=random shuffle)\n aggragate_geo\n aggragate_osm\n build_osm\n build_geo\n modify_geo_file\n modify_osm_file\n modify_geo_file_baseline \n modify_osm_file_baseline\n modify_geo_file_lstree\n build_osm_single\n construct_only_geo_rtree\n construct_only_osm_rtree\n construct_only_geo_level\n construct_only_osm_level\n construct_only_geo_shuffle\n construct_only_osm_shuffle\n find_queries_geo=|Q|,tolerance\n find_queries_osm=|Q|,tolerance\n extra\n construct_sample_node_structure\n run_sample_node_structure\n build_geo_block_size=K Build the geo data with block size K\n build_osm_block_size=K Build the osm data with block size of K\n build_mem_nodes_file=input rtree\n" << std::endl;
+        std::cerr << "give options for which experiments to run\n query_file_osm_a=[eblrs] (e=estimation test, b=baseline, l=level sampling, r=range query, s=random shuffle)\n query_file_geo_a=[eblrs] (e=estimation test, b=baseline, l=level sampling, r=range query, s=random shuffle)\n aggragate_geo\n aggragate_osm\n build_osm\n build_geo\n modify_geo_file\n modify_osm_file\n modify_geo_file_baseline \n modify_osm_file_baseline\n modify_geo_file_lstree\n build_osm_single\n construct_only_geo_rtree\n construct_only_osm_rtree\n construct_only_geo_level\n construct_only_osm_level\n construct_only_geo_shuffle\n construct_only_osm_shuffle\n find_queries_geo=|Q|,tolerance\n find_queries_osm=|Q|,tolerance\n extra\n construct_sample_node_structure\n run_sample_node_structure\n build_geo_block_size=K Build the geo data with block size K\n build_osm_block_size=K Build the osm data with block size of K\n build_mem_nodes_file=input rtree\n direct_io use O_DIRECT for the trees opened by the experiments that follow, so every query starts cold\n tlb_experiment=[go] (g=geolife, o=osm) sample queries on the tree in memory, with and without huge pages\n block_size_sweep=[go] (g=geolife, o=osm) sample queries on trees built with blocks of 64 KB to 2 MB\n" << std::endl;
         //std::cerr << "give options for which experiments to run\n query_osm\n query_geo\n query_osm_a=[eblr] (e=estimation test, b=baseline, l=level sampling, r=range query)\n query_geo_a=[eblr] (e=estimation test, b=baseline, l=level sampling, r=range query)\n query_file_osm_a=[eblr] (e=estimation test, b=baseline, l=level sampling, r=range query)\n query_file_geo_a=[eblr] (e=estimation test, b=baseline, l=level sampling, r=range query)\n aggragate_geo\n aggragate_osm\n build_osm\n build_geo\n modify_osm\n modify_osm_p=(float) <- used to indicate specific cover\n modify_geo\n modify_geo_p=(float) <- used to indicate specific cover\n build_geo_single\n build_osm_single\n construct_only_geo_rtree\n construct_only_osm_rtree\n construct_only_geo_level\n construct_only_osm_level\n find_queries_geo=|Q|,tolerance\n find_queries_osm=|Q|,tolerance" << std::endl;
 
     for (int i = 1; i < argc; ++i)
@@ -101,7 +93,12 @@ int main(int argc, char ** argv)
         std::string argument{ argv[i] };
         
  
-        if (argument.substr(0, 17) == "query_file_osm_a=")
+        if (argument == "direct_io")
+        {
+            // the page cache is bypassed, flushing the trees' own caches is enough
+            rtree::BlockManager::default_storage = rtree::StorageKind::DIRECT;
+        }
+        else if (argument.substr(0, 17) == "query_file_osm_a=")
         {
             Query_tree_experiments querying_experiments;
 
@@ -705,6 +702,50 @@ int main(int argc, char ** argv)
                 }
             }
         }
+        else if (argument.substr(0, 15) == "tlb_experiment=")
+        {
+            for (int i = 15; i < argument.size(); i++)
+            {
+                std::unique_ptr<tlb_experiment> experiment;
+
+                char value = tolower(argument[i]);
+                switch (value)
+                {
+                case 'g':
+                    experiment.reset(new tlb_experiment("geo_tlb.txt", Geolife));
+                    experiment->run_experiment(1000, 10000, 0.01f);
+                    break;
+                case 'o':
+                    experiment.reset(new tlb_experiment("osm_tlb.txt", OSM_nodes));
+                    experiment->run_experiment(1000, 10000, 0.01f);
+                    break;
+                default:
+                    std::cerr << "unknown option \'" << value << '\"' << std::endl;
+                }
+            }
+        }
+        else if (argument.substr(0, 17) == "block_size_sweep=")
+        {
+            for (int i = 17; i < argument.size(); i++)
+            {
+                std::unique_ptr<block_size_sweep> experiment;
+
+                char value = tolower(argument[i]);
+                switch (value)
+                {
+                case 'g':
+                    experiment.reset(new block_size_sweep("geo_block_size_sweep.txt", Geolife));
+                    experiment->run_experiment(100, 100000, 0.01f);
+                    break;
+                case 'o':
+                    experiment.reset(new block_size_sweep("osm_block_size_sweep.txt", OSM_nodes));
+                    experiment->run_experiment(100, 100000, 0.01f);
+                    break;
+                default:
+                    std::cerr << "unknown option \'" << value << '\"' << std::endl;
+                }
+            }
+        }
         else if (argument == "test") {
             auto source = Data_Source_Information::get_data_information(Geolife);
 
@@ -0,0 +1,119 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "block_size_sweep.h"
+
+#include "Data_Source_Information.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+size_t sweep_memory_use = 4L * 1024L * 1024L * 1024L;
+
+} // anonymous namespace
+
+block_size_sweep::block_size_sweep(std::string output_file, Data_sources method_to_use, std::vector<size_t> block_sizes)
+    : m_output_file{ output_file }
+    , m_block_sizes{ block_sizes }
+{
+    if (method_to_use != Data_sources::Geolife && method_to_use != Data_sources::OSM_nodes)
+        throw "bad method to use";
+
+    m_data_source = Data_Source_Information::get_data_information(method_to_use);
+}
+
+void block_size_sweep::clear_system_cache(void)
+{
+    // with direct I/O there is no page cache to clear
+    if (rtree::BlockManager::default_storage != rtree::StorageKind::DIRECT)
+    {
+        auto unused = system("./clearCache > /dev/null");
+    }
+}
+
+block_size_sweep::result block_size_sweep::run_configuration(size_t block_size, std::vector<mongo_types::box3d> const& queries, int sample_size)
+{
+    std::string tree_file = m_data_source->get_source_created() + "_blockSize-" + std::to_string(block_size);
+
+    rtree::IOLayersParameters parameters;
+    // the same amount of memory for the cache, whatever the block size
+    parameters.cached_blocks = std::max<size_t>(1, parameters.cached_blocks * parameters.block_size / block_size);
+    parameters.block_size = block_size;
+    parameters.node_format = rtree::IOLayersParameters::latest_node_format;
+
+    result r;
+    r.block_size = block_size;
+
+    boost::timer::cpu_timer build_timer;
+    rtree_t::build_io_layers(m_data_source->get_source_raw(),
+        tree_file,
+        m_data_source->get_convert_function(),
+        sweep_memory_use,
+        nullptr,
+        parameters);
+    build_timer.stop();
+    r.build_seconds = build_timer.elapsed().wall / 1e9;
+
+    std::unique_ptr<rtree_t> tree(new rtree_t(tree_file));
+    utilities::null_iterator<sample_entry> iter;
+
+    r.query_seconds = 0;
+    r.io_cost = 0;
+    for (auto const& query : queries)
+    {
+        tree->flush_cache();
+        clear_system_cache();
+
+        boost::timer::cpu_timer query_timer;
+        auto cursor = tree->sample_query(query);
+        cursor.get_samples(sample_size, iter);
+        query_timer.stop();
+
+        r.query_seconds += query_timer.elapsed().wall / 1e9;
+        r.io_cost += cursor.get_io_cost();
+    }
+    return r;
+}
+
+void block_size_sweep::run_experiment(int query_count, int sample_size, float percentage_cover)
+{
+    // the same queries for every block size
+    std::vector<mongo_types::box3d> queries;
+    for (int i = 0; i < query_count; ++i)
+        queries.push_back(utilities::get_random_query_box(percentage_cover, *m_data_source));
+
+    std::fstream file_out{ m_output_file, std::fstream::out };
+    file_out << "block size (KB)\tbuild (s)\tqueries (s)\tio cost\tMB read\n";
+
+    for (size_t block_size : m_block_sizes)
+    {
+        result r = run_configuration(block_size, queries, sample_size);
+        for (std::ostream * out : { (std::ostream*)&file_out, (std::ostream*)&std::cout })
+        {
+            *out << r.block_size / 1024 << '\t' << r.build_seconds << '\t' << r.query_seconds << '\t'
+                << r.io_cost << '\t' << r.io_cost * r.block_size / (1024 * 1024) << '\n';
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "experiment_utilities.h"
+
+/*
+ * Effect of the block size on the sample queries
+ *
+ * the tree is built once per block size (64 KB to 2 MB, the sizes at which
+ * NVMe drives reach their bandwidth) with the 32 bit array headers, then the
+ * same random sample queries are run cold on each of them, timing them and
+ * counting the blocks read
+ */
+class block_size_sweep
+{
+public:
+    block_size_sweep(std::string output_file, Data_sources method_to_use,
+        std::vector<size_t> block_sizes = { 64 * 1024, 256 * 1024, 1024 * 1024, 2 * 1024 * 1024 });
+
+    void run_experiment(int query_count, int sample_size, float percentage_cover);
+
+private:
+    struct result
+    {
+        size_t block_size;
+        double build_seconds;
+        double query_seconds;
+        size_t io_cost;
+    };
+
+    result run_configuration(size_t block_size, std::vector<mongo_types::box3d> const& queries, int sample_size);
+
+    void clear_system_cache(void);
+
+    std::string m_output_file;
+    std::vector<size_t> m_block_sizes;
+    std::shared_ptr<Data_Source_Information> m_data_source;
+
+    using entry = mongo_types::entry;
+    using sample_entry = mongo_types::sample_entry;
+    using box = mongo_types::box3d;
+
+    using rtree_t = rtree::rtree <
+        entry,
+        sample_entry,
+        box
+    >;
+};
@@ -464,7 +464,11 @@ void Query_tree_experiments::clear_system_cache()
         mp_rtree_ptr->flush_cache();
     if (mp_levelSample_ptr)
         mp_levelSample_ptr->flush_cache();
-    auto unused = system("./clearCache > /dev/null");
+    // with direct I/O there is no page cache to clear
+    if (rtree::BlockManager::default_storage != rtree::StorageKind::DIRECT)
+    {
+        auto unused = system("./clearCache > /dev/null");
+    }
     m_IOUsed = false;
     std::cout << "C";
 }
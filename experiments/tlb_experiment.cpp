@@ -0,0 +1,160 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "tlb_experiment.h"
+
+#include "Data_Source_Information.h"
+
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+size_t tlb_memory_limit = 4L * 1024L * 1024L * 1024L;
+
+// dTLB load misses of the calling thread, in user space
+struct dtlb_miss_counter
+{
+    dtlb_miss_counter()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // fails without the hardware counter or the permission (kernel.perf_event_paranoid)
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~dtlb_miss_counter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    void start()
+    {
+        if (fd < 0)
+            return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // -1 if the counter is not available
+    long long stop()
+    {
+        if (fd < 0)
+            return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count;
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            return -1;
+        return count;
+    }
+
+    int fd;
+};
+
+} // anonymous namespace
+
+tlb_experiment::tlb_experiment(std::string output_file, Data_sources method_to_use)
+    : m_output_file{ output_file }
+{
+    if (method_to_use != Data_sources::Geolife && method_to_use != Data_sources::OSM_nodes)
+        throw "bad method to use";
+
+    m_data_source = Data_Source_Information::get_data_information(method_to_use);
+    m_tree_file = m_data_source->get_source_created();
+}
+
+tlb_experiment::result tlb_experiment::run_configuration(bool huge_pages, std::vector<mongo_types::box3d> const& queries, int sample_size)
+{
+    // both only apply to what is allocated / opened from now on
+    rtree::HugePageArena::instance().set_enabled(huge_pages);
+    rtree::BlockManager::huge_pages = huge_pages;
+
+    result r;
+
+    boost::timer::cpu_timer load_timer;
+    std::unique_ptr<rtree_t> tree(new rtree_t(m_tree_file, true /*unlimited memory*/, false /*load using mem nodes*/, tlb_memory_limit));
+    load_timer.stop();
+    r.load_seconds = load_timer.elapsed().wall / 1e9;
+
+    utilities::null_iterator<sample_entry> iter;
+    dtlb_miss_counter counter;
+
+    boost::timer::cpu_timer query_timer;
+    counter.start();
+    for (auto const& query : queries)
+    {
+        auto cursor = tree->sample_query(query);
+        cursor.get_samples(sample_size, iter);
+    }
+    r.dtlb_misses = counter.stop();
+    query_timer.stop();
+    r.query_seconds = query_timer.elapsed().wall / 1e9;
+
+    auto stats = rtree::HugePageArena::instance().get_stats();
+    r.arena_mapped = stats.mapped;
+    r.arena_explicit_huge = stats.explicit_huge;
+
+    tree.reset();
+    rtree::HugePageArena::instance().set_enabled(false);
+    rtree::BlockManager::huge_pages = false;
+    return r;
+}
+
+void tlb_experiment::run_experiment(int query_count, int sample_size, float percentage_cover)
+{
+    // the same queries for both layouts
+    std::vector<mongo_types::box3d> queries;
+    for (int i = 0; i < query_count; ++i)
+        queries.push_back(utilities::get_random_query_box(percentage_cover, *m_data_source));
+
+    result regular = run_configuration(false, queries, sample_size);
+    result huge = run_configuration(true, queries, sample_size);
+
+    std::fstream file_out{ m_output_file, std::fstream::out };
+    file_out << "layout\tload (s)\tqueries (s)\tdTLB load misses\tarena mapped (MB)\texplicit huge pages (MB)\n";
+
+    auto dump = [&](std::string const& name, result const& r) {
+        for (std::ostream * out : { (std::ostream*)&file_out, (std::ostream*)&std::cout })
+        {
+            *out << name << '\t' << r.load_seconds << '\t' << r.query_seconds << '\t';
+            if (r.dtlb_misses < 0)
+                *out << "n/a";
+            else
+                *out << r.dtlb_misses;
+            *out << '\t' << r.arena_mapped / (1024 * 1024) << '\t' << r.arena_explicit_huge / (1024 * 1024) << '\n';
+        }
+    };
+    dump("heap", regular);
+    dump("huge_pages", huge);
+}
@@ -0,0 +1,72 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "experiment_utilities.h"
+
+/*
+ * Effect of the memory layout of an in memory tree on the TLB
+ *
+ * the tree is loaded fully in memory twice, first with the nodes on the heap
+ * and the data file mapped as usual, then with the nodes in the HugePageArena
+ * and the data file mapped for huge pages. the same random sample queries
+ * are run on both, timing them and counting the dTLB load misses
+ * (through perf_event_open, n/a if the counter is not available)
+ */
+class tlb_experiment
+{
+public:
+    tlb_experiment(std::string output_file, Data_sources method_to_use);
+
+    void run_experiment(int query_count, int sample_size, float percentage_cover);
+
+private:
+    struct result
+    {
+        double load_seconds;
+        double query_seconds;
+        // -1 if not counted
+        long long dtlb_misses;
+        size_t arena_mapped;
+        size_t arena_explicit_huge;
+    };
+
+    result run_configuration(bool huge_pages, std::vector<mongo_types::box3d> const& queries, int sample_size);
+
+    std::string m_output_file;
+    std::string m_tree_file;
+    std::shared_ptr<Data_Source_Information> m_data_source;
+
+    using entry = mongo_types::entry;
+    using sample_entry = mongo_types::sample_entry;
+    using box = mongo_types::box3d;
+
+    using rtree_t = rtree::rtree <
+        entry,
+        sample_entry,
+        box
+    >;
+};
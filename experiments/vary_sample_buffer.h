@@ -228,7 +228,11 @@ void Vary_sample_buffer<t_NodeSampleSize>::clear_system_cache()
     // this uses a custom utility to clear the system cache
     if (mp_rtree_ptr)
         mp_rtree_ptr->flush_cache();
-    auto unused = system("./clearCache > /dev/null");
+    // with direct I/O there is no page cache to clear
+    if (rtree::BlockManager::default_storage != rtree::StorageKind::DIRECT)
+    {
+        auto unused = system("./clearCache > /dev/null");
+    }
 }
 //
 template<size_t t_NodeSampleSize>
@@ -31,6 +31,8 @@ SOFTWARE.
 
 #include "serialization/default_serializers.h"
 #include "serialization/serializer.h"
+#include "serialization/leaf_codec.h"
+#include "serialization/leaf_columns.h"
 
 namespace mongo_types {
 namespace bg = boost::geometry;
@@ -271,6 +273,74 @@ struct has_dump_load_method<mongo_types::entry>
     static constexpr bool value = true;
 };
 
+// dump_to writes the memory image
+template <>
+struct fixed_layout<mongo_types::entry>
+    : fixed_memory_image<mongo_types::entry>
+{
+    static_assert(sizeof(mongo_types::entry) == mongo_types::entry::serialization_size, "dump_to writes the memory image");
+};
+
+template <>
+struct leaf_codec<mongo_types::entry>
+{
+    using value_type = mongo_types::entry;
+
+    static constexpr bool compressing = true;
+
+    static value_type origin(void) {
+        value_type v;
+        v.oid.id.fill(0);
+        return v;
+    }
+
+    static size_t size(value_type const& prev, value_type const& cur) {
+        return leaf_coding::xor_size(prev.loc.get<0>(), cur.loc.get<0>())
+            + leaf_coding::xor_size(prev.loc.get<1>(), cur.loc.get<1>())
+            + leaf_coding::delta_size(prev.timestamp, cur.timestamp)
+            + leaf_coding::prefixed_size(prev.oid.id, cur.oid.id);
+    }
+
+    static void encode(std::ostream & out, value_type const& prev, value_type const& cur) {
+        leaf_coding::dump_xor(out, prev.loc.get<0>(), cur.loc.get<0>());
+        leaf_coding::dump_xor(out, prev.loc.get<1>(), cur.loc.get<1>());
+        leaf_coding::dump_delta(out, prev.timestamp, cur.timestamp);
+        leaf_coding::dump_prefixed(out, prev.oid.id, cur.oid.id);
+    }
+
+    static void decode(std::istream & in, value_type const& prev, value_type & cur) {
+        float f;
+        int64_t timestamp;
+        leaf_coding::load_xor(in, prev.loc.get<0>(), f);
+        cur.loc.set<0>(f);
+        leaf_coding::load_xor(in, prev.loc.get<1>(), f);
+        cur.loc.set<1>(f);
+        leaf_coding::load_delta(in, prev.timestamp, timestamp);
+        cur.timestamp = (int)timestamp;
+        leaf_coding::load_prefixed(in, prev.oid.id, cur.oid.id);
+    }
+};
+
+// lat, lon, timestamp and oid in columns
+template <>
+struct leaf_columns<mongo_types::entry>
+    : point_id_columns<mongo_types::entry, leaf_columns<mongo_types::entry>, mongo_types::OID::oid_len>
+{
+    static void split(value_type const& v, float & c0, float & c1, int32_t & c2, unsigned char * id) {
+        c0 = v.loc.get<0>();
+        c1 = v.loc.get<1>();
+        c2 = v.timestamp;
+        std::memcpy(id, v.oid.id.data(), v.oid.id.size());
+    }
+
+    static void join(value_type & v, float c0, float c1, int32_t c2, unsigned char const * id) {
+        v.loc.set<0>(c0);
+        v.loc.set<1>(c1);
+        v.timestamp = c2;
+        std::memcpy(v.oid.id.data(), id, v.oid.id.size());
+    }
+};
+
 namespace std {
     template <>
     struct hash<mongo_types::sample_entry>
@@ -0,0 +1,276 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "rtree/async_reader.h"
+
+// io_uring is driven with raw system calls, liburing is not required
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define RSTREE_HAS_IO_URING
+#endif
+#endif
+
+namespace rtree {
+
+#ifdef RSTREE_HAS_IO_URING
+
+AsyncReader::AsyncReader(unsigned depth)
+    : depth(depth)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, depth, &params);
+    if(fd < 0)
+        return;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED)
+    {
+        close(fd);
+        return;
+    }
+
+    if(single_mmap)
+        cq_ring = sq_ring;
+    else
+    {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED)
+        {
+            munmap(sq_ring, sq_ring_size);
+            close(fd);
+            return;
+        }
+    }
+
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        if(cq_ring != sq_ring)
+            munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        close(fd);
+        return;
+    }
+
+    char * sq = (char*)sq_ring;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char * cq = (char*)cq_ring;
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    this->depth = std::min(depth, params.sq_entries);
+    ring_fd = fd;
+}
+
+AsyncReader::~AsyncReader()
+{
+    if(ring_fd < 0)
+        return;
+
+    shut_down(nullptr, 0);
+}
+
+size_t
+AsyncReader::reap(Request * first)
+{
+    auto * cqe_array = (io_uring_cqe*)cqes;
+
+    size_t count = 0;
+    unsigned head = *cq_head;
+    while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        io_uring_cqe & cqe = cqe_array[head & *cq_mask];
+        first[cqe.user_data].result = cqe.res;
+        ++head;
+        ++count;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void
+AsyncReader::shut_down(Request * first, size_t in_flight)
+{
+    // the kernel may still write into the buffers of the reads it has taken
+    while(in_flight > 0)
+    {
+        size_t n = reap(first);
+        in_flight -= std::min(n, in_flight);
+        if(n == 0 && in_flight > 0)
+        {
+            // the completions land in the ring even if waiting for them fails
+            if(syscall(__NR_io_uring_enter, ring_fd.load(), 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                    && errno != EINTR)
+                sched_yield();
+        }
+    }
+
+    munmap(sqes, sqes_size);
+    if(cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    munmap(sq_ring, sq_ring_size);
+    close(ring_fd);
+    ring_fd = -1;
+}
+
+void
+AsyncReader::submit_and_wait(Request * first, size_t count)
+{
+    auto * sqe_array = (io_uring_sqe*)sqes;
+
+    unsigned tail = *sq_tail;
+    unsigned mask = *sq_mask;
+    for(size_t i = 0; i < count; ++i)
+    {
+        unsigned index = tail & mask;
+        io_uring_sqe & sqe = sqe_array[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = first[i].fd;
+        sqe.addr = (unsigned long)first[i].data;
+        sqe.len = first[i].size;
+        sqe.off = first[i].offset;
+        sqe.user_data = i;
+        sq_array[index] = index;
+        ++tail;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    size_t submitted = 0;
+    size_t completed = 0;
+    int busy_retries = 0;
+    while(completed < count)
+    {
+        unsigned to_submit = count - submitted;
+        int rv = syscall(__NR_io_uring_enter, ring_fd.load(), to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(rv < 0 && errno != EINTR)
+        {
+            if((errno != EAGAIN && errno != EBUSY) || ++busy_retries > max_busy_retries)
+                break;
+            // the completion queue may be full, make room before trying again
+            completed += reap(first);
+            sched_yield();
+            continue;
+        }
+        if(rv > 0)
+        {
+            submitted += rv;
+            busy_retries = 0;
+        }
+        completed += reap(first);
+    }
+
+    if(completed < count)
+    {
+        // take back what the kernel has not taken, so no later batch submits it,
+        // and don't use the ring any more
+        __atomic_store_n(sq_tail, __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        shut_down(first, submitted - std::min(submitted, completed));
+    }
+
+    // the kernel refused (part of) the batch, the rest is read synchronously
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(first[i].result != (ssize_t)first[i].size)
+            read_sync(first[i]);
+    }
+}
+
+void
+AsyncReader::read(std::vector<Request> & batch)
+{
+    for(auto & request : batch)
+        request.result = -EINPROGRESS;
+
+    std::unique_lock<std::mutex> lck(lock);
+    size_t i = 0;
+    for(; i < batch.size() && ring_fd >= 0; i += depth)
+        submit_and_wait(&batch[i], std::min<size_t>(depth, batch.size() - i));
+    lck.unlock();
+
+    // no ring, or it failed on the way
+    for(; i < batch.size(); ++i)
+        read_sync(batch[i]);
+}
+
+#else // RSTREE_HAS_IO_URING
+
+AsyncReader::AsyncReader(unsigned depth)
+    : depth(depth)
+{ }
+
+AsyncReader::~AsyncReader()
+{ }
+
+void
+AsyncReader::read(std::vector<Request> & batch)
+{
+    for(auto & request : batch)
+        read_sync(request);
+}
+
+#endif // RSTREE_HAS_IO_URING
+
+void
+AsyncReader::read_sync(Request & request)
+{
+    size_t done = 0;
+    while(done < request.size)
+    {
+        ssize_t rv = pread(request.fd, request.data + done, request.size - done, request.offset + done);
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+        {
+            request.result = (rv < 0) ? -errno : done;
+            return;
+        }
+        done += rv;
+    }
+    request.result = done;
+}
+
+} // namespace rtree
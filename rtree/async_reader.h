@@ -0,0 +1,104 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Batched reads
+ *
+ * all the reads of a batch are submitted at once through io_uring, so the
+ * latency of a batch is about the latency of its slowest read.
+ * when io_uring is not available (old kernel, seccomp, ...) the reads are
+ * done one by one with pread, which is also what happens for good once
+ * the ring fails
+ */
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <sys/types.h>
+
+namespace rtree {
+
+struct AsyncReader
+{
+    struct Request
+    {
+        int fd;
+        off_t offset;
+        char * data;
+        size_t size;
+
+        // number of bytes read, or -errno
+        ssize_t result;
+    };
+
+    // depth: the maximum number of reads in flight
+    explicit AsyncReader(unsigned depth = 64);
+    ~AsyncReader();
+
+    AsyncReader(AsyncReader const&) = delete;
+    AsyncReader & operator = (AsyncReader const&) = delete;
+
+    // true if the reads are really submitted together
+    bool is_async(void) const { return ring_fd >= 0; }
+
+    // issue all the reads and wait for them to complete
+    void read(std::vector<Request> & batch);
+
+private:
+    // io_uring_enter is retried this many times on EAGAIN/EBUSY before giving up on the ring
+    static constexpr
+    int max_busy_retries = 16;
+
+    void read_sync(Request & request);
+    void submit_and_wait(Request * first, size_t count);
+
+    // move the completions to `first`, returns how many there were
+    size_t reap(Request * first);
+
+    // wait for the reads in flight, then close the ring, must hold `lock`
+    void shut_down(Request * first, size_t in_flight);
+
+    std::atomic<int> ring_fd{-1};
+    unsigned depth;
+
+    // ring buffers shared with the kernel
+    void * sq_ring = nullptr;
+    void * cq_ring = nullptr;
+    void * sqes = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    void * cqes;
+
+    // a ring can only be used by one thread at a time
+    std::mutex lock;
+};
+
+} // namespace rtree
@@ -19,105 +19,342 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
-// #ifndef BLOCK_CACHE_H__
-// #define BLOCK_CACHE_H__
-
-// #include <unordered_map>
-
-// namespace rtree {
-
-// template<typename Key, typename Value>
-// struct BlockCache
-// {
-//     BlockCache(size_t capacity)
-//         : capacity(capacity)
-//     { }
-
-//     using value_ptr = std::shared_ptr<Value>;
-
-//     value_ptr get(Key const& key);
-//     void put(Key const& key, value_ptr const& value);
-
-//     void flush(void);
-
-//     // 0 for unlimited
-//     void set_capacity (size_t c) { capacity = c; }
-
-//     size_t size (void) const { return entries.size(); }
-
-// private:
-//     void compact(void);
-
-//     size_t capacity;
-
-//     using CacheEntry = std::pair<Key, value_ptr>;
-//     std::list<CacheEntry> entries;
-//     //std::unordered_map<Key, typename std::list<CacheEntry>::iterator> cache;
-//     std::map<Key, typename std::list<CacheEntry>::iterator> cache;
-// };
-
-// #define TDECL template<typename Key, typename Value>
-// #define TARGS <Key, Value>
-
-// TDECL
-// typename BlockCache TARGS::value_ptr
-// BlockCache TARGS::
-// get(Key const& key)
-// {
-//     auto iter = cache.find(key);
-//     if(iter == cache.end()) 
-//         return value_ptr();
-
-//     /*
-//      * currently each block holds a single instance of stream
-//      * we do not support multiple access at the same time due to get/put pointers
-//      */
-//     assert(iter->second->second.unique());
-
-//     entries.splice(entries.begin(), entries, iter->second);
-//     return iter->second->second;
-// }
-
-// TDECL
-// void
-// BlockCache TARGS::
-// put(Key const& key, value_ptr const& value)
-// {
-// //    auto iter = cache.find(key);
-// //    assert(iter == cache.end());
-
-//     if((capacity > 0) && (entries.size() > capacity))
-//         compact();
-
-//     entries.push_front(std::make_pair(key, value));
-//     cache.insert(std::make_pair(key, entries.begin()));
-// }
-
-// TDECL
-// void
-// BlockCache TARGS::
-// flush(void)
-// {
-//     entries.clear();
-//     cache.clear();
-// }
-
-
-// TDECL
-// void
-// BlockCache TARGS::
-// compact(void)
-// {
-//     while(entries.size() > capacity)
-//     {
-//         cache.erase(entries.back().first);
-//         entries.pop_back();
-//     }
-// }
-
-// #undef TDECL
-// #undef TARGS
-
-// } // namespace rtree
-
-// #endif //BLOCK_CACHE_H__
+/*
+ * A bounded buffer pool for the block manager
+ *
+ * blocks are kept in fixed size frames and evicted with the CLOCK algorithm.
+ * a frame is pinned while someone is reading from it, pinned frames are never evicted.
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+
+namespace rtree {
+
+struct BlockCache
+{
+    struct Frame
+    {
+        bid_t bid = INVALID_BID;
+        char * data = nullptr;
+
+        std::atomic<int> pins{0};
+        std::atomic<bool> referenced{false};
+        // false while the owner of the miss is still filling `data`
+        std::atomic<bool> ready{false};
+        // the read failed, or a write went to the storage while it was going on,
+        // so `data` must not be used by the other threads (see pin)
+        std::atomic<bool> failed{false};
+    };
+
+    // capacity is in bytes, 0 for unlimited
+    BlockCache(size_t block_size, size_t capacity)
+        : block_size(block_size)
+    {
+        set_capacity(capacity);
+    }
+
+    BlockCache(BlockCache const&) = delete;
+    BlockCache & operator = (BlockCache const&) = delete;
+
+    ~BlockCache() {
+        for(auto * frame : frames)
+        {
+            free(frame->data);
+            delete frame;
+        }
+    }
+
+    /*
+     * Pin the frame holding `bid`
+     * `hit` is set to false if the frame has just been assigned to `bid`,
+     * in which case the caller must fill in frame->data and then call `loaded`
+     *
+     * returns nullptr if every frame is pinned (the caller should bypass the cache)
+     */
+    Frame *
+    pin(bid_t bid, bool & hit) {
+        while(true)
+        {
+            Frame * frame = nullptr;
+            {
+                std::lock_guard<std::mutex> lck(lock);
+                auto iter = table.find(bid);
+                if(iter != table.end())
+                {
+                    frame = iter->second;
+                    ++ frame->pins;
+                    hit = true;
+                }
+                else
+                {
+                    frame = victim();
+                    if(frame == nullptr)
+                        return nullptr;
+
+                    assign(frame, bid);
+                    hit = false;
+                }
+            }
+
+            frame->referenced = true;
+            if(!hit)
+            {
+                ++ miss_count;
+                return frame;
+            }
+
+            // another thread is still reading the block from the disk
+            while(!frame->ready)
+                std::this_thread::yield();
+            if(!frame->failed)
+            {
+                ++ hit_count;
+                return frame;
+            }
+
+            // the frame has left the table, look `bid` up again
+            unpin(frame);
+        }
+    }
+
+    /*
+     * Pin a fresh frame for `bid` ahead of its use
+     * returns nullptr if `bid` is already cached (or being read) or if every frame is pinned,
+     * otherwise the caller must fill the frame and call `loaded` or `abandon`
+     */
+    Frame *
+    reserve(bid_t bid) {
+        std::lock_guard<std::mutex> lck(lock);
+        if(table.find(bid) != table.end())
+            return nullptr;
+
+        Frame * frame = victim();
+        if(frame == nullptr)
+            return nullptr;
+
+        assign(frame, bid);
+        frame->referenced = true;
+        ++ miss_count;
+        return frame;
+    }
+
+    /*
+     * The block has been read into a freshly pinned frame
+     * if a write raced with the read, the frame is dropped from the table,
+     * the caller may still use what it read
+     */
+    void
+    loaded(Frame * frame) {
+        std::lock_guard<std::mutex> lck(lock);
+        if(frame->failed)
+            forget(frame);
+        frame->ready = true;
+    }
+
+    /*
+     * The block could not be read into a freshly pinned frame, give it up
+     * the threads waiting for it look the block up again
+     */
+    void
+    abandon(Frame * frame) {
+        {
+            std::lock_guard<std::mutex> lck(lock);
+            frame->failed = true;
+            forget(frame);
+            frame->ready = true;
+        }
+        unpin(frame);
+    }
+
+    void
+    unpin(Frame * frame) {
+        assert(frame->pins > 0);
+        -- frame->pins;
+    }
+
+    /*
+     * Write-through, update the cached copy of `bid` if there is one
+     */
+    void
+    update(bid_t bid, char const * data) {
+        std::lock_guard<std::mutex> lck(lock);
+        auto iter = table.find(bid);
+        if(iter == table.end())
+            return;
+        if(iter->second->ready)
+            memcpy(iter->second->data, data, block_size);
+        else
+            // the block is being read, what is read might be older than `data`
+            iter->second->failed = true;
+    }
+
+    /*
+     * Forget about [bid, bid + size), used when blocks are freed
+     */
+    void
+    invalidate(bid_t bid, size_t size) {
+        std::lock_guard<std::mutex> lck(lock);
+        for(size_t i = 0; i < size; ++i)
+        {
+            auto iter = table.find(bid + i);
+            if(iter != table.end() && iter->second->pins == 0)
+            {
+                iter->second->bid = INVALID_BID;
+                table.erase(iter);
+            }
+        }
+    }
+
+    /*
+     * Drop every block that is not pinned
+     */
+    void
+    flush(void) {
+        std::lock_guard<std::mutex> lck(lock);
+        for(auto * frame : frames)
+        {
+            if(frame->bid != INVALID_BID && frame->pins == 0)
+            {
+                table.erase(frame->bid);
+                frame->bid = INVALID_BID;
+            }
+        }
+        trim();
+    }
+
+    // 0 for unlimited
+    void
+    set_capacity(size_t c) {
+        std::lock_guard<std::mutex> lck(lock);
+        capacity = c;
+        max_frames = (c == 0) ? 0 : std::max<size_t>(1, c / block_size);
+        trim();
+    }
+
+    size_t get_capacity(void) const { return capacity; }
+
+    // number of blocks cached
+    size_t
+    size(void) const {
+        std::lock_guard<std::mutex> lck(lock);
+        return table.size();
+    }
+
+    size_t get_hits(void) const { return hit_count; }
+    size_t get_misses(void) const { return miss_count; }
+
+    void
+    reset_counters(void) {
+        hit_count = 0;
+        miss_count = 0;
+    }
+
+private:
+    // must hold `lock`
+    void
+    assign(Frame * frame, bid_t bid) {
+        if(frame->bid != INVALID_BID)
+            table.erase(frame->bid);
+        frame->bid = bid;
+        frame->ready = false;
+        frame->failed = false;
+        frame->pins = 1;
+        table.insert(std::make_pair(bid, frame));
+    }
+
+    // must hold `lock`
+    void
+    forget(Frame * frame) {
+        table.erase(frame->bid);
+        frame->bid = INVALID_BID;
+    }
+
+    /*
+     * Release the frames over `max_frames`, those pinned when the capacity
+     * was lowered go on the next call after they are unpinned
+     * must hold `lock`
+     */
+    void
+    trim(void) {
+        if(max_frames == 0)
+            return;
+        for(size_t i = max_frames; i < frames.size(); )
+        {
+            Frame * frame = frames[i];
+            if(frame->pins > 0)
+            {
+                ++ i;
+                continue;
+            }
+            if(frame->bid != INVALID_BID)
+                table.erase(frame->bid);
+            free(frame->data);
+            delete frame;
+            frames[i] = frames.back();
+            frames.pop_back();
+        }
+    }
+
+    // must hold `lock`
+    Frame *
+    victim(void) {
+        trim();
+        if(max_frames == 0 || frames.size() < max_frames)
+        {
+            // still growing
+            auto * frame = new Frame();
+            // frames are aligned so the storage can read into them directly
+            if(posix_memalign((void**)&frame->data, 4096, block_size) != 0)
+            {
+                delete frame;
+                throw std::bad_alloc();
+            }
+            frames.push_back(frame);
+            return frame;
+        }
+
+        // the capacity might have been lowered, only use the first `max_frames` frames
+        // two full sweeps, the first one may only clear the reference bits
+        clock_hand %= max_frames;
+        for(size_t i = 0; i < max_frames * 2; ++i)
+        {
+            Frame * frame = frames[clock_hand];
+            clock_hand = (clock_hand + 1) % max_frames;
+
+            if(frame->pins > 0 || (frame->bid != INVALID_BID && !frame->ready))
+                continue;
+
+            if(frame->referenced && frame->bid != INVALID_BID)
+            {
+                frame->referenced = false;
+                continue;
+            }
+
+            return frame;
+        }
+
+        return nullptr;
+    }
+
+    size_t block_size;
+    size_t capacity;
+    size_t max_frames;
+
+    mutable std::mutex lock;
+    std::unordered_map<bid_t, Frame*> table;
+    std::vector<Frame*> frames;
+    size_t clock_hand = 0;
+
+    std::atomic<size_t> hit_count{0};
+    std::atomic<size_t> miss_count{0};
+};
+
+} // namespace rtree
@@ -20,6 +20,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <stdexcept>
+#include <algorithm>
+#include <climits>
 #include <sys/mman.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -33,84 +35,259 @@ namespace rtree {
 Block::~Block()
 {
     if(mode & WRITE)
-        owner.write_block(*this);
+        owner.write_block(bid, data);
     delete [] data;
 }
 
+BlockView::BlockView(BlockManager & owner, bid_t bid)
+    : owner(owner)
+    , bid(bid)
+    , data(owner.pin_block(bid, buffer, frame))
+    , stream(data, owner.block_size)
+{
+    stream.exceptions(stream_t::failbit | stream_t::badbit);
+}
+
+BlockView::~BlockView()
+{
+    owner.unpin_block(frame, !buffer);
+}
+
+StorageKind BlockManager::default_storage = StorageKind::DEFAULT;
+bool BlockManager::huge_pages = false;
+
+// std::min takes them by reference
+constexpr size_t BlockManager::max_small_extent;
+constexpr size_t BlockManager::allocation_batch;
+
 std::unique_ptr<BlockManager>
-BlockManager::create(std::string const& name, size_t block_size, size_t cache_size)
+BlockManager::create(std::string const& name, size_t block_size, size_t cache_size, StorageKind storage_kind,
+        StripingParameters const& striping)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
     // create files
     { std::ofstream _(name + ".metadata"); }
-    { std::ofstream _(name + ".data"); }
+    for(size_t i = 0; i < striping.file_count(); ++i)
+    {
+        std::ofstream _(striping.file_name(name, i));
+        if(!_)
+            throw std::runtime_error("BlockManager: cannot create " + striping.file_name(name, i));
+    }
    
-    // since the block manager is new, we will allow it to increase the size
-    // building is single threaded so this should be okay.
-    BlockManager * p = new BlockManager(name, false);
+    std::unique_ptr<BlockManager> p(new BlockManager(name));
     p->block_size = block_size;
+    p->striping = striping;
+    if(storage_kind == StorageKind::DEFAULT)
+        storage_kind = default_storage;
+    // building writes every block once, no need to map them
+    if(storage_kind == StorageKind::DEFAULT)
+        storage_kind = StorageKind::SYSCALL;
+    p->set_storage(storage_kind);
+    p->set_cache_capacity(cache_size);
     p->save_meta_data();
-    return std::unique_ptr<BlockManager>(p);
+    return p;
 }
 
 std::unique_ptr<BlockManager>
-BlockManager::load(std::string const& name, size_t cache_size)
+BlockManager::load(std::string const& name, size_t cache_size, StorageKind storage_kind)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    // block manager is created with static size.  We expect that
-    // we will only be submitting queries, so we would like multi threaded
-    // support but don't care about modifying the data structure at this time
-    BlockManager * p = new BlockManager(name, true);
+    // the data file is memory mapped by default, the mapping grows if
+    // inserts need more blocks
+    std::unique_ptr<BlockManager> p(new BlockManager(name));
     p->load_meta_data();
-    p->memory_map_data();
-    return std::unique_ptr<BlockManager>(p);
+    if(storage_kind == StorageKind::DEFAULT)
+        storage_kind = default_storage;
+    if(storage_kind == StorageKind::DEFAULT)
+        storage_kind = StorageKind::MMAP;
+    p->set_storage(storage_kind);
+    p->set_cache_capacity(cache_size);
+    return p;
+}
+
+void
+BlockManager::set_storage(StorageKind kind)
+{
+    assert(m_pinned_views == 0);
+    if(kind == StorageKind::DEFAULT)
+        kind = default_storage;
+    if(kind == StorageKind::DEFAULT)
+        kind = StorageKind::MMAP;
+
+    // write back everything before the file is opened again
+    storage.reset();
+    storage = StorageBackend::open(kind, name, striping, block_size, huge_pages);
+    if(file_advice != AccessAdvice::NORMAL)
+        storage->advise(0, 0, file_advice);
+}
+
+namespace {
+
+// the metadata files written before this format start with the block size
+constexpr uint64_t metadata_magic = 0x4154454d42535352ULL; // "RSBMETA" + 'A'
+constexpr uint32_t metadata_version = 2;
+
+void
+dump_bids(std::ostream & out, std::vector<bid_t> bids)
+{
+    std::sort(bids.begin(), bids.end());
+    dump_varint(out, bids.size());
+    bid_t last = 0;
+    for(auto bid : bids)
+    {
+        dump_varint(out, bid - last);
+        last = bid;
+    }
+}
+
+void
+load_bids(std::istream & in, std::vector<bid_t> & bids)
+{
+    uint64_t count, delta;
+    load_varint(in, count);
+    bids.clear();
+    bids.reserve(count);
+    bid_t last = 0;
+    for(uint64_t i = 0; i < count; ++i)
+    {
+        load_varint(in, delta);
+        last += delta;
+        bids.push_back(last);
+    }
 }
 
+} // anonymous namespace
+
+/*
+ * .metadata format
+ *  magic, version, block_size, next_free_block: fixed size
+ *  then (since version 2) the striping: width, count of directories, each as length and characters
+ *  then for the free lists of 1 and 2 blocks: count, sorted bids as deltas
+ *  then the larger extents: count, (bid delta, size) pairs
+ *  all variable length integers
+ */
 void
 BlockManager::save_meta_data (void)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    m_manager_lock.lock();
+    drain_allocation_shards();
+
+    std::lock_guard<std::mutex> lck(m_manager_lock);
 
     metadata_file.seekp(0);
-    dump_value(metadata_file, block_size);
+    dump_value(metadata_file, metadata_magic);
+    dump_value(metadata_file, metadata_version);
+    dump_value(metadata_file, (uint64_t)block_size);
+    dump_value(metadata_file, (uint64_t)next_free_block);
+
+    dump_varint(metadata_file, striping.width);
+    dump_varint(metadata_file, striping.directories.size());
+    for(auto const& directory : striping.directories)
+    {
+        dump_varint(metadata_file, directory.size());
+        metadata_file.write(directory.data(), directory.size());
+    }
+
+    for(size_t s = 1; s <= max_small_extent; ++s)
+        dump_bids(metadata_file, free_lists[s]);
 
-    dump_value(metadata_file, free_block_map.size());
+    dump_varint(metadata_file, free_block_map.size());
+    bid_t last = 0;
     for(auto const& p : free_block_map) 
     {
-        dump_value(metadata_file, p.first);
-        dump_value(metadata_file, p.second);
+        dump_varint(metadata_file, p.first - last);
+        dump_varint(metadata_file, p.second);
+        last = p.first;
     }
+    metadata_file.flush();
 
-    dump_value(metadata_file, next_free_block);
-
-    m_manager_lock.unlock();
+    // the blocks past the last one allocated are only padding (see MmapStorage::grow)
+    if(storage)
+        storage->shrink_to(next_free_block);
 }
 
 void
 BlockManager::load_meta_data (void)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    m_manager_lock.lock();
+    std::lock_guard<std::mutex> lck(m_manager_lock);
+
+    for(auto & l : free_lists)
+        l.clear();
+    free_block_map.clear();
 
     metadata_file.seekg(0);
-    load_value(metadata_file, block_size);
+    uint64_t head;
+    load_value(metadata_file, head);
 
-    size_t s;
-    load_value(metadata_file, s);
-    free_block_map.clear();
-    for(size_t i = 0; i < s; ++i)
+    if(head != metadata_magic)
     {
-        bid_t bid;
-        size_t size;
-        load_value(metadata_file, bid);
-        load_value(metadata_file, size);
-        free_block_map.insert(std::make_pair(bid, size));
+        // the original format: block_size, count, (bid, size) pairs, next_free_block
+        block_size = head;
+
+        size_t s;
+        load_value(metadata_file, s);
+        for(size_t i = 0; i < s; ++i)
+        {
+            bid_t bid;
+            size_t size;
+            load_value(metadata_file, bid);
+            load_value(metadata_file, size);
+            free_shared(bid, size);
+        }
+
+        load_value(metadata_file, next_free_block);
+        return;
     }
 
-    load_value(metadata_file, next_free_block);
+    uint32_t version;
+    load_value(metadata_file, version);
+    if(version > metadata_version)
+        throw std::runtime_error("BlockManager: unsupported metadata version " + std::to_string(version));
+
+    uint64_t v;
+    load_value(metadata_file, v);
+    block_size = v;
+    load_value(metadata_file, v);
+    next_free_block = v;
+
+    striping = StripingParameters();
+    if(version >= 2)
+    {
+        uint64_t count, length;
+        load_varint(metadata_file, v);
+        striping.width = v;
+        load_varint(metadata_file, count);
+        for(uint64_t i = 0; i < count && metadata_file; ++i)
+        {
+            load_varint(metadata_file, length);
+            if(length > PATH_MAX)
+            {
+                metadata_file.setstate(std::ios::failbit);
+                break;
+            }
+            std::string directory(length, '\0');
+            metadata_file.read(&directory[0], length);
+            striping.directories.push_back(directory);
+        }
+    }
+
+    for(size_t s = 1; s <= max_small_extent; ++s)
+        load_bids(metadata_file, free_lists[s]);
+
+    uint64_t count, delta, size;
+    load_varint(metadata_file, count);
+    bid_t last = 0;
+    for(uint64_t i = 0; i < count; ++i)
+    {
+        load_varint(metadata_file, delta);
+        load_varint(metadata_file, size);
+        last += delta;
+        free_block_map.insert(free_block_map.end(), std::make_pair(last, size));
+    }
 
-    m_manager_lock.unlock();
+    if(!metadata_file)
+        throw std::runtime_error("BlockManager: corrupted metadata file");
 }
 
 
@@ -126,7 +303,7 @@ BlockManager::get_block(bid_t bid, int mode)
 
     assert(block);
     if(mode & Block::READ)
-        read_block(*block);
+        read_block(bid, block->data);
 
     return block;
 }
@@ -135,24 +312,90 @@ bid_t
 BlockManager::allocate_blocks(size_t size)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
+    assert(size > 0);
+
+    if(size <= max_small_extent)
+    {
+        auto & shard = get_allocation_shard();
+        std::lock_guard<std::mutex> shard_lck(shard.lock);
+        auto & cached = shard.free_lists[size];
+
+        if(cached.empty())
+        {
+            // refill from the shared list
+            std::lock_guard<std::mutex> lck(m_manager_lock);
+            auto & shared = free_lists[size];
+            size_t n = std::min(allocation_batch, shared.size());
+            cached.assign(shared.end() - n, shared.end());
+            shared.resize(shared.size() - n);
+
+            if(cached.empty())
+                return allocate_shared(size);
+        }
+
+        bid_t bid = cached.back();
+        cached.pop_back();
+        return bid;
+    }
+
     // this will automatically unlock when we return or thrown an exception
     std::lock_guard<std::mutex> lck(m_manager_lock);
+    return allocate_shared(size);
+}
 
-    for(auto iter = free_block_map.begin(); iter != free_block_map.end(); ++iter)
+bid_t
+BlockManager::allocate_shared(size_t size)
+{
+    if(size <= max_small_extent)
     {
-        if(iter->second >= size) 
+        for(size_t s = size; s <= max_small_extent; ++s)
         {
+            if(free_lists[s].empty())
+                continue;
+
+            bid_t bid = free_lists[s].back();
+            free_lists[s].pop_back();
+            // keep the rest of a larger extent
+            if(s > size)
+                free_lists[s - size].push_back(bid + size);
+            return bid;
+        }
+
+        // every extent in the map is larger than a small one, take the first
+        if(!free_block_map.empty())
+        {
+            auto iter = free_block_map.begin();
             auto bid = iter->first + iter->second - size;
             iter->second -= size;
-            if(iter->second == 0)
+            if(iter->second <= max_small_extent)
+            {
+                free_lists[iter->second].push_back(iter->first);
                 free_block_map.erase(iter);
+            }
             return bid;
         }
     }
+    else
+    {
+        for(auto iter = free_block_map.begin(); iter != free_block_map.end(); ++iter)
+        {
+            if(iter->second >= size) 
+            {
+                auto bid = iter->first + iter->second - size;
+                iter->second -= size;
+                if(iter->second == 0)
+                    free_block_map.erase(iter);
+                else if(iter->second <= max_small_extent)
+                {
+                    free_lists[iter->second].push_back(iter->first);
+                    free_block_map.erase(iter);
+                }
+                return bid;
+            }
+        }
+    }
 
-    if(this->m_static_size == true)
-        throw std::runtime_error("BlockManager::allocate_blocks attempted to increase the number of allocated blocks!");
-
+    // the storage grows when the new blocks are written
     bid_t bid = next_free_block;
     next_free_block += size;
     return bid;
@@ -162,9 +405,53 @@ void
 BlockManager::free_blocks(bid_t bid, size_t size)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
+    assert(bid != INVALID_BID);
+    assert(size > 0);
+
+    if(block_cache)
+        block_cache->invalidate(bid, size);
+
+    if(size <= max_small_extent)
+    {
+        auto & shard = get_allocation_shard();
+        std::lock_guard<std::mutex> shard_lck(shard.lock);
+        auto & cached = shard.free_lists[size];
+        cached.push_back(bid);
+
+        // give a batch back so other threads can use it
+        if(cached.size() >= allocation_batch * 2)
+        {
+            std::vector<std::pair<bid_t, size_t>> extents;
+            for(size_t i = 0; i < allocation_batch; ++i)
+                extents.emplace_back(cached[i], size);
+            cached.erase(cached.begin(), cached.begin() + allocation_batch);
+
+            std::lock_guard<std::mutex> lck(m_manager_lock);
+            release_extents(extents);
+        }
+        return;
+    }
+
     // this will automatically unlock when we return or thrown an exception
     std::lock_guard<std::mutex> lck(m_manager_lock);
+    free_shared(bid, size);
+}
+
+void
+BlockManager::free_shared(bid_t bid, size_t size)
+{
+    if(size <= max_small_extent)
+    {
+        free_lists[size].push_back(bid);
+        return;
+    }
+
+    free_in_map(bid, size);
+}
 
+void
+BlockManager::free_in_map(bid_t bid, size_t size)
+{
     bool inserted = false;
     auto iter = free_block_map.lower_bound(bid);
     if(iter != free_block_map.begin())
@@ -201,82 +488,305 @@ BlockManager::free_blocks(bid_t bid, size_t size)
     }
 }
 
-BlockManager::BlockManager (std::string const& name, bool static_size)
-    : name{name}
-    , metadata_file(name + ".metadata", std::fstream::in | std::fstream::out | std::fstream::binary)
-    , m_static_size{static_size}
-    , m_allocated_memory_size{0}
-    , mp_data_memory{nullptr}
-    //,data_file(name + ".data", std::fstream::in | std::fstream::out | std::fstream::binary)
+void
+BlockManager::release_extents(std::vector<std::pair<bid_t, size_t>> & extents)
 {
-    //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    std::string data_file_name = name + ".data";
-    data_file_descriptor = open(data_file_name.c_str(), O_RDWR);
+    std::sort(extents.begin(), extents.end());
+
+    // merge the extents next to each other
+    size_t n = 0;
+    for(size_t i = 0; i < extents.size(); ++i)
+    {
+        if(n > 0 && extents[n - 1].first + extents[n - 1].second >= extents[i].first)
+        {
+            // overlapping extents, the same blocks were freed twice
+            assert(extents[n - 1].first + extents[n - 1].second == extents[i].first);
+            extents[n - 1].second += extents[i].second;
+        }
+        else
+            extents[n++] = extents[i];
+    }
+    extents.resize(n);
+
+    for(auto const& extent : extents)
+    {
+        bid_t end = extent.first + extent.second;
+        auto next = free_block_map.lower_bound(extent.first);
+        bool touches = false;
+        if(next != free_block_map.end())
+        {
+            assert(next->first >= end);
+            touches = next->first == end;
+        }
+        if(next != free_block_map.begin())
+        {
+            auto prev = std::prev(next);
+            assert(prev->first + prev->second <= extent.first);
+            touches = touches || prev->first + prev->second == extent.first;
+        }
+
+        if(touches || extent.second > max_small_extent)
+            free_in_map(extent.first, extent.second);
+        else
+            free_lists[extent.second].push_back(extent.first);
+    }
 }
 
 void
-BlockManager::memory_map_data()
+BlockManager::drain_allocation_shards(void)
 {
-    //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    // we must have a static size because otherwise we have to to some more
-    // complicated locking to make sure we remap the file with a large capacity
-    assert(m_static_size);
-
-    // get the size of the file
-    m_allocated_memory_size = lseek(data_file_descriptor, 0, SEEK_END);
-
-    // map the file
-    mp_data_memory = mmap(NULL
-                        , m_allocated_memory_size
-                        , PROT_READ | PROT_WRITE
-                        , MAP_SHARED
-                        , data_file_descriptor
-                        , 0);
+    std::vector<std::pair<bid_t, size_t>> extents;
+    for(auto & shard : allocation_shards)
+    {
+        std::lock_guard<std::mutex> shard_lck(shard.lock);
+        for(size_t s = 1; s <= max_small_extent; ++s)
+        {
+            for(auto bid : shard.free_lists[s])
+                extents.emplace_back(bid, s);
+            shard.free_lists[s].clear();
+        }
+    }
+
+    std::lock_guard<std::mutex> lck(m_manager_lock);
+    for(size_t s = 1; s <= max_small_extent; ++s)
+    {
+        for(auto bid : free_lists[s])
+            extents.emplace_back(bid, s);
+        free_lists[s].clear();
+    }
+    release_extents(extents);
+}
+
+size_t
+BlockManager::get_free_block_count(void)
+{
+    drain_allocation_shards();
+
+    std::lock_guard<std::mutex> lck(m_manager_lock);
+    size_t count = 0;
+    for(size_t s = 1; s <= max_small_extent; ++s)
+        count += free_lists[s].size() * s;
+    for(auto const& p : free_block_map)
+        count += p.second;
+    return count;
 }
 
 void
-BlockManager::read_block(Block const& block)
+BlockManager::prefetch_blocks(std::vector<bid_t> const& bids)
 {
-    //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    ++ stats.read;
-    if(mp_data_memory == nullptr)
+    if(bids.empty())
+        return;
+
+    // the mapped blocks are read from the mapping, not through the pool (see pin_block)
+    if(!block_cache || storage->kind() == StorageKind::MMAP)
+    {
+        for(auto bid : bids)
+            storage->will_need(bid);
+        return;
+    }
+
+    std::vector<BlockCache::Frame*> frames;
+    std::vector<StorageBackend::ReadRequest> batch;
+    frames.reserve(bids.size());
+    batch.reserve(bids.size());
+    for(auto bid : bids)
     {
-        m_manager_lock.lock();
-        // TODO: check for errors.
-        lseek(data_file_descriptor, block.bid * block_size, SEEK_SET);
-        ssize_t rv = read(data_file_descriptor, block.data, block_size);
-
-        // we should always read the correct number of bytes since the file should be aligned
-        assert(rv == block_size);
-        m_manager_lock.unlock();
+        auto * frame = block_cache->reserve(bid);
+        if(frame != nullptr)
+        {
+            frames.push_back(frame);
+            batch.push_back({bid, frame->data, false});
+        }
     }
-    else // if we have a memory mapped file
+
+    storage->read_batch(batch);
+
+    for(size_t i = 0; i < frames.size(); ++i)
+    {
+        if(batch[i].done)
+        {
+            block_cache->loaded(frames[i]);
+            block_cache->unpin(frames[i]);
+        }
+        else
+        {
+            // leave it to the real read to report the problem
+            block_cache->abandon(frames[i]);
+        }
+    }
+}
+
+void
+BlockManager::advise(bid_t bid, size_t count, AccessAdvice advice)
+{
+    advise(std::vector<std::pair<bid_t, size_t>>{{bid, count}}, advice);
+}
+
+void
+BlockManager::advise(AccessAdvice advice)
+{
+    if(advice != AccessAdvice::WILLNEED && advice != AccessAdvice::DONTNEED)
     {
-        memcpy(block.data, &((char*)mp_data_memory)[block.bid * block_size], block_size);
+        // every query may ask, only the changes go to the storage
+        if(file_advice.exchange(advice) == advice)
+            return;
     }
+    storage->advise(0, 0, advice);
 }
 
 void
-BlockManager::write_block(Block const& block)
+BlockManager::advise(std::vector<std::pair<bid_t, size_t>> extents, AccessAdvice advice)
+{
+    if(extents.empty())
+        return;
+
+    if(advice == AccessAdvice::WILLNEED && block_cache)
+    {
+        std::vector<bid_t> bids;
+        for(auto const& extent : extents)
+        {
+            for(size_t i = 0; i < extent.second; ++i)
+                bids.push_back(extent.first + i);
+        }
+        prefetch_blocks(bids);
+        return;
+    }
+    if(advice == AccessAdvice::DONTNEED && block_cache)
+    {
+        for(auto const& extent : extents)
+            block_cache->invalidate(extent.first, extent.second);
+    }
+
+    advise_storage(std::move(extents), advice);
+}
+
+void
+BlockManager::advise_storage(std::vector<std::pair<bid_t, size_t>> extents, AccessAdvice advice)
+{
+    if(extents.empty())
+        return;
+
+    std::sort(extents.begin(), extents.end());
+    auto run = extents.front();
+    for(size_t i = 1; i <= extents.size(); ++i)
+    {
+        if(i < extents.size() && extents[i].first <= run.first + run.second)
+        {
+            run.second = std::max(run.second, extents[i].first + extents[i].second - run.first);
+            continue;
+        }
+        if(run.second > 0)
+            storage->advise(run.first, run.second, advice);
+        if(i < extents.size())
+            run = extents[i];
+    }
+}
+
+BlockManager::BlockManager (std::string const& name)
+    : name{name}
+    , metadata_file(name + ".metadata", std::fstream::in | std::fstream::out | std::fstream::binary)
+    , file_advice{AccessAdvice::NORMAL}
+    , m_pinned_views{0}
+    , read_count{0}
+    , write_count{0}
+{
+}
+
+void
+BlockManager::read_block(bid_t bid, char * data)
 {
     //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
-    ++ stats.write;
-    if(mp_data_memory == nullptr)
+    ++ read_count;
+    // a copy from the mapping is as cheap as one from the pool
+    char const * address = storage->address(bid);
+    if(address != nullptr)
     {
-        m_manager_lock.lock();
-        // TODO: check for errors.
-        lseek(data_file_descriptor, block.bid * block_size, SEEK_SET);
-        ssize_t rv = write(data_file_descriptor, block.data, block_size);
-
-        // we should always write the correct number of bytes.  If it is not the
-        // same it is returning an error anyway
-        assert(rv == block_size);
-        m_manager_lock.unlock();
+        memcpy(data, address, block_size);
+        return;
     }
-    else // if we have a memory mapped file
+
+    auto * frame = pin_cached(bid);
+    if(frame != nullptr)
     {
-        memcpy(&((char*)mp_data_memory)[block.bid * block_size], block.data, block_size);
+        memcpy(data, frame->data, block_size);
+        block_cache->unpin(frame);
+    }
+    else
+        read_from_disk(bid, data);
+}
+
+BlockCache::Frame *
+BlockManager::pin_cached(bid_t bid)
+{
+    if(!block_cache)
+        return nullptr;
+
+    bool hit;
+    auto * frame = block_cache->pin(bid, hit);
+    if(frame != nullptr && !hit)
+    {
+        try {
+            read_from_disk(bid, frame->data);
+        } catch(...) {
+            block_cache->abandon(frame);
+            throw;
+        }
+        block_cache->loaded(frame);
     }
+    // nullptr if every frame is pinned
+    return frame;
+}
+
+void
+BlockManager::read_from_disk(bid_t bid, char * data)
+{
+    storage->read(bid, data);
+}
+
+char const *
+BlockManager::pin_block(bid_t bid, std::unique_ptr<char[]> & buffer, BlockCache::Frame * & frame)
+{
+    assert(bid != INVALID_BID);
+    ++ read_count;
+
+    // the mapped blocks are never copied into the pool
+    char const * address = storage->address(bid);
+    if(address == nullptr)
+    {
+        frame = pin_cached(bid);
+        if(frame != nullptr)
+            address = frame->data;
+    }
+
+    if(address == nullptr)
+    {
+        buffer.reset(new char[block_size]);
+        read_from_disk(bid, buffer.get());
+        return buffer.get();
+    }
+
+    ++ m_pinned_views;
+    return address;
+}
+
+void
+BlockManager::unpin_block(BlockCache::Frame * frame, bool in_storage)
+{
+    if(frame != nullptr)
+        block_cache->unpin(frame);
+    if(in_storage)
+        -- m_pinned_views;
+}
+
+void
+BlockManager::write_block(bid_t bid, char const * data)
+{
+    //std::cerr << "starting " << __func__ << " line: " << __LINE__ << std::endl;
+    ++ write_count;
+    storage->write(bid, data);
+
+    if(block_cache)
+        block_cache->update(bid, data);
 }
 
 
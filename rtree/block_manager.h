@@ -25,8 +25,11 @@ SOFTWARE.
 #include <boost/iostreams/device/array.hpp>
 #include <sys/mman.h>
 #include <mutex>
+#include <atomic>
+#include <thread>
 
-//#include "block_cache.h"
+#include "block_cache.h"
+#include "storage_backend.h"
 
 namespace rtree {
 
@@ -72,16 +75,69 @@ struct Block
     BlockManager & owner;
 };
 
+/*
+ * A read-only view of a block
+ *
+ * the view points directly into the memory mapped data file,
+ * or into the frame of the buffer pool holding the block for the other storages,
+ * so no copy is made. Otherwise the block is read into a private buffer.
+ * the frame (or the mapping) is pinned while the view is alive
+ */
+struct BlockView
+{
+    using stream_t = bi::stream<bi::basic_array_source<char>>;
+
+    BlockView(BlockManager & owner, bid_t bid);
+
+    BlockView(BlockView const&) = delete;
+    BlockView & operator = (BlockView const&) = delete;
+
+    ~BlockView();
+
+    stream_t &
+    get_stream(void) {
+        stream.seekg(0);
+        return stream;
+    }
+
+    char const *
+    get_data(void) const { return data; }
+
+    BlockManager & owner;
+    bid_t bid;
+
+private:
+    std::unique_ptr<char[]> buffer;
+    BlockCache::Frame * frame = nullptr;
+    char const * data;
+    stream_t stream;
+};
+
 struct BlockManager
 {
+    // the capacity of the buffer pool, in blocks (unused with MMAP, see set_cache_budget)
     static constexpr 
     size_t default_cache_size = 4096;
 
+    // the storage used when StorageKind::DEFAULT is asked for
+    // left to DEFAULT, trees are built with SYSCALL and loaded with MMAP
+    // (so the loaded trees read their blocks from the mapping, not through the buffer pool)
+    // every storage grows with the tree, so a loaded tree accepts inserts
+    static StorageKind default_storage;
+
+    // map the data file aligned to, and hinted to be backed by, 2 MB pages (MMAP only)
+    // see also HugePageArena for the memory of the nodes
+    static bool huge_pages;
+
+    // the striping is saved in the metadata, load opens the same data files
     static std::unique_ptr<BlockManager>
-    create (std::string const& name, size_t block_size, size_t cache_size = default_cache_size);
+    create (std::string const& name, size_t block_size, size_t cache_size = default_cache_size,
+            StorageKind storage_kind = StorageKind::DEFAULT,
+            StripingParameters const& striping = StripingParameters());
 
     static std::unique_ptr<BlockManager>
-    load (std::string const& name, size_t cache_size = default_cache_size);
+    load (std::string const& name, size_t cache_size = default_cache_size,
+            StorageKind storage_kind = StorageKind::DEFAULT);
 
     void save_meta_data(void);
     void load_meta_data(void);
@@ -89,96 +145,347 @@ struct BlockManager
     struct Stats {
         size_t read = 0;
         size_t write = 0;
+        // reads served by / missed in the buffer pool, none with MMAP
+        size_t cache_hit = 0;
+        size_t cache_miss = 0;
         size_t cost (void) const { return read + write; }
     };
 
-    Stats get_stats (void) const { return stats; }
-    void reset_stats (void) { stats = Stats(); }
+    Stats get_stats (void) const {
+        Stats s;
+        s.read = read_count;
+        s.write = write_count;
+        if(block_cache)
+        {
+            s.cache_hit = block_cache->get_hits();
+            s.cache_miss = block_cache->get_misses();
+        }
+        return s;
+    }
+    void reset_stats (void) {
+        read_count = 0;
+        write_count = 0;
+        if(block_cache)
+            block_cache->reset_counters();
+    }
     
     size_t get_block_size (void) const { return block_size; }
 
+    StripingParameters const& get_striping (void) const { return striping; }
+
+    /*
+     * Whether the io leaf nodes encode their values with leaf_codec
+     * it is a property of the tree (IOLayersParameters::compress_leaves),
+     * kept here because the nodes only see the block manager. it is not saved in the metadata
+     */
+    void set_compress_leaves (bool c) { compress_leaves = c; }
+    bool get_compress_leaves (void) const { return compress_leaves; }
+
+    // whether the io leaf nodes store their values in columns (IOLayersParameters::columnar_leaves), for the same reason
+    void set_columnar_leaves (bool c) { columnar_leaves = c; }
+    bool get_columnar_leaves (void) const { return columnar_leaves; }
+
+    // the layout of the arrays in the nodes (IOLayersParameters::node_format), for the same reason
+    // 1: 16 bit sizes, 2: 32 bit sizes
+    void set_node_format (uint32_t f) { node_format = f; }
+    uint32_t get_node_format (void) const { return node_format; }
+
     std::unique_ptr<Block>
     get_block(bid_t bid, int mode);
 
+    /*
+     * Extents of 1 and 2 blocks (the only sizes the nodes use) are kept in
+     * free lists and allocated in O(1), mostly from a cache owned by the calling thread.
+     * larger extents are allocated first-fit from a map of coalesced free extents
+     */
     bid_t
     allocate_blocks(size_t size);
 
     void 
     free_blocks(bid_t bid, size_t size);
 
+    // the number of free blocks that are not at the end of the file
+    size_t get_free_block_count (void);
+
+    /*
+     * Announce that the blocks in `bids` are about to be read
+     *
+     * the missing blocks are read into the buffer pool as a single batch,
+     * so the reads overlap instead of waiting on each other.
+     * without a buffer pool, or with MMAP, the kernel is only asked to read ahead.
+     * prefetching does not count as a read in the stats, the later get_block does
+     */
+    void
+    prefetch_blocks(std::vector<bid_t> const& bids);
+
+    /*
+     * Hint how the blocks [bid, bid + count) are going to be read
+     *
+     * WILLNEED reads them into the buffer pool (see prefetch_blocks) if there is one,
+     * DONTNEED drops them from it, the other hints only matter to the page cache
+     * and do nothing with direct I/O
+     */
+    void
+    advise(bid_t bid, size_t count, AccessAdvice advice);
+
+    // for the whole file, NORMAL, RANDOM and SEQUENTIAL are kept when the storage is switched
+    void
+    advise(AccessAdvice advice);
+
+    // for the extents (bid, count), overlapping and adjacent ones are merged into a single hint
+    void
+    advise(std::vector<std::pair<bid_t, size_t>> extents, AccessAdvice advice);
+
+    // like advise, but only for the page cache, the buffer pool is left alone
+    void
+    advise_storage(std::vector<std::pair<bid_t, size_t>> extents, AccessAdvice advice);
+
+    /*
+     * write back the storage and drop everything in the buffer pool
+     */
     void
     flush_cache(void) {
-        // if we are not using the memory mapped file we can't control
-        // how data is flushed.
-        if(mp_data_memory != nullptr)
-        {
-            msync(mp_data_memory, m_allocated_memory_size, MS_ASYNC);
-        }
+        storage->sync(false);
+        if(block_cache)
+            block_cache->flush();
     }
 
     ~BlockManager() {
+        // every view must be released before the mapping goes away
+        assert(m_pinned_views == 0);
+        block_cache.reset();
         save_meta_data();
-        close(data_file_descriptor);
-        if(mp_data_memory != nullptr)
-        {
-            msync(mp_data_memory, m_allocated_memory_size, MS_SYNC);
-            munmap(mp_data_memory, m_allocated_memory_size);
-            mp_data_memory = nullptr;
-            m_allocated_memory_size = 0;
-        }
+        storage.reset();
     }
 
-    // 0 for unlimited
+    /*
+     * Switch to another storage backend
+     * no BlockView may be alive
+     */
+    void set_storage (StorageKind kind);
+
+    StorageKind get_storage (void) const { return storage->kind(); }
+
+    // in blocks, 0 for no buffer pool
     void set_cache_capacity (size_t c)
     {
-        // since we are now using memory mapped files, the cache capacity is
-        // set my the OS.  when needed the cache size will shrink and it will
-        // grow if the OS thinks it can accomidate.
-        // This is left in here for compatibility with older code.
+        set_cache_budget(c * block_size);
+    }
+
+    /*
+     * in bytes, 0 for no buffer pool (the reads then go to the storage,
+     * the page cache or the mapping being the only cache)
+     * the budget is ignored with MMAP, the storage of the loaded trees by default:
+     * every block, samples included, is read from the mapping without a copy,
+     * so nothing is kept in the pool nor counted as a hit or a miss.
+     * load with (or set_storage to) SYSCALL or DIRECT for the budget to bound the blocks held
+     * no BlockView may be alive when the pool is dropped
+     */
+    void set_cache_budget (size_t bytes)
+    {
+        if(bytes == 0)
+        {
+            assert(m_pinned_views == 0);
+            block_cache.reset();
+        }
+        else if(block_cache)
+            block_cache->set_capacity(bytes);
+        else
+            block_cache.reset(new BlockCache(block_size, bytes));
     }
 
-    // the OS manages the cache.  This function is left in for compatibility
-    // with older code which expects it.
-    // TODO: remove this function?
-    size_t get_cache_size (void) const { return 0; }
+    size_t get_cache_budget (void) const { return block_cache ? block_cache->get_capacity() : 0; }
+
+    // the number of blocks in the buffer pool
+    size_t get_cache_size (void) const { return block_cache ? block_cache->size() : 0; }
 
 private:
     friend struct Block;
+    friend struct BlockView;
 
     // arguments:
     // name - the prefix of the input files to read (will read meta file and data file)
-    // static_size - true if the number of blocks will never increase.  If this is true
-    //               the block manager can allow multiple threads.  Otherwise, it only
-    //               supports a single thread.
-    BlockManager(std::string const& name, bool static_size);
+    BlockManager(std::string const& name);
 
-    void memory_map_data();
+    void read_block(bid_t bid, char * data);
+    void write_block(bid_t bid, char const * data);
 
-    void read_block(Block const&);
-    void write_block(Block const&);
+    // bypass the buffer pool
+    void read_from_disk(bid_t bid, char * data);
+
+    // pin `bid` in the buffer pool, reading it from the disk on a miss
+    // nullptr if there is no buffer pool or no frame is available
+    BlockCache::Frame * pin_cached(bid_t bid);
+
+    // return a pointer to the content of the block, valid until unpin_block
+    // the block is pinned in the buffer pool if possible, in which case `frame` is set
+    // `buffer` is only used when the block is neither cached nor addressable in the storage
+    char const * pin_block(bid_t bid, std::unique_ptr<char[]> & buffer, BlockCache::Frame * & frame);
+    // `in_storage` if the pointer came from the storage itself
+    void unpin_block(BlockCache::Frame * frame, bool in_storage);
 
     std::string name;
     size_t block_size;
+    bool compress_leaves = false;
+    bool columnar_leaves = false;
+    uint32_t node_format = 1;
+    StripingParameters striping;
 
+    // guards the allocation of blocks and the metadata, the I/O doesn't need it
     std::mutex m_manager_lock;
 
     std::fstream metadata_file;
-    //std::fstream data_file;
 
-    // we are using linux specific code to enable us to have the OS handle caching
-    int data_file_descriptor;
+    std::unique_ptr<StorageBackend> storage;
+    std::atomic<AccessAdvice> file_advice;
+
+    // number of BlockView pointing into the storage or the buffer pool
+    std::atomic<size_t> m_pinned_views;
+
+    // extents of at most this many blocks are kept in free lists
+    static constexpr
+    size_t max_small_extent = 2;
+
+    // a thread takes/gives back this many extents at a time from/to the shared lists
+    static constexpr
+    size_t allocation_batch = 32;
 
-    // a memory mapped section of memory with all the data
-    size_t m_allocated_memory_size;
-    void *mp_data_memory;
-    bool m_static_size;
+    static constexpr
+    size_t allocation_shard_count = 16;
+
+    // must hold m_manager_lock
+    bid_t allocate_shared(size_t size);
+    void free_shared(bid_t bid, size_t size);
+    // add an extent to free_block_map, merged with its neighbours there
+    void free_in_map(bid_t bid, size_t size);
+    // give (bid, size) extents back to the shared lists, merged with each other
+    // and with their neighbours in free_block_map
+    void release_extents(std::vector<std::pair<bid_t, size_t>> & extents);
+
+    // move everything cached by the threads back to the shared lists,
+    // and coalesce all the free extents
+    void drain_allocation_shards(void);
+
+    struct AllocationShard
+    {
+        std::mutex lock;
+        std::vector<bid_t> free_lists[max_small_extent + 1];
+    };
 
+    AllocationShard &
+    get_allocation_shard(void) {
+        return allocation_shards[std::hash<std::thread::id>()(std::this_thread::get_id()) % allocation_shard_count];
+    }
+
+    // shared free space, guarded by m_manager_lock
+    // free_lists[s] holds extents of s blocks, free_block_map holds larger ones
+    std::vector<bid_t> free_lists[max_small_extent + 1];
     std::map<bid_t, size_t> free_block_map; // garbage collected
     bid_t next_free_block = 1;
 
-    Stats stats;
+    AllocationShard allocation_shards[allocation_shard_count];
+
+    std::atomic<size_t> read_count;
+    std::atomic<size_t> write_count;
 
-    //BlockCache<bid_t, Block> block_cache;
+    std::unique_ptr<BlockCache> block_cache;
 };
 
+/*
+ * dump_array / load_array at `offset` of a block, with the size header of the node format of its owner
+ * the values with a fixed layout are copied straight from / to the block, skipping the stream
+ */
+template <typename SizeType, typename ArrayType>
+typename std::enable_if<has_fixed_array_layout<ArrayType>::value>::type
+dump_array_to_block(Block & block, size_t offset, ArrayType const& at)
+{
+    dump_fixed_array<SizeType>(block.data + offset, block.data + block.owner.get_block_size(), at);
+}
+
+template <typename SizeType, typename ArrayType>
+typename std::enable_if<!has_fixed_array_layout<ArrayType>::value>::type
+dump_array_to_block(Block & block, size_t offset, ArrayType const& at)
+{
+    auto & stream = block.get_stream();
+    stream.seekp(offset);
+    ::dump_array<SizeType>(stream, at);
+}
+
+template <typename ArrayType>
+void
+dump_array_to_block(Block & block, size_t offset, ArrayType const& at)
+{
+    if(block.owner.get_node_format() >= 2)
+        dump_array_to_block<uint32_t>(block, offset, at);
+    else
+        dump_array_to_block<uint16_t>(block, offset, at);
+}
+
+template <typename SizeType, typename ArrayType>
+typename std::enable_if<has_fixed_array_layout<ArrayType>::value>::type
+load_array_from_block(BlockView & view, size_t offset, ArrayType & at)
+{
+    load_fixed_array<SizeType>(view.get_data() + offset, view.get_data() + view.owner.get_block_size(), at);
+}
+
+template <typename SizeType, typename ArrayType>
+typename std::enable_if<!has_fixed_array_layout<ArrayType>::value>::type
+load_array_from_block(BlockView & view, size_t offset, ArrayType & at)
+{
+    auto & stream = view.get_stream();
+    stream.seekg(offset);
+    ::load_array<SizeType>(stream, at);
+}
+
+template <typename ArrayType>
+void
+load_array_from_block(BlockView & view, size_t offset, ArrayType & at)
+{
+    if(view.owner.get_node_format() >= 2)
+        load_array_from_block<uint32_t>(view, offset, at);
+    else
+        load_array_from_block<uint16_t>(view, offset, at);
+}
+
+/*
+ * the same for values stored without their count (`at` is already sized when loading)
+ */
+template <typename ArrayType>
+typename std::enable_if<has_fixed_array_layout<ArrayType>::value>::type
+dump_values_to_block(Block & block, ArrayType const& at)
+{
+    using layout = fixed_layout<typename ArrayType::value_type>;
+    if(at.size() * layout::size > block.owner.get_block_size())
+        throw std::runtime_error("dump_values_to_block: the values do not fit");
+    encode_fixed(block.data, at.data(), at.size());
+}
+
+template <typename ArrayType>
+typename std::enable_if<!has_fixed_array_layout<ArrayType>::value>::type
+dump_values_to_block(Block & block, ArrayType const& at)
+{
+    auto & stream = block.get_stream();
+    for(auto const& v : at)
+        dump_value(stream, v);
+}
+
+template <typename ArrayType>
+typename std::enable_if<has_fixed_array_layout<ArrayType>::value>::type
+load_values_from_block(BlockView & view, ArrayType & at)
+{
+    using layout = fixed_layout<typename ArrayType::value_type>;
+    if(at.size() * layout::size > view.owner.get_block_size())
+        throw std::runtime_error("load_values_from_block: more values than fit in a block");
+    decode_fixed(view.get_data(), at.data(), at.size());
+}
+
+template <typename ArrayType>
+typename std::enable_if<!has_fixed_array_layout<ArrayType>::value>::type
+load_values_from_block(BlockView & view, ArrayType & at)
+{
+    auto & stream = view.get_stream();
+    for(auto & v : at)
+        load_value(stream, v);
+}
+
 } //namespace rtree 
@@ -0,0 +1,130 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHILD_BOXES_X86
+#include <immintrin.h>
+#endif
+
+#include "child_boxes.h"
+
+namespace rtree {
+
+namespace {
+
+using test_fn = void (*)(float const *, size_t, size_t, column_box const&, uint64_t *, uint64_t *);
+
+// the bits past `n` in the word of `first`
+inline uint64_t
+valid_bits(size_t first, size_t n)
+{
+    return n - first >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (n - first)) - 1;
+}
+
+void
+test_scalar(float const * boxes, size_t stride, size_t n, column_box const& q,
+        uint64_t * intersect, uint64_t * covered)
+{
+    for(size_t first = 0; first < n; first += 64)
+    {
+        uint64_t in_bits = 0, cov_bits = 0;
+        for(size_t i = first; i < std::min(first + 64, n); ++i)
+        {
+            bool in = true, cov = true;
+            for(int d = 0; d < 3; ++d)
+            {
+                float bmin = boxes[d * stride + i], bmax = boxes[(3 + d) * stride + i];
+                in = in && bmin <= q.max[d] && q.min[d] <= bmax;
+                cov = cov && q.min[d] <= bmin && bmax <= q.max[d];
+            }
+            in_bits |= (uint64_t)in << (i - first);
+            cov_bits |= (uint64_t)cov << (i - first);
+        }
+        intersect[first / 64] = in_bits;
+        covered[first / 64] = cov_bits;
+    }
+}
+
+#ifdef CHILD_BOXES_X86
+
+// the padding of the arrays is tested too, its bits are dropped
+__attribute__((target("avx2")))
+void
+test_avx2(float const * boxes, size_t stride, size_t n, column_box const& q,
+        uint64_t * intersect, uint64_t * covered)
+{
+    __m256 qmin[3], qmax[3];
+    for(int d = 0; d < 3; ++d)
+    {
+        qmin[d] = _mm256_set1_ps(q.min[d]);
+        qmax[d] = _mm256_set1_ps(q.max[d]);
+    }
+
+    for(size_t first = 0; first < n; first += 64)
+    {
+        // the bits of a word are gathered in registers, then stored once
+        uint64_t in_bits = 0, cov_bits = 0;
+        for(size_t i = first; i < std::min(first + 64, n); i += 8)
+        {
+            __m256 in = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            __m256 cov = in;
+            for(int d = 0; d < 3; ++d)
+            {
+                __m256 bmin = _mm256_loadu_ps(boxes + d * stride + i);
+                __m256 bmax = _mm256_loadu_ps(boxes + (3 + d) * stride + i);
+                in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(bmin, qmax[d], _CMP_LE_OQ), _mm256_cmp_ps(qmin[d], bmax, _CMP_LE_OQ)));
+                cov = _mm256_and_ps(cov, _mm256_and_ps(_mm256_cmp_ps(qmin[d], bmin, _CMP_LE_OQ), _mm256_cmp_ps(bmax, qmax[d], _CMP_LE_OQ)));
+            }
+            in_bits |= (uint64_t)_mm256_movemask_ps(in) << (i - first);
+            cov_bits |= (uint64_t)_mm256_movemask_ps(cov) << (i - first);
+        }
+        intersect[first / 64] = in_bits & valid_bits(first, n);
+        covered[first / 64] = cov_bits & valid_bits(first, n);
+    }
+    _mm256_zeroupper();
+}
+
+#endif // CHILD_BOXES_X86
+
+test_fn
+pick_implementation(void)
+{
+#ifdef CHILD_BOXES_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return test_avx2;
+#endif
+    return test_scalar;
+}
+
+} // anonymous namespace
+
+void
+test_boxes(float const * boxes, size_t stride, size_t n, column_box const& query,
+        uint64_t * intersect, uint64_t * covered)
+{
+    static test_fn const impl = pick_implementation();
+    impl(boxes, stride, n, query, intersect, covered);
+}
+
+} // namespace rtree
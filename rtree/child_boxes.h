@@ -0,0 +1,189 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Packed bounding boxes of the children of an internal node
+ *
+ * the traversals test the box of every child against the query, which
+ * Boost.Geometry does one box and one coordinate at a time. the nodes keep
+ * a copy of the boxes of their children as arrays (min then max of each
+ * dimension) so all the children are tested at once with AVX2, giving a
+ * bitmask of the children intersecting the query and one of those covered by it
+ *
+ * the copy is built by the first traversal after it was invalidated, the
+ * code changing the children (or their boxes) invalidates it. concurrent
+ * queries don't wait for each other: while one builds, the others test with
+ * Boost.Geometry
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <boost/geometry.hpp>
+
+#include "column_filter.h"
+#include "huge_page_arena.h"
+
+namespace rtree {
+
+// bit i % 64 of intersect[i / 64] (covered[i / 64]) is set if box i intersects (is covered by) `query`
+// the boxes are 6 arrays of `stride` floats: min 0, min 1, min 2, max 0, max 1, max 2
+// `stride` is at least `n` rounded up to a multiple of 8, the bits past `n` are cleared
+void
+test_boxes(float const * boxes, size_t stride, size_t n, column_box const& query,
+        uint64_t * intersect, uint64_t * covered);
+
+// the boxes that can be packed, 3d with float coordinates
+template <typename Box>
+struct packable_box
+{
+    static constexpr bool value =
+        boost::geometry::dimension<Box>::value == 3 &&
+        std::is_same<typename boost::geometry::coordinate_type<Box>::type, float>::value;
+};
+
+/*
+ * the result of a test of the children
+ */
+struct child_box_masks
+{
+    void reset(size_t n) {
+        words = (n + 63) / 64;
+        if(words > inline_words)
+            heap.assign(2 * words, 0);
+        else
+            storage.fill(0);
+    }
+
+    bool intersects(size_t i) const { return (intersect_words()[i / 64] >> (i % 64)) & 1; }
+    bool covered(size_t i) const { return (covered_words()[i / 64] >> (i % 64)) & 1; }
+
+    void set_intersects(size_t i) { intersect_words()[i / 64] |= (uint64_t)1 << (i % 64); }
+    void set_covered(size_t i) { covered_words()[i / 64] |= (uint64_t)1 << (i % 64); }
+
+    uint64_t * intersect_words(void) { return words > inline_words ? heap.data() : storage.data(); }
+    uint64_t * covered_words(void) { return intersect_words() + words; }
+    uint64_t const * intersect_words(void) const { return words > inline_words ? heap.data() : storage.data(); }
+    uint64_t const * covered_words(void) const { return intersect_words() + words; }
+
+private:
+    // enough for 128 children without allocating
+    static constexpr
+    size_t inline_words = 2;
+
+    size_t words = 0;
+    std::array<uint64_t, 2 * inline_words> storage;
+    std::vector<uint64_t> heap;
+};
+
+struct child_box_cache
+{
+    child_box_cache() = default;
+
+    // a copy of a node builds its own
+    child_box_cache(child_box_cache const&) { }
+    child_box_cache & operator = (child_box_cache const&) { invalidate(); return *this; }
+
+    void invalidate(void) { state.store(INVALID, std::memory_order_release); }
+
+    // test the boxes of `children` (entries with a bbox of type Box) against the query
+    template <typename Entries, typename Box>
+    void test(Entries const& children, Box const& query, child_box_masks & masks) const {
+        masks.reset(children.size());
+        test_packed(children, query, masks, std::integral_constant<bool, packable_box<Box>::value>());
+    }
+
+    // the same with Boost.Geometry, for any geometry
+    template <typename Entries, typename Geometry>
+    static void test_each(Entries const& children, Geometry const& query, child_box_masks & masks) {
+        masks.reset(children.size());
+        for(size_t i = 0; i < children.size(); ++i)
+        {
+            if(boost::geometry::covered_by(children[i].bbox, query))
+            {
+                masks.set_covered(i);
+                masks.set_intersects(i);
+            }
+            else if(boost::geometry::intersects(children[i].bbox, query))
+                masks.set_intersects(i);
+        }
+    }
+
+private:
+    enum { INVALID, BUILDING, VALID };
+
+    template <typename Entries, typename Box>
+    void test_packed(Entries const& children, Box const& query, child_box_masks & masks, std::true_type) const {
+        if(!acquire(children))
+            return test_each(children, query, masks);
+        test_boxes(boxes.data(), stride, children.size(), make_column_box(query),
+                masks.intersect_words(), masks.covered_words());
+    }
+
+    template <typename Entries, typename Box>
+    void test_packed(Entries const& children, Box const& query, child_box_masks & masks, std::false_type) const {
+        test_each(children, query, masks);
+    }
+
+    // whether the copy is there, building it if needed and no one else is
+    template <typename Entries>
+    bool acquire(Entries const& children) const {
+        if(state.load(std::memory_order_acquire) == VALID)
+            return true;
+        int expected = INVALID;
+        if(!state.compare_exchange_strong(expected, BUILDING, std::memory_order_acq_rel))
+            return false;
+        build(children);
+        state.store(VALID, std::memory_order_release);
+        return true;
+    }
+
+    template <typename Entries>
+    void build(Entries const& children) const {
+        namespace bg = boost::geometry;
+        stride = (children.size() + 7) / 8 * 8;
+        boxes.resize(6 * stride);
+        float * min0 = boxes.data(), * min1 = min0 + stride, * min2 = min1 + stride;
+        float * max0 = min2 + stride, * max1 = max0 + stride, * max2 = max1 + stride;
+        for(size_t i = 0; i < children.size(); ++i)
+        {
+            auto const& b = children[i].bbox;
+            min0[i] = bg::get<bg::min_corner, 0>(b);
+            min1[i] = bg::get<bg::min_corner, 1>(b);
+            min2[i] = bg::get<bg::min_corner, 2>(b);
+            max0[i] = bg::get<bg::max_corner, 0>(b);
+            max1[i] = bg::get<bg::max_corner, 1>(b);
+            max2[i] = bg::get<bg::max_corner, 2>(b);
+        }
+    }
+
+    mutable std::atomic<int> state{INVALID};
+    mutable size_t stride = 0;
+    // padded to a multiple of 8 boxes for test_boxes
+    mutable node_vector<float> boxes;
+};
+
+} // namespace rtree
@@ -0,0 +1,170 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLUMN_FILTER_X86
+#include <immintrin.h>
+#endif
+
+#include "column_filter.h"
+
+namespace rtree {
+
+namespace {
+
+using select_fn = void (*)(float const *, float const *, int32_t const *, size_t, column_box const&, uint64_t *);
+
+inline bool
+in_box(float x, float y, int32_t t, column_box const& box)
+{
+    float z = (float)t;
+    return box.min[0] <= x && x <= box.max[0]
+        && box.min[1] <= y && y <= box.max[1]
+        && box.min[2] <= z && z <= box.max[2];
+}
+
+// rows [first, n)
+void
+select_tail(float const * c0, float const * c1, int32_t const * c2, size_t first, size_t n,
+        column_box const& box, uint64_t * mask)
+{
+    for(size_t i = first; i < n; ++i)
+    {
+        if(in_box(c0[i], c1[i], c2[i], box))
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+}
+
+void
+select_scalar(float const * c0, float const * c1, int32_t const * c2, size_t n,
+        column_box const& box, uint64_t * mask)
+{
+    std::memset(mask, 0, (n + 63) / 64 * sizeof(uint64_t));
+    select_tail(c0, c1, c2, 0, n, box, mask);
+}
+
+#ifdef COLUMN_FILTER_X86
+
+__attribute__((target("avx2")))
+void
+select_avx2(float const * c0, float const * c1, int32_t const * c2, size_t n,
+        column_box const& box, uint64_t * mask)
+{
+    std::memset(mask, 0, (n + 63) / 64 * sizeof(uint64_t));
+
+    __m256 const min0 = _mm256_set1_ps(box.min[0]), max0 = _mm256_set1_ps(box.max[0]);
+    __m256 const min1 = _mm256_set1_ps(box.min[1]), max1 = _mm256_set1_ps(box.max[1]);
+    __m256 const min2 = _mm256_set1_ps(box.min[2]), max2 = _mm256_set1_ps(box.max[2]);
+
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(c0 + i);
+        __m256 y = _mm256_loadu_ps(c1 + i);
+        __m256 z = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(c2 + i)));
+
+        // ordered comparisons, a NaN is never in the box
+        __m256 in = _mm256_and_ps(_mm256_cmp_ps(min0, x, _CMP_LE_OQ), _mm256_cmp_ps(x, max0, _CMP_LE_OQ));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(min1, y, _CMP_LE_OQ), _mm256_cmp_ps(y, max1, _CMP_LE_OQ)));
+        in = _mm256_and_ps(in, _mm256_and_ps(_mm256_cmp_ps(min2, z, _CMP_LE_OQ), _mm256_cmp_ps(z, max2, _CMP_LE_OQ)));
+
+        // i is a multiple of 8, so the 8 bits don't straddle two words
+        mask[i / 64] |= (uint64_t)_mm256_movemask_ps(in) << (i % 64);
+    }
+    select_tail(c0, c1, c2, i, n, box, mask);
+}
+
+__attribute__((target("avx512f")))
+void
+select_avx512(float const * c0, float const * c1, int32_t const * c2, size_t n,
+        column_box const& box, uint64_t * mask)
+{
+    std::memset(mask, 0, (n + 63) / 64 * sizeof(uint64_t));
+
+    __m512 const min0 = _mm512_set1_ps(box.min[0]), max0 = _mm512_set1_ps(box.max[0]);
+    __m512 const min1 = _mm512_set1_ps(box.min[1]), max1 = _mm512_set1_ps(box.max[1]);
+    __m512 const min2 = _mm512_set1_ps(box.min[2]), max2 = _mm512_set1_ps(box.max[2]);
+
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16)
+    {
+        __m512 x = _mm512_loadu_ps(c0 + i);
+        __m512 y = _mm512_loadu_ps(c1 + i);
+        __m512 z = _mm512_cvtepi32_ps(_mm512_loadu_si512(c2 + i));
+
+        __mmask16 in = _mm512_cmp_ps_mask(min0, x, _CMP_LE_OQ);
+        in = _mm512_mask_cmp_ps_mask(in, x, max0, _CMP_LE_OQ);
+        in = _mm512_mask_cmp_ps_mask(in, min1, y, _CMP_LE_OQ);
+        in = _mm512_mask_cmp_ps_mask(in, y, max1, _CMP_LE_OQ);
+        in = _mm512_mask_cmp_ps_mask(in, min2, z, _CMP_LE_OQ);
+        in = _mm512_mask_cmp_ps_mask(in, z, max2, _CMP_LE_OQ);
+
+        mask[i / 64] |= (uint64_t)in << (i % 64);
+    }
+    select_tail(c0, c1, c2, i, n, box, mask);
+}
+
+#endif // COLUMN_FILTER_X86
+
+struct implementation
+{
+    select_fn select;
+    char const * name;
+};
+
+implementation
+pick_implementation(void)
+{
+#ifdef COLUMN_FILTER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return { select_avx512, "avx512" };
+    if(__builtin_cpu_supports("avx2"))
+        return { select_avx2, "avx2" };
+#endif
+    return { select_scalar, "scalar" };
+}
+
+implementation const&
+get_implementation(void)
+{
+    static implementation const impl = pick_implementation();
+    return impl;
+}
+
+} // anonymous namespace
+
+void
+select_in_box(float const * c0, float const * c1, int32_t const * c2, size_t n,
+        column_box const& box, uint64_t * mask)
+{
+    get_implementation().select(c0, c1, c2, n, box, mask);
+}
+
+char const *
+column_filter_isa(void)
+{
+    return get_implementation().name;
+}
+
+} // namespace rtree
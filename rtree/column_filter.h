@@ -0,0 +1,134 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Box test over the columns of a leaf (see serialization/leaf_columns.h)
+ *
+ * the test runs on 8 (AVX2) or 16 (AVX-512) rows at a time and gives a bitmask
+ * of the rows in the box, the instruction set is picked at run time.
+ * the result is the same as bg::covered_by(v.get_point(), box):
+ * the bounds are included and the integer coordinate is compared as a float
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/geometry.hpp>
+
+#include "serialization/leaf_columns.h"
+
+namespace rtree {
+
+struct column_box
+{
+    float min[3];
+    float max[3];
+};
+
+// bit i % 64 of mask[i / 64] is set if row i is in the box, the bits past `n` are cleared
+void
+select_in_box(float const * c0, float const * c1, int32_t const * c2, size_t n,
+        column_box const& box, uint64_t * mask);
+
+// "avx512", "avx2" or "scalar"
+char const *
+column_filter_isa(void);
+
+template <typename Box>
+column_box
+make_column_box(Box const& box)
+{
+    namespace bg = boost::geometry;
+    static_assert(bg::dimension<Box>::value == 3, "the columns have 3 coordinates");
+    column_box b;
+    b.min[0] = bg::get<bg::min_corner, 0>(box);
+    b.min[1] = bg::get<bg::min_corner, 1>(box);
+    b.min[2] = bg::get<bg::min_corner, 2>(box);
+    b.max[0] = bg::get<bg::max_corner, 0>(box);
+    b.max[1] = bg::get<bg::max_corner, 1>(box);
+    b.max[2] = bg::get<bg::max_corner, 2>(box);
+    return b;
+}
+
+/*
+ * what the io leaf nodes do with the columns of their values
+ * the types that are not columnar only get stubs, the block manager
+ * never has columnar leaves for them (see IOLayers::columnar_leaves)
+ */
+template <typename Value, bool Columnar = leaf_columns<Value>::columnar>
+struct leaf_column_io
+{
+    using columns_t = leaf_columns<Value>;
+
+    static size_t row_size(void) { return columns_t::row_size; }
+
+    static void store(Value const * values, size_t n, char * out) { columns_t::store(values, n, out); }
+
+    static void load(char const * in, size_t n, Value * values) {
+        auto columns = columns_t::view(in, n);
+        for(size_t i = 0; i < n; ++i)
+            columns_t::load(columns, i, values[i]);
+    }
+
+    // the `n` values at `in` covered by `box` go to `out`, the others are not put together
+    // returns how many were selected
+    template <typename Box, typename OutputIterator>
+    static size_t select(char const * in, size_t n, Box const& box, OutputIterator & out) {
+        auto columns = columns_t::view(in, n);
+
+        thread_local std::vector<uint64_t> mask;
+        mask.resize((n + 63) / 64);
+        select_in_box(columns.c0, columns.c1, columns.c2, n, make_column_box(box), mask.data());
+
+        size_t selected = 0;
+        Value v;
+        for(size_t w = 0; w < mask.size(); ++w)
+        {
+            for(uint64_t bits = mask[w]; bits != 0; bits &= bits - 1)
+            {
+                columns_t::load(columns, w * 64 + __builtin_ctzll(bits), v);
+                *out = v;
+                ++out;
+                ++selected;
+            }
+        }
+        return selected;
+    }
+};
+
+template <typename Value>
+struct leaf_column_io<Value, false>
+{
+    static size_t row_size(void) { throw not_columnar(); }
+    static void store(Value const *, size_t, char *) { throw not_columnar(); }
+    static void load(char const *, size_t, Value *) { throw not_columnar(); }
+
+    template <typename Box, typename OutputIterator>
+    static size_t select(char const *, size_t, Box const&, OutputIterator &) { throw not_columnar(); }
+
+private:
+    static std::logic_error not_columnar(void) { return std::logic_error("leaf_column_io: the values can't be stored in columns"); }
+};
+
+} // namespace rtree
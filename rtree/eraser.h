@@ -135,7 +135,7 @@ private:
         {
             -- iter;
 
-            iter->apply_visitor(*this);
+            iter->apply_static(*this);
 
             if(apply_ret.erased) 
             {
@@ -143,6 +143,7 @@ private:
                 {
                     // release node pointer or blocks
                     node_type::free(*iter, block_manager);
+                    node.invalidate_child_boxes();
                     node.children.erase(iter);
                 }
                 return true;
@@ -178,7 +179,7 @@ private:
             // rebuild samples if necessary
             {
                 sample_builder<MemNodeSampleSize, Box, Key, Value, SampleValue> sb(block_manager);
-                node.apply_visitor(sb, entry);
+                sb.apply(node, entry);
             }
         }
         // naive erase: no underflow checking
@@ -102,7 +102,7 @@ private:
         while(iter != node.children.begin())
         {
             -- iter;
-            iter->apply_visitor(*this);
+            iter->apply_static(*this);
 
             if(apply_ret.found) 
                 return true;
@@ -0,0 +1,436 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * sample_query and naive_sample_query on a frozen tree
+ *
+ * the same algorithms as sample_query_cursor and naive_sample_query_cursor,
+ * with the nodes as indices into frozen_tree::nodes
+ */
+#pragma once
+
+#include <list>
+#include <vector>
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+struct frozen_sample_query_cursor
+{
+    using tree_type = frozen_tree TARGS;
+    using node_t = frozen_node<Box>;
+
+    frozen_sample_query_cursor(Geometry const& query, tree_type const& tree, RNG_DEV & rng_dev)
+        : tree(tree)
+        , query(query)
+        , rng(rng_dev())
+        , count(0)
+    {
+        if(!tree.nodes.empty())
+        {
+            nodes.push_back(sample_node{0, 0});
+            count = tree.nodes.front().subtree_size;
+        }
+    }
+
+    frozen_sample_query_cursor(frozen_sample_query_cursor const&) = delete;
+    frozen_sample_query_cursor(frozen_sample_query_cursor &&) = default;
+
+    template<typename OutIter>
+    void
+    get_samples(size_t sample_size, OutIter out_iter) {
+        auto sample_buffer_inserter = std::back_inserter(sample_buffer);
+        sampler<decltype(sample_buffer_inserter)> s(*this, sample_buffer_inserter);
+        while(sample_size > 0)
+        {
+            if(sample_buffer.empty())
+            {
+                while(sample_buffer.empty())
+                {
+                    if(count == 0) return;
+                    size_t ss = std::max<size_t>(sample_size, nodes.size() * 4);
+                    s.get_samples(ss);
+                }
+                std::shuffle(sample_buffer.begin(), sample_buffer.end(), rng);
+            }
+            while((sample_size > 0) && (!sample_buffer.empty()))
+            {
+                *out_iter = sample_buffer.back();
+                ++out_iter;
+                sample_buffer.pop_back();
+                --sample_size;
+            }
+        }
+    }
+
+    // see sample_query_cursor::estimate_count
+    size_t estimate_count(double * sd_ptr = nullptr) {
+        double c = values.size();
+        double variance = 0.0;
+        for(auto const& sn : nodes)
+        {
+            auto const& node = tree.nodes[sn.node];
+            double ss = node.subtree_size;
+            if(bg::covered_by(node.bbox, query))
+                c += ss;
+            else if(node.is_leaf())
+            {
+                auto first = tree.values.begin() + node.first_value;
+                for(auto iter = first; iter != first + node.subtree_size; ++iter)
+                {
+                    if(bg::covered_by(iter->get_point(), query))
+                        ++c;
+                }
+            }
+            else if(node.sample_count == 0)
+            {
+                c += ss / 2.0;
+                variance += ss * ss / 4.0;
+            }
+            else
+            {
+                size_t in_range = 0;
+                auto first = tree.samples.begin() + node.first_sample;
+                for(auto iter = first; iter != first + node.sample_count; ++iter)
+                {
+                    if(bg::covered_by(iter->get_point(), query))
+                        ++in_range;
+                }
+                c += ss / node.sample_count * in_range;
+                variance += ss * ss / node.sample_count;
+            }
+        }
+        if(sd_ptr)
+            *sd_ptr = sqrt(variance);
+        return round(c);
+    }
+
+    Stats get_stats(void) const { return stats; }
+    void reset_stats(void) { stats = Stats(); }
+
+    size_t node_count (void) const { return nodes.size(); }
+    size_t value_count (void) const { return values.size(); }
+    size_t ground_set_size (void) const { return count; }
+    size_t sample_buffer_size (void) const { return sample_buffer.size(); }
+
+    std::vector<SampleValue> sample_buffer; // samples not returned
+
+private:
+    struct sample_node {
+        uint32_t node;
+        size_t sample_used;
+    };
+
+    template<typename OutIter>
+    struct sampler
+    {
+        using cursor_type = frozen_sample_query_cursor;
+
+        sampler(cursor_type & cursor, OutIter out_iter)
+            : cursor(cursor)
+            , tree(cursor.tree)
+            , out_iter(out_iter)
+        { }
+
+        void get_samples(size_t sample_size)
+        {
+            if(cursor.count == 0) return;
+
+            // cursor.count changes as the nodes are expanded
+            size_t cur_count = cursor.count;
+
+            size_t samples_from_values = next_sample_size(sample_size, cursor.values.size(), cur_count, cursor.rng);
+            if(samples_from_values > 0)
+                sample_from_values(cursor.values.begin(), cursor.values.end(), samples_from_values);
+
+            if(sample_size > samples_from_values)
+            {
+                sample_from_nodes(cursor.nodes.begin(), cursor.nodes.end(),
+                        cur_count - cursor.values.size(),
+                        sample_size - samples_from_values);
+            }
+        }
+
+    private:
+        using node_iter = typename std::list<sample_node>::iterator;
+
+        template<typename ValueIter>
+        void
+        sample_from_values(ValueIter first, ValueIter last, size_t sample_size)
+        {
+            boost::random::uniform_smallint<size_t> dist(0, (size_t)std::distance(first, last) - 1);
+            for(size_t i = 0; i < sample_size; ++i)
+            {
+                *out_iter = first[dist(cursor.rng)];
+                ++out_iter;
+            }
+        }
+
+        // see sample_query_cursor::sampler::sample_from_entries
+        void
+        sample_from_nodes(node_iter first, node_iter last, size_t subtree_size, size_t sample_size)
+        {
+            struct planned_node {
+                node_iter iter;
+                size_t sample_size;
+                size_t ground_size;
+            };
+
+            std::vector<planned_node> plan;
+            for(auto iter = first; iter != last && sample_size > 0; ++iter)
+            {
+                size_t node_size = tree.nodes[iter->node].subtree_size;
+                size_t s = next_sample_size(sample_size, node_size, subtree_size, cursor.rng);
+                if(s > 0)
+                    plan.push_back(planned_node{iter, s, subtree_size});
+                sample_size -= s;
+                subtree_size -= node_size;
+            }
+
+            for(auto const& p : plan)
+            {
+                auto iter = p.iter;
+                auto const& node = tree.nodes[iter->node];
+
+                if(node.is_leaf())
+                {
+                    sample_from_leaf(node, p.sample_size);
+                    cursor.nodes.erase(iter);
+                    continue;
+                }
+
+                size_t from_children = sample_from_node(node, iter->sample_used, p.sample_size);
+                if(from_children == 0)
+                    continue;
+
+                // not enough samples at this node, go down to the children in the query range
+                iter = cursor.nodes.erase(iter);
+                cursor.count -= node.subtree_size;
+
+                child_box_masks masks;
+                tree.test_children(node, cursor.query, masks);
+                auto first_child_iter = iter;
+                bool first_child = true;
+                for(size_t i = 0; i < node.child_count; ++i)
+                {
+                    if(!masks.intersects(i))
+                        continue;
+                    uint32_t child = node.first_child + i;
+                    auto child_iter = cursor.nodes.insert(iter, sample_node{child, 0});
+                    if(first_child)
+                    {
+                        first_child_iter = child_iter;
+                        first_child = false;
+                    }
+                    cursor.count += tree.nodes[child].subtree_size;
+                }
+                ++cursor.stats.internal_nodes;
+
+                if(!first_child)
+                    sample_from_nodes(first_child_iter, iter, p.ground_size, from_children);
+            }
+        }
+
+        // the samples of the node not used yet, returns how many are missing
+        size_t
+        sample_from_node(node_t const& node, size_t & sample_used, size_t sample_size)
+        {
+            size_t s = std::min<size_t>(node.sample_count - sample_used, sample_size);
+            auto first = tree.samples.begin() + node.first_sample + sample_used;
+            bool covered = bg::covered_by(node.bbox, cursor.query);
+            for(auto iter = first; iter != first + s; ++iter)
+            {
+                if(covered || bg::covered_by(iter->get_point(), cursor.query))
+                {
+                    *out_iter = *iter;
+                    ++out_iter;
+                }
+            }
+            sample_used += s;
+            return sample_size - s;
+        }
+
+        // keep the values of the leaf in the query range, then sample them
+        void
+        sample_from_leaf(node_t const& node, size_t sample_size)
+        {
+            ++cursor.stats.leaf_nodes;
+            size_t old_values_size = cursor.values.size();
+            auto first = tree.values.begin() + node.first_value;
+            for(auto iter = first; iter != first + node.subtree_size; ++iter)
+            {
+                if(bg::covered_by(iter->get_point(), cursor.query))
+                    cursor.values.push_back(*iter);
+            }
+            size_t count_in_range = cursor.values.size() - old_values_size;
+            cursor.count -= node.subtree_size;
+            cursor.count += count_in_range;
+
+            size_t s = next_sample_size(sample_size, count_in_range, node.subtree_size, cursor.rng);
+            sample_from_values(cursor.values.begin() + old_values_size, cursor.values.end(), s);
+        }
+
+        cursor_type & cursor;
+        tree_type const& tree;
+        OutIter out_iter;
+    };
+
+    tree_type const& tree;
+    Geometry query;
+    RNG rng;
+
+    std::list<sample_node> nodes; // nodes that might have elements in the query range
+    std::vector<SampleValue> values; // (some) values in the query range, which are not covered by nodes
+    size_t count; // the number of values covered by nodes and values
+
+    Stats stats;
+};
+
+TDECL
+struct frozen_naive_sample_query_cursor
+{
+    using tree_type = frozen_tree TARGS;
+    using node_t = frozen_node<Box>;
+
+    template<typename Geometry>
+    frozen_naive_sample_query_cursor(Geometry const& query, tree_type const& tree, RNG_DEV & rng_dev)
+        : tree(tree)
+        , rng(rng_dev())
+    {
+        if(!tree.nodes.empty())
+            decompose(tree.nodes.front(), query);
+
+        count = values.size();
+        for(auto n : nodes)
+            count += tree.nodes[n].subtree_size;
+    }
+
+    template<typename OutIter>
+    void
+    get_samples(size_t sample_size, OutIter out_iter) {
+        if(sample_size == 0 || count == 0)
+            return;
+
+        size_t samples_from_values = next_sample_size(sample_size, values.size(), count, rng);
+        if(samples_from_values > 0)
+            sample_from_values(values.begin(), values.end(), samples_from_values, out_iter);
+
+        size_t subtree_size = count - values.size();
+        sample_size -= samples_from_values;
+        for(auto n : nodes)
+        {
+            if(sample_size == 0)
+                break;
+            auto const& node = tree.nodes[n];
+            size_t s = next_sample_size(sample_size, node.subtree_size, subtree_size, rng);
+            if(s > 0)
+                sample_from_subtree(node, s, out_iter);
+            sample_size -= s;
+            subtree_size -= node.subtree_size;
+        }
+    }
+
+    size_t get_count(void) const { return count; }
+    size_t get_node_count(void) const { return nodes.size(); }
+    size_t get_value_count(void) const { return values.size(); }
+
+    Stats get_stats(void) const { return stats; }
+    void reset_stats(void) { stats = Stats(); }
+
+private:
+    // the nodes covered by the query, and the values in it from the other leaves
+    template<typename Geometry>
+    void decompose(node_t const& node, Geometry const& query) {
+        if(node.is_leaf())
+        {
+            ++stats.leaf_nodes;
+            auto first = tree.values.begin() + node.first_value;
+            for(auto iter = first; iter != first + node.subtree_size; ++iter)
+            {
+                if(bg::covered_by(iter->get_point(), query))
+                    values.push_back(*iter);
+            }
+            return;
+        }
+
+        ++stats.internal_nodes;
+        child_box_masks masks;
+        tree.test_children(node, query, masks);
+        for(size_t i = 0; i < node.child_count; ++i)
+        {
+            if(masks.covered(i))
+                nodes.push_back(node.first_child + i);
+            else if(masks.intersects(i))
+                decompose(tree.nodes[node.first_child + i], query);
+        }
+    }
+
+    template<typename ValueIter, typename OutIter>
+    void sample_from_values(ValueIter first, ValueIter last, size_t sample_size, OutIter & out_iter) {
+        boost::random::uniform_smallint<size_t> dist(0, (size_t)std::distance(first, last) - 1);
+        for(size_t i = 0; i < sample_size; ++i)
+        {
+            *out_iter = first[dist(rng)];
+            ++out_iter;
+        }
+    }
+
+    // the children of a node split its whole subtree, buffer included
+    template<typename OutIter>
+    void sample_from_subtree(node_t const& node, size_t sample_size, OutIter & out_iter) {
+        if(node.is_leaf())
+        {
+            ++stats.leaf_nodes;
+            auto first = tree.values.begin() + node.first_value;
+            sample_from_values(first, first + node.subtree_size, sample_size, out_iter);
+            return;
+        }
+
+        ++stats.internal_nodes;
+        size_t subtree_size = node.subtree_size;
+        for(size_t i = 0; i < node.child_count && sample_size > 0; ++i)
+        {
+            auto const& child = tree.nodes[node.first_child + i];
+            size_t s = next_sample_size(sample_size, child.subtree_size, subtree_size, rng);
+            if(s > 0)
+                sample_from_subtree(child, s, out_iter);
+            sample_size -= s;
+            subtree_size -= child.subtree_size;
+        }
+    }
+
+    tree_type const& tree;
+
+    std::vector<uint32_t> nodes; // nodes that completely fall into the query range
+    std::vector<Value> values; // (some) values in the query range, which are not covered by nodes
+    size_t count;
+
+    Stats stats;
+    RNG rng;
+};
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
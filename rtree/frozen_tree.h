@@ -0,0 +1,169 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * A read-only copy of a whole tree in a few contiguous arrays
+ *
+ * a tree opened in memory is still made of nodes allocated one at a time and
+ * linked by pointers, loaded io nodes included, so its queries chase pointers
+ * all over the heap. freezing copies the tree, in breadth first order, into
+ *  - the nodes: box, size, and offsets into the other arrays.
+ *    the children of a node are next to each other
+ *  - the samples of the nodes, one run per node
+ *  - the values of the leaves, one run per leaf
+ *  - the boxes of the nodes again, as columns for test_boxes
+ * the buffer of a mem leaf or an io internal node becomes an extra leaf child
+ *
+ * a frozen tree can't be changed. it answers sample_query, naive_sample_query
+ * and range_report like the tree it comes from, and is saved and loaded
+ * as a handful of large arrays
+ */
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+template <typename Box>
+struct frozen_node
+{
+    Box bbox;
+    size_t subtree_size = 0;
+
+    // nodes [first_child, first_child + child_count), none for a leaf
+    uint32_t first_child = 0;
+    uint32_t child_count = 0;
+
+    // samples [first_sample, first_sample + sample_count)
+    uint64_t first_sample = 0;
+    uint32_t sample_count = 0;
+
+    // values [first_value, first_value + subtree_size), leaves only
+    uint64_t first_value = 0;
+
+    bool is_leaf(void) const { return child_count == 0; }
+};
+
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+struct frozen_sample_query_cursor;
+
+TDECL
+struct frozen_naive_sample_query_cursor;
+
+TDECL
+struct frozen_tree
+{
+    using node_t = frozen_node<Box>;
+    using entry_t = node_entry TARGS;
+
+    frozen_tree() : rng_dev(new RNG_DEV()) { }
+
+    frozen_tree(frozen_tree &&) = default;
+    frozen_tree & operator = (frozen_tree &&) = default;
+
+    // copy the tree under `root`, the io nodes that are not loaded are read
+    static frozen_tree freeze(entry_t & root, BlockManager & block_manager);
+
+    void save(std::string const& filename) const;
+    static frozen_tree load(std::string const& filename);
+
+    size_t size(void) const { return nodes.empty() ? 0 : nodes.front().subtree_size; }
+
+    /*
+     * the same queries as rtree
+     * the cursors refer to the frozen tree, which must outlive them
+     */
+    template <typename Geometry>
+    frozen_naive_sample_query_cursor TARGS
+    naive_sample_query(Geometry const& query) const {
+        return frozen_naive_sample_query_cursor TARGS(query, *this, *rng_dev);
+    }
+
+    template <typename Geometry>
+    frozen_sample_query_cursor<Geometry, Box, Key, Value, SampleValue>
+    sample_query(Geometry const& query) const {
+        return frozen_sample_query_cursor<Geometry, Box, Key, Value, SampleValue>(query, *this, *rng_dev);
+    }
+
+    template <typename Geometry, typename Iterator>
+    Stats range_report(Geometry const& query, Iterator out_iter) const;
+
+    // which children of `node` intersect / are covered by `query`
+    // tested at once on the columns for a Box query
+    void test_children(node_t const& node, Box const& query, child_box_masks & masks) const {
+        test_children(node, query, masks, std::integral_constant<bool, packable_box<Box>::value>());
+    }
+
+    template <typename Geometry>
+    void test_children(node_t const& node, Geometry const& query, child_box_masks & masks) const {
+        test_children(node, query, masks, std::false_type());
+    }
+
+    std::vector<node_t> nodes;
+    std::vector<SampleValue> samples;
+    std::vector<Value> values;
+
+private:
+    void test_children(node_t const& node, Box const& query, child_box_masks & masks, std::true_type) const;
+    template <typename Geometry>
+    void test_children(node_t const& node, Geometry const& query, child_box_masks & masks, std::false_type) const;
+
+    template <typename Geometry, typename Iterator>
+    void report(node_t const& node, Geometry const& query, Iterator & out_iter, Stats & stats) const;
+    template <typename Iterator>
+    void report_all(node_t const& node, Iterator & out_iter, Stats & stats) const;
+
+    // fill `boxes` from `nodes`
+    void pack_boxes(void);
+
+    // 6 columns of `stride` floats (see test_boxes), padded so the children
+    // of any node can be read 8 at a time
+    size_t stride = 0;
+    std::vector<float> boxes;
+
+    // a random_device can't be moved
+    std::unique_ptr<RNG_DEV> rng_dev;
+
+    static constexpr
+    char magic[8] = {'R', 'S', 'F', 'R', 'O', 'Z', 'E', 'N'};
+    static constexpr
+    uint32_t format_version = 1;
+};
+
+TDECL
+constexpr char frozen_tree TARGS::magic[8];
+
+TDECL
+constexpr uint32_t frozen_tree TARGS::format_version;
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
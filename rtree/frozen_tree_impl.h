@@ -0,0 +1,306 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <deque>
+#include <limits>
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+/*
+ * copy the content of the nodes to a frozen tree, in breadth first order
+ * the node being visited is already in tree.nodes at `current`,
+ * its children are appended to tree.nodes and queued to be visited
+ */
+TDECL
+struct frozen_tree_builder
+    : visitor TARGS
+{
+    using base_t = visitor TARGS;
+    using internal_node_type = typename base_t::internal_node_type;
+    using leaf_node_type = typename base_t::leaf_node_type;
+    using io_internal_node_type = typename base_t::io_internal_node_type;
+    using io_leaf_node_type = typename base_t::io_leaf_node_type;
+    using entry_t = typename base_t::entry_t;
+    using node_t = frozen_node<Box>;
+    using base_t::block_manager;
+
+    // the entry of a node, or the buffer of its parent
+    struct pending {
+        entry_t entry;
+        std::vector<Value> buffer;
+        bool is_buffer;
+    };
+
+    frozen_tree_builder(frozen_tree TARGS & tree, BlockManager & block_manager)
+        : base_t(block_manager)
+        , tree(tree)
+    { }
+
+    void build(entry_t const& root) {
+        tree.nodes.push_back(make_node(root.bbox, root.subtree_size));
+        queue.push_back(pending{root, {}, false});
+        for(current = 0; current < tree.nodes.size(); ++current)
+        {
+            pending p = std::move(queue.front());
+            queue.pop_front();
+            if(p.is_buffer)
+                add_values(p.buffer);
+            else
+                p.entry.apply_static(*this);
+        }
+    }
+
+    void apply (internal_node_type & node, entry_t & /* entry */) {
+        add_samples_and_children(node, nullptr);
+    }
+    void apply (leaf_node_type & node, entry_t & /* entry */) {
+        add_samples_and_children(node, &node.buffer);
+    }
+    void apply (io_internal_node_type & node, entry_t & entry) {
+        node.load_samples_from_blocks(entry, block_manager);
+        node.load_children_and_buffer_from_blocks(entry, block_manager);
+        add_samples_and_children(node, &node.buffer);
+    }
+    void apply (io_leaf_node_type & node, entry_t & entry) {
+        node.load_from_blocks(entry, block_manager);
+        add_values(node.values);
+    }
+
+private:
+    static node_t make_node(Box const& bbox, size_t subtree_size) {
+        node_t n;
+        n.bbox = bbox;
+        n.subtree_size = subtree_size;
+        return n;
+    }
+
+    void add_samples_and_children(internal_node_type const& node, node_vector<Value> const * buffer) {
+        tree.nodes[current].first_sample = tree.samples.size();
+        tree.nodes[current].sample_count = node.samples.size();
+        tree.samples.insert(tree.samples.end(), node.samples.begin(), node.samples.end());
+
+        size_t first_child = tree.nodes.size();
+        for(auto const& child : node.children)
+        {
+            tree.nodes.push_back(make_node(child.bbox, child.subtree_size));
+            queue.push_back(pending{child, {}, false});
+        }
+        if(buffer != nullptr && !buffer->empty())
+        {
+            Box bbox;
+            bg::assign_inverse(bbox);
+            for(auto const& v : *buffer)
+                bg::expand(bbox, v.get_point());
+            tree.nodes.push_back(make_node(bbox, buffer->size()));
+            queue.push_back(pending{entry_t(), std::vector<Value>(buffer->begin(), buffer->end()), true});
+        }
+
+        if(tree.nodes.size() > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("frozen_tree: too many nodes");
+        tree.nodes[current].first_child = first_child;
+        tree.nodes[current].child_count = tree.nodes.size() - first_child;
+    }
+
+    template <typename Values>
+    void add_values(Values const& values) {
+        tree.nodes[current].first_value = tree.values.size();
+        tree.values.insert(tree.values.end(), values.begin(), values.end());
+    }
+
+    frozen_tree TARGS & tree;
+    std::deque<pending> queue;
+    size_t current = 0;
+};
+
+TDECL
+    frozen_tree TARGS
+    frozen_tree TARGS
+    ::freeze(entry_t & root, BlockManager & block_manager)
+{
+    frozen_tree tree;
+    frozen_tree_builder TARGS(tree, block_manager).build(root);
+    tree.pack_boxes();
+    return tree;
+}
+
+TDECL
+    void
+    frozen_tree TARGS
+    ::save(std::string const& filename) const
+{
+    std::ofstream outf(filename.c_str(), std::ofstream::binary);
+    outf.write(magic, sizeof(magic));
+    dump_value(outf, format_version);
+    dump_array<uint64_t>(outf, nodes);
+    dump_array<uint64_t>(outf, samples);
+    dump_array<uint64_t>(outf, values);
+    if(!outf)
+        throw std::runtime_error("frozen_tree: cannot write " + filename);
+}
+
+TDECL
+    frozen_tree TARGS
+    frozen_tree TARGS
+    ::load(std::string const& filename)
+{
+    std::ifstream inf(filename.c_str(), std::ifstream::binary);
+    char file_magic[sizeof(magic)];
+    uint32_t version;
+    inf.read(file_magic, sizeof(file_magic));
+    load_value(inf, version);
+    if(!inf || !std::equal(file_magic, file_magic + sizeof(magic), magic) || version != format_version)
+        throw std::runtime_error("frozen_tree: " + filename + " is not a frozen tree this version can read");
+
+    frozen_tree tree;
+    load_array<uint64_t>(inf, tree.nodes);
+    load_array<uint64_t>(inf, tree.samples);
+    load_array<uint64_t>(inf, tree.values);
+    if(!inf)
+        throw std::runtime_error("frozen_tree: " + filename + " is truncated");
+    tree.pack_boxes();
+    return tree;
+}
+
+TDECL
+    void
+    frozen_tree TARGS
+    ::pack_boxes(void)
+{
+    if(!packable_box<Box>::value)
+        return;
+    // the last children are read up to 7 boxes past the last node
+    stride = (nodes.size() + 7 + 7) / 8 * 8;
+    boxes.assign(6 * stride, 0.0f);
+    for(size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto const& b = nodes[i].bbox;
+        boxes[0 * stride + i] = bg::get<bg::min_corner, 0>(b);
+        boxes[1 * stride + i] = bg::get<bg::min_corner, 1>(b);
+        boxes[2 * stride + i] = bg::get<bg::min_corner, 2>(b);
+        boxes[3 * stride + i] = bg::get<bg::max_corner, 0>(b);
+        boxes[4 * stride + i] = bg::get<bg::max_corner, 1>(b);
+        boxes[5 * stride + i] = bg::get<bg::max_corner, 2>(b);
+    }
+}
+
+TDECL
+    void
+    frozen_tree TARGS
+    ::test_children(node_t const& node, Box const& query, child_box_masks & masks, std::true_type) const
+{
+    masks.reset(node.child_count);
+    test_boxes(boxes.data() + node.first_child, stride, node.child_count, make_column_box(query),
+            masks.intersect_words(), masks.covered_words());
+}
+
+TDECL
+template <typename Geometry>
+    void
+    frozen_tree TARGS
+    ::test_children(node_t const& node, Geometry const& query, child_box_masks & masks, std::false_type) const
+{
+    masks.reset(node.child_count);
+    for(size_t i = 0; i < node.child_count; ++i)
+    {
+        auto const& bbox = nodes[node.first_child + i].bbox;
+        if(bg::covered_by(bbox, query))
+        {
+            masks.set_covered(i);
+            masks.set_intersects(i);
+        }
+        else if(bg::intersects(bbox, query))
+            masks.set_intersects(i);
+    }
+}
+
+TDECL
+template <typename Geometry, typename Iterator>
+    Stats
+    frozen_tree TARGS
+    ::range_report(Geometry const& query, Iterator out_iter) const
+{
+    Stats stats;
+    if(!nodes.empty())
+        report(nodes.front(), query, out_iter, stats);
+    return stats;
+}
+
+TDECL
+template <typename Geometry, typename Iterator>
+    void
+    frozen_tree TARGS
+    ::report(node_t const& node, Geometry const& query, Iterator & out_iter, Stats & stats) const
+{
+    if(node.is_leaf())
+    {
+        ++stats.leaf_nodes;
+        auto first = values.begin() + node.first_value;
+        for(auto iter = first; iter != first + node.subtree_size; ++iter)
+        {
+            if(bg::covered_by(iter->get_point(), query))
+            {
+                *out_iter = *iter;
+                ++out_iter;
+            }
+        }
+        return;
+    }
+
+    ++stats.internal_nodes;
+    child_box_masks masks;
+    test_children(node, query, masks);
+    for(size_t i = 0; i < node.child_count; ++i)
+    {
+        // nothing to test under a covered child
+        if(masks.covered(i))
+            report_all(nodes[node.first_child + i], out_iter, stats);
+        else if(masks.intersects(i))
+            report(nodes[node.first_child + i], query, out_iter, stats);
+    }
+}
+
+TDECL
+template <typename Iterator>
+    void
+    frozen_tree TARGS
+    ::report_all(node_t const& node, Iterator & out_iter, Stats & stats) const
+{
+    if(node.is_leaf())
+    {
+        ++stats.leaf_nodes;
+        out_iter = std::copy(values.begin() + node.first_value, values.begin() + node.first_value + node.subtree_size, out_iter);
+        return;
+    }
+
+    ++stats.internal_nodes;
+    for(size_t i = 0; i < node.child_count; ++i)
+        report_all(nodes[node.first_child + i], out_iter, stats);
+}
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
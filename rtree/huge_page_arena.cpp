@@ -0,0 +1,274 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <cassert>
+#include <new>
+#include <sys/mman.h>
+
+#include "huge_page_arena.h"
+
+namespace rtree {
+
+namespace {
+
+size_t
+round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// multiples of 16 up to 256, then 4 sizes between powers of two,
+// so no more than 25% is wasted
+size_t
+class_size(size_t size)
+{
+    if(size <= 256)
+        return round_up(size == 0 ? 1 : size, 16);
+    size_t power = 256;
+    while(power * 2 < size)
+        power *= 2;
+    return round_up(size, power / 4);
+}
+
+} // anonymous namespace
+
+struct HugePageArena::ThreadCache
+{
+    std::unordered_map<size_t, std::vector<void*>> lists;
+
+    ~ThreadCache() {
+        auto & arena = HugePageArena::instance();
+        for(auto const& list : lists)
+            arena.give_back(list.first, list.second.data(), list.second.size());
+        // what the thread frees from now on goes straight to the arena
+        current = nullptr;
+        exited = true;
+    }
+
+    // trivially destructible, so they are still there while the thread exits
+    static thread_local ThreadCache * current;
+    static thread_local bool exited;
+};
+
+thread_local HugePageArena::ThreadCache * HugePageArena::ThreadCache::current = nullptr;
+thread_local bool HugePageArena::ThreadCache::exited = false;
+
+HugePageArena::ThreadCache *
+HugePageArena::thread_cache(void)
+{
+    if(ThreadCache::current == nullptr && !ThreadCache::exited)
+    {
+        static thread_local ThreadCache cache;
+        ThreadCache::current = &cache;
+    }
+    return ThreadCache::current;
+}
+
+HugePageArena &
+HugePageArena::instance(void)
+{
+    static HugePageArena arena;
+    return arena;
+}
+
+HugePageArena::HugePageArena()
+{
+    for(auto & leaf : chunk_table)
+        leaf.store(nullptr, std::memory_order_relaxed);
+}
+
+void
+HugePageArena::add_chunks(char * start, size_t size)
+{
+    for(size_t offset = 0; offset < size; offset += chunk_size)
+    {
+        uintptr_t n = (uintptr_t)(start + offset) >> chunk_bits;
+        // mmap only goes over 47 bits when asked to
+        assert((n >> (root_bits + leaf_bits)) == 0);
+        auto & root = chunk_table[n >> leaf_bits];
+        auto * leaf = root.load(std::memory_order_relaxed);
+        if(leaf == nullptr)
+        {
+            leaf = new std::atomic<bool>[(size_t)1 << leaf_bits]();
+            root.store(leaf, std::memory_order_release);
+        }
+        leaf[n & (((size_t)1 << leaf_bits) - 1)].store(true, std::memory_order_relaxed);
+    }
+}
+
+bool
+HugePageArena::owns(void const * p) const
+{
+    uintptr_t n = (uintptr_t)p >> chunk_bits;
+    if((n >> (root_bits + leaf_bits)) != 0)
+        return false;
+    // the memory freed was handed out after its chunk was added
+    auto * leaf = chunk_table[n >> leaf_bits].load(std::memory_order_acquire);
+    return leaf != nullptr && leaf[n & (((size_t)1 << leaf_bits) - 1)].load(std::memory_order_relaxed);
+}
+
+char *
+HugePageArena::map_chunks(size_t size)
+{
+#ifdef MAP_HUGETLB
+    // explicit huge pages, only there if the administrator reserved some
+    void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(p != MAP_FAILED)
+    {
+        stats.explicit_huge += size;
+        stats.mapped += size;
+        return (char*)p;
+    }
+#endif
+
+    // map more than needed to find an aligned start, the kernel
+    // can only back aligned 2 MB ranges with transparent huge pages
+    char * raw = (char*)mmap(NULL, size + chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED)
+        throw std::bad_alloc();
+    char * start = (char*)round_up((uintptr_t)raw, chunk_size);
+    if(start != raw)
+        munmap(raw, start - raw);
+    if(start + size != raw + size + chunk_size)
+        munmap(start + size, raw + chunk_size - start);
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+    stats.mapped += size;
+    return start;
+}
+
+void *
+HugePageArena::allocate(size_t size)
+{
+    size = class_size(size);
+    if(size > max_small_size)
+        size = round_up(size, chunk_size);
+
+    in_use += size;
+
+    if(size <= max_small_size)
+    {
+        auto * cache = thread_cache();
+        if(cache != nullptr)
+        {
+            auto & cached = cache->lists[size];
+            if(!cached.empty())
+            {
+                void * p = cached.back();
+                cached.pop_back();
+                return p;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lck(lock);
+
+    auto & list = free_lists[size];
+    if(!list.empty())
+    {
+        void * p = list.back();
+        list.pop_back();
+        return p;
+    }
+
+    if(size > max_small_size)
+    {
+        char * p = map_chunks(size);
+        add_chunks(p, size);
+        return p;
+    }
+
+    if(left < size)
+    {
+        // the rest of the old chunk goes to the free lists of the small sizes
+        while(left >= 16)
+        {
+            size_t s = 16;
+            while(s * 2 <= left && s * 2 <= 256)
+                s *= 2;
+            free_lists[s].push_back(cursor);
+            cursor += s;
+            left -= s;
+        }
+        cursor = map_chunks(chunk_size);
+        left = chunk_size;
+        add_chunks(cursor, chunk_size);
+    }
+
+    void * p = cursor;
+    cursor += size;
+    left -= size;
+    return p;
+}
+
+bool
+HugePageArena::release(void * p, size_t size)
+{
+    if(p == nullptr || !owns(p))
+        return false;
+
+    size = class_size(size);
+    if(size > max_small_size)
+        size = round_up(size, chunk_size);
+
+    in_use -= size;
+
+    if(size <= max_small_size)
+    {
+        auto * cache = thread_cache();
+        if(cache != nullptr)
+        {
+            auto & cached = cache->lists[size];
+            cached.push_back(p);
+            if(cached.size() > thread_cache_limit)
+            {
+                size_t keep = thread_cache_limit / 2;
+                give_back(size, cached.data() + keep, cached.size() - keep);
+                cached.resize(keep);
+            }
+            return true;
+        }
+    }
+
+    give_back(size, &p, 1);
+    return true;
+}
+
+void
+HugePageArena::give_back(size_t size, void * const * first, size_t count)
+{
+    if(count == 0)
+        return;
+    std::lock_guard<std::mutex> lck(lock);
+    auto & list = free_lists[size];
+    list.insert(list.end(), first, first + count);
+}
+
+HugePageArena::Stats
+HugePageArena::get_stats(void)
+{
+    std::lock_guard<std::mutex> lck(lock);
+    Stats s = stats;
+    s.in_use = in_use;
+    return s;
+}
+
+} // namespace rtree
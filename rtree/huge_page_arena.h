@@ -0,0 +1,181 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Memory of the nodes, backed by 2 MB pages
+ *
+ * a tree that lives in the memory is a lot of small nodes and vectors spread
+ * over the heap, so walking it misses the TLB all the time.
+ * when the arena is enabled, the nodes (and their samples, children, buffers
+ * and values) are carved from 2 MB chunks, mapped with explicit huge pages
+ * if some are reserved (vm.nr_hugepages) or transparent huge pages otherwise.
+ *
+ * freed memory is kept in per size free lists for the next allocations,
+ * nothing is given back to the system. the small sizes are first kept by the
+ * thread that freed them, so neither releasing them nor telling the memory of
+ * the arena from the heap takes the lock
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+namespace rtree {
+
+struct HugePageArena
+{
+    static constexpr
+    size_t chunk_size = 2 * 1024 * 1024;
+
+    static HugePageArena & instance(void);
+
+    // only the allocations made while enabled come from the arena,
+    // memory from the arena can be freed at any time
+    void set_enabled(bool e) { enabled = e; }
+    bool is_enabled(void) const { return enabled; }
+
+    void * allocate(size_t size);
+
+    // false if `p` was not allocated from the arena
+    bool release(void * p, size_t size);
+
+    struct Stats {
+        // bytes mapped, and how many of them with explicit huge pages
+        size_t mapped = 0;
+        size_t explicit_huge = 0;
+        // bytes handed out and not released
+        size_t in_use = 0;
+    };
+
+    Stats get_stats(void);
+
+private:
+    HugePageArena();
+
+    // the free lists of the small sizes kept by the calling thread,
+    // nullptr once the thread is exiting
+    struct ThreadCache;
+    static ThreadCache * thread_cache(void);
+
+    // allocations larger than this get chunks of their own
+    static constexpr
+    size_t max_small_size = chunk_size / 4;
+
+    // the blocks of a size a thread keeps, half of them go back to
+    // `free_lists` when there are more
+    static constexpr
+    size_t thread_cache_limit = 256;
+
+    // map `size` bytes (a multiple of chunk_size), aligned to chunk_size
+    char * map_chunks(size_t size);
+
+    // the chunks in [start, start + size) are from the arena, must hold `lock`
+    void add_chunks(char * start, size_t size);
+    // without the lock
+    bool owns(void const * p) const;
+
+    // put the blocks of the size `size` back in `free_lists`
+    void give_back(size_t size, void * const * first, size_t count);
+
+    std::atomic<bool> enabled{false};
+
+    std::mutex lock;
+
+    // the chunk being carved
+    char * cursor = nullptr;
+    size_t left = 0;
+
+    std::unordered_map<size_t, std::vector<void*>> free_lists;
+
+    // which chunks are from the arena, by address >> chunk_bits, as a page table of
+    // two levels over the user address space. the leaves are added under `lock` and
+    // the entries are never cleared, nothing being unmapped, so `owns` only loads
+    static constexpr size_t chunk_bits = 21;
+    static constexpr size_t leaf_bits = 13;
+    static constexpr size_t root_bits = 48 - chunk_bits - leaf_bits;
+    static_assert(chunk_size == (size_t)1 << chunk_bits, "chunk_bits must match chunk_size");
+    std::atomic<std::atomic<bool>*> chunk_table[(size_t)1 << root_bits];
+
+    // bytes handed out, also updated by the threads without the lock
+    std::atomic<size_t> in_use{0};
+
+    Stats stats;
+};
+
+// the allocations of node memory made by the current thread so far,
+// from the arena or not
+inline size_t &
+node_allocations(void)
+{
+    static thread_local size_t count = 0;
+    return count;
+}
+
+inline void *
+arena_allocate(size_t size)
+{
+    ++node_allocations();
+    auto & arena = HugePageArena::instance();
+    if(arena.is_enabled())
+        return arena.allocate(size);
+    return ::operator new(size);
+}
+
+inline void
+arena_deallocate(void * p, size_t size)
+{
+    if(!HugePageArena::instance().release(p, size))
+        ::operator delete(p);
+}
+
+/*
+ * std allocator on top of the arena
+ * it is stateless, so containers can exchange memory with each other
+ */
+template <typename T>
+struct arena_allocator
+{
+    using value_type = T;
+
+    arena_allocator() = default;
+
+    template <typename U>
+    arena_allocator(arena_allocator<U> const&) { }
+
+    T * allocate(size_t n) { return static_cast<T*>(arena_allocate(n * sizeof(T))); }
+    void deallocate(T * p, size_t n) { arena_deallocate(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator == (arena_allocator<T> const&, arena_allocator<U> const&) { return true; }
+
+template <typename T, typename U>
+bool operator != (arena_allocator<T> const&, arena_allocator<U> const&) { return false; }
+
+// the containers of the nodes
+template <typename T>
+using node_vector = std::vector<T, arena_allocator<T>>;
+
+} // namespace rtree
@@ -64,6 +64,8 @@ struct inserter
     void apply (internal_node_type & node, entry_t & entry) {
         assert(!buffer_flushing);
         assert(!node.children.empty());
+        // the box of a child grows, and the children may be split
+        node.invalidate_child_boxes();
 
         auto compare = [](entry_t const& k, entry_t const& entry) -> bool {
             return k.min_key < entry.min_key;
@@ -82,11 +84,12 @@ struct inserter
         
         bg::expand(entry.bbox, value.get_point());
         ++entry.subtree_size;
+        entry.aggregate.add_value(value);
         if(NEED_SAMPLE)
             update_samples(node, entry);
 
         assert(apply_ret.new_entries.empty());
-        iter->apply_visitor(*this);
+        iter->apply_static(*this);
 
         // merge new nodes if the child has been split
         if(!apply_ret.new_entries.empty())
@@ -111,9 +114,11 @@ struct inserter
      */
     void apply (leaf_node_type & node, entry_t & entry) {
         assert(!buffer_flushing);
+        node.invalidate_child_boxes();
 
         bg::expand(entry.bbox, value.get_point());
         ++entry.subtree_size;
+        entry.aggregate.add_value(value);
         if(NEED_SAMPLE)
             update_samples(node, entry);
 
@@ -145,6 +150,7 @@ struct inserter
         assert(buffer_flushing);
 
         node.load_children_and_buffer_from_blocks(entry, block_manager);
+        node.invalidate_child_boxes();
 
         // parameters from caller 
         // indicating the incoming values
@@ -153,9 +159,12 @@ struct inserter
         size_t flush_size = std::distance(flush_first, flush_last);
         assert(flush_size > 0);
 
-        // bbox & subtree_size
+        // bbox & subtree_size & aggregate
         for(auto iter = flush_first; iter != flush_last; ++iter)
+        {
             bg::expand(entry.bbox, iter->get_point());
+            entry.aggregate.add_value(*iter);
+        }
         entry.subtree_size += flush_size;
 
         // update samples
@@ -218,9 +227,12 @@ struct inserter
 
         node.load_from_blocks(entry, block_manager);
 
-        // bbox & subtree_size
+        // bbox & subtree_size & aggregate
         for(auto iter = flush_first; iter != flush_last; ++iter)
+        {
             bg::expand(entry.bbox, iter->get_point());
+            entry.aggregate.add_value(*iter);
+        }
         entry.subtree_size += flush_size;
 
         // merge values
@@ -235,15 +247,24 @@ struct inserter
         }
 
         assert(apply_ret.new_entries.empty());
-        if(node.overflow(block_manager.get_block_size()))
+        if(node.overflow(block_manager))
         {
-            size_t capacity = node.capacity(block_manager.get_block_size());
+            // halve the runs until each of them fits in a block
+            auto runs_fit = [&](size_t step) -> bool {
+                for(size_t i = 0; i < node.values.size(); i += step)
+                {
+                    auto last = node.values.begin() + std::min(i + step, node.values.size());
+                    if(!io_leaf_node_type::fits(node.values.begin() + i, last, block_manager))
+                        return false;
+                }
+                return true;
+            };
 
             size_t step = node.values.size();
-            while(step > capacity)
+            while(!runs_fit(step))
                 step /= 2;
 
-            std::vector<Value> tmp_values;
+            decltype(node.values) tmp_values;
             tmp_values.swap(node.values);
 
             size_t values_left = tmp_values.size();
@@ -304,7 +325,7 @@ private:
 
         // the result after potentially splitting
         // saving all the children that have been processed.
-        std::vector<entry_t> next_children;
+        decltype(node.children) next_children;
         next_children.reserve(node.children.size());
 
         auto buffer_iter = node.buffer.begin();
@@ -339,7 +360,7 @@ private:
             apply_arg.last = buffer_iter2;
             
             assert(apply_ret.new_entries.empty());
-            child_iter->apply_visitor(*this);
+            child_iter->apply_static(*this);
             next_children.push_back(std::move(*child_iter));
             ++child_iter;
             
@@ -376,7 +397,7 @@ private:
 
         auto child_iter = node.children.begin();
 
-        std::vector<entry_t> next_children;
+        decltype(node.children) next_children;
         next_children.reserve(node.children.size());
 
         while(true)
@@ -416,7 +437,7 @@ private:
                     apply_arg.last = buffer_iter2;
                     
                     assert(apply_ret.new_entries.empty());
-                    child_iter->apply_visitor(*this);
+                    child_iter->apply_static(*this);
                     buffer_iter = buffer_iter2;
                 }
             }
@@ -460,7 +481,7 @@ private:
 
         assert(step >= min_fanout);
 
-        std::vector<entry_t> tmp_children;
+        decltype(node.children) tmp_children;
         tmp_children.swap(node.children);
 
         size_t children_left = tmp_children.size();
@@ -476,7 +497,7 @@ private:
         {
             node.samples.clear();
             sample_builder<MemNodeSampleSize, Box, Key, Value, SampleValue> sb(block_manager);
-            node.apply_visitor(sb, entry);
+            sb.apply(node, entry);
         }
         // will be saved outside this function
 
@@ -518,7 +539,7 @@ private:
             if(NEED_SAMPLE)
             {
                 sample_builder<MemNodeSampleSize, Box, Key, Value, SampleValue> sb(block_manager);
-                new_node->apply_visitor(sb, new_entry);
+                sb.apply(*new_node, new_entry);
             }
 
             if(new_entry.is_io_node())
@@ -573,7 +594,7 @@ public:
     struct {
         // if a node has been split
         // new entries are kept here
-        std::vector<entry_t> new_entries;
+        node_vector<entry_t> new_entries;
     } apply_ret;
 
 
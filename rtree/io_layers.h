@@ -35,10 +35,133 @@ struct IOLayersParameters
     // the maximum number of nodes in the top layer
     // we will stop building more layers when there are few enough nodes
     size_t max_top_layer_io_node_count = 1024;
-    // maximum number of nodes to cache in the memory (in the block manager)
+    // maximum number of blocks to cache in the memory (in the block manager's buffer pool)
+    // 0 for unlimited
     size_t cached_blocks = 4096;
+    // encode the values of the leaf nodes with leaf_codec (see serialization/leaf_codec.h)
+    // the leaves then hold as many values as fit in a block once encoded
+    bool compress_leaves = false;
+    // store the values of the leaf nodes in columns (see serialization/leaf_columns.h)
+    // so the queries filter them with a SIMD box test, can't be combined with compress_leaves
+    bool columnar_leaves = false;
+    /*
+     * the layout of the arrays (samples, children, buffers) in the blocks
+     *  1 - the size of an array is a uint16_t, so no array holds more than 65535 values.
+     *      the format of the files written before node_format existed
+     *  2 - the size is a uint32_t, needed by blocks larger than about 1 MB
+     * the .iolayers and .memnodes files use the same width for their arrays
+     */
+    uint32_t node_format = latest_node_format;
+
+    static constexpr
+    uint32_t latest_node_format = 2;
+
+    // spread the blocks over several data files (see StripingParameters)
+    // kept in the metadata of the block manager rather than in the .iolayers file
+    StripingParameters striping;
+
+    /*
+     * the parameters are saved at the beginning of the .iolayers file
+     * files written before the format was versioned start with fill_ratio
+     * and have no magic, they are still loaded
+     */
+    void dump_to(std::ostream & out) const;
+    void load_from(std::istream & in);
+
+    // a NaN as a double, so it is never mistaken for fill_ratio
+    static constexpr
+    uint64_t format_magic = 0x7ff8535250524c49ULL;
+
+    // 2: node_format
+    // 3: columnar_leaves
+    static constexpr
+    uint32_t format_version = 3;
+
+    static constexpr
+    size_t serialization_size = 
+        sizeof(uint64_t) +
+        sizeof(uint32_t) +
+        sizeof(double) +
+        3 * sizeof(uint64_t) +
+        sizeof(uint8_t) +
+        sizeof(uint32_t) +
+        sizeof(uint8_t);
 };
 
+} // namespace rtree
+
+template <>
+struct has_dump_load_method<rtree::IOLayersParameters>
+{
+    static constexpr bool value = true;
+};
+
+namespace rtree {
+
+inline void
+IOLayersParameters::dump_to(std::ostream & out) const
+{
+    uint64_t magic = format_magic;
+    uint32_t version = format_version;
+    dump_value(out, magic);
+    dump_value(out, version);
+    dump_value(out, fill_ratio);
+    dump_value(out, (uint64_t)block_size);
+    dump_value(out, (uint64_t)max_top_layer_io_node_count);
+    dump_value(out, (uint64_t)cached_blocks);
+    dump_value(out, (uint8_t)compress_leaves);
+    dump_value(out, node_format);
+    dump_value(out, (uint8_t)columnar_leaves);
+}
+
+inline void
+IOLayersParameters::load_from(std::istream & in)
+{
+    uint64_t magic;
+    load_value(in, magic);
+    if(magic != format_magic)
+    {
+        // legacy format, the struct was dumped as it is
+        static_assert(sizeof(fill_ratio) == sizeof(magic), "fill_ratio is the first field of the legacy format");
+        std::memcpy(&fill_ratio, &magic, sizeof(fill_ratio));
+        load_value(in, block_size);
+        load_value(in, max_top_layer_io_node_count);
+        load_value(in, cached_blocks);
+        compress_leaves = false;
+        node_format = 1;
+        columnar_leaves = false;
+        return;
+    }
+
+    uint32_t version;
+    load_value(in, version);
+    if(version > format_version)
+        throw std::runtime_error("IOLayersParameters: the .iolayers file is from a newer version");
+
+    uint64_t v;
+    uint8_t flag;
+    load_value(in, fill_ratio);
+    load_value(in, v);
+    block_size = v;
+    load_value(in, v);
+    max_top_layer_io_node_count = v;
+    load_value(in, v);
+    cached_blocks = v;
+    load_value(in, flag);
+    compress_leaves = flag;
+    node_format = 1;
+    if(version >= 2)
+        load_value(in, node_format);
+    if(node_format == 0 || node_format > latest_node_format)
+        throw std::runtime_error("IOLayersParameters: unknown node format " + std::to_string(node_format));
+    columnar_leaves = false;
+    if(version >= 3)
+    {
+        load_value(in, flag);
+        columnar_leaves = flag;
+    }
+}
+
 struct IOLayerBuildStatistics
 {
     // the time it took to read and prepare all the elements (for disk based building)
@@ -129,6 +252,23 @@ struct IOLayers
     BlockManager &
     get_block_manager(void) { return *block_manager; }
 
+    /*
+     * Rewrite the data file so that each subtree of the top layer is stored
+     * contiguously, nodes in depth first order.
+     * the bids in the top layer are updated
+     * loaded IO nodes (see node_loader) are not supported, the block manager is
+     * replaced so no cursor may be alive
+     */
+    void
+    relayout(void);
+
+    /*
+     * Same as above for the subtrees of `entries`, whose bids are updated.
+     * they become the new top layer, for when the tree has changed since it was built
+     */
+    void
+    relayout(std::vector<entry_t*> const& entries);
+
     const IOLayerBuildStatistics get_statistics() const
     {
         return last_build_statistics;
@@ -136,7 +276,8 @@ struct IOLayers
 
 private:
     IOLayers(std::string const& filename)
-        : iolayers_file(filename + ".iolayers", std::fstream::in | std::fstream::out | std::fstream::binary)
+        : filename(filename)
+        , iolayers_file(filename + ".iolayers", std::fstream::in | std::fstream::out | std::fstream::binary)
     { }
 
     void save_to_file(void);
@@ -154,9 +295,31 @@ private:
     std::vector<entry_t>
     build_internal(Iterator first, Iterator last, size_t min_fanout, size_t max_fanout);
 
+    // throws std::runtime_error if the nodes don't fit in a block of parameters.block_size
+    // or if an array may hold more values than parameters.node_format allows
+    void
+    check_capacities(void) const;
+
+    // set up the block manager for the nodes of this tree
+    void
+    configure(BlockManager & manager) const;
+
+    // the values of the leaves are encoded, see IOLayersParameters::compress_leaves
+    bool
+    compress_leaves(void) const { return parameters.compress_leaves && leaf_codec<Value>::compressing; }
+
+    // the values of the leaves are in columns, see IOLayersParameters::columnar_leaves
+    bool
+    columnar_leaves(void) const { return parameters.columnar_leaves && leaf_columns<Value>::columnar; }
+
+    // copy the subtree of `entry` into `target`, `entry.bid` is updated
+    void
+    copy_subtree(entry_t & entry, BlockManager & target);
+
     IOLayersParameters parameters;
     std::vector<entry_t> top_layer;
 
+    std::string filename;
     std::fstream iolayers_file;
     std::unique_ptr<BlockManager> block_manager;
 
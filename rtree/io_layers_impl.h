@@ -34,6 +34,10 @@ SOFTWARE.
 #include <cstdio>
 #include <chrono>
 #include <type_traits>
+#include <limits>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
 
 #include <stdlib.h>
 
@@ -56,7 +60,8 @@ IOLayers TARGS::build(Iterator first, Iterator last)
     // dump information
     std::cerr << "Building IO layers..." << std::endl;
     std::cerr << "block size: " << parameters.block_size << std::endl;
-    std::cerr << "leaf node capacity: " << leaf_node_type::capacity(parameters.block_size) << std::endl;
+    std::cerr << "leaf node capacity: " << leaf_node_type::capacity(parameters.block_size)
+        << (compress_leaves() ? " (before compression)" : "") << std::endl;
     std::cerr << "internal node capacity: " << internal_node_type::capacity(parameters.block_size) << std::endl;
 
     using element_type = typename std::iterator_traits<Iterator>::value_type;
@@ -120,7 +125,8 @@ IOLayers TARGS::build(const std::string &inputFile, converter_t ReadConverter, s
     // output statistical information
     std::cerr << "Building IO layers..." << std::endl;
     std::cerr << "block size: " << parameters.block_size << std::endl;
-    std::cerr << "leaf node capacity: " << leaf_node_type::capacity(parameters.block_size) << std::endl;
+    std::cerr << "leaf node capacity: " << leaf_node_type::capacity(parameters.block_size)
+        << (compress_leaves() ? " (before compression)" : "") << std::endl;
     std::cerr << "internal node capacity: " << internal_node_type::capacity(parameters.block_size) << std::endl;
 
     // open temp file
@@ -360,7 +366,10 @@ IOLayers TARGS::create(std::string const& filename, IOLayersParameters const& pa
 
     IOLayers TARGS * p = new IOLayers TARGS(filename);
     p->parameters = parameters;
-    p->block_manager = BlockManager::create(filename, parameters.block_size);
+    p->check_capacities();
+    p->block_manager = BlockManager::create(filename, parameters.block_size, parameters.cached_blocks,
+            StorageKind::DEFAULT, parameters.striping);
+    p->configure(*p->block_manager);
     return std::unique_ptr<IOLayers TARGS>(p);
 }
 
@@ -370,7 +379,10 @@ IOLayers TARGS::load(std::string const& filename)
 {
     IOLayers TARGS * p = new IOLayers TARGS(filename);
     p->load_from_file();
-    p->block_manager = BlockManager::load(filename);
+    p->check_capacities();
+    p->block_manager = BlockManager::load(filename, p->parameters.cached_blocks);
+    p->configure(*p->block_manager);
+    p->parameters.striping = p->block_manager->get_striping();
     if(p->block_manager->get_block_size() != p->parameters.block_size) 
     {
         std::cerr << "Warning: block_size mismatch between IOLayers and BlockManager! " 
@@ -382,13 +394,139 @@ IOLayers TARGS::load(std::string const& filename)
     return std::unique_ptr<IOLayers TARGS>(p);
 }
 
+TDECL
+void
+IOLayers TARGS::check_capacities(void) const
+{
+    size_t block_size = parameters.block_size;
+    auto too_small = [&](std::string const& what) {
+        return std::runtime_error("IOLayers: a block of " + std::to_string(block_size) + " bytes cannot hold " + what);
+    };
+
+    if(block_size < internal_node_type::buffer_offset() + sizeof(size_t) + serializer<Value>::size)
+        throw too_small("the children and the buffer of an internal node");
+    if(block_size < sizeof(size_t) + serializer<SampleValue>::size)
+        throw too_small("the samples of an internal node");
+    if(leaf_node_type::capacity(block_size) < 2)
+        throw too_small("a leaf node");
+
+    if(parameters.compress_leaves && parameters.columnar_leaves)
+        throw std::runtime_error("IOLayers: the leaves can't be both compressed and in columns");
+
+    size_t max_array_size = parameters.node_format >= 2 ? std::numeric_limits<uint32_t>::max() : std::numeric_limits<uint16_t>::max();
+    size_t largest = std::max(internal_node_type::sample_capacity(block_size), internal_node_type::buffer_capacity(block_size));
+    if(largest > max_array_size || parameters.max_top_layer_io_node_count > max_array_size)
+        throw std::runtime_error("IOLayers: arrays of " + std::to_string(largest) + " values need a larger size header than node format "
+                + std::to_string(parameters.node_format) + " has, use a smaller block size or node format 2");
+}
+
+TDECL
+void
+IOLayers TARGS::configure(BlockManager & manager) const
+{
+    manager.set_compress_leaves(compress_leaves());
+    manager.set_columnar_leaves(columnar_leaves());
+    manager.set_node_format(parameters.node_format);
+}
+
+TDECL
+void
+IOLayers TARGS::relayout(void)
+{
+    std::vector<entry_t*> entries;
+    for(auto & entry : top_layer)
+        entries.push_back(&entry);
+    relayout(entries);
+}
+
+TDECL
+void
+IOLayers TARGS::relayout(std::vector<entry_t*> const& entries)
+{
+    std::string relayout_name = filename + ".relayout";
+    auto storage_kind = block_manager->get_storage();
+    auto cache_budget = block_manager->get_cache_budget();
+    auto striping = block_manager->get_striping();
+
+    // nothing is changed until the copy is complete
+    std::vector<entry_t> new_top_layer;
+    new_top_layer.reserve(entries.size());
+    {
+        // the target is only written, it needs no cache
+        auto target = BlockManager::create(relayout_name, parameters.block_size, 1, storage_kind, striping);
+        configure(*target);
+        for(auto * entry : entries)
+        {
+            new_top_layer.push_back(*entry);
+            copy_subtree(new_top_layer.back(), *target);
+        }
+    }
+
+    block_manager.reset();
+    std::vector<std::pair<std::string, std::string>> files;
+    for(size_t i = 0; i < striping.file_count(); ++i)
+        files.emplace_back(striping.file_name(relayout_name, i), striping.file_name(filename, i));
+    files.emplace_back(relayout_name + ".metadata", filename + ".metadata");
+    for(auto const& file : files)
+    {
+        if(std::rename(file.first.c_str(), file.second.c_str()) != 0)
+            throw std::runtime_error("IOLayers::relayout cannot replace " + file.second);
+    }
+    block_manager = BlockManager::load(filename, parameters.cached_blocks, storage_kind);
+    block_manager->set_cache_budget(cache_budget);
+    configure(*block_manager);
+
+    for(size_t i = 0; i < entries.size(); ++i)
+        entries[i]->bid = new_top_layer[i].bid;
+    top_layer.swap(new_top_layer);
+
+    save_to_file();
+}
+
+TDECL
+void
+IOLayers TARGS::copy_subtree(entry_t & entry, BlockManager & target)
+{
+    // nodes are allocated before their children, so a subtree is stored
+    // in depth first order in one extent
+    switch(entry.type)
+    {
+        case entry_t::IO_INTERNAL_TYPE:
+            {
+                internal_node_type node;
+                node.load_samples_from_blocks(entry, *block_manager);
+                node.load_children_and_buffer_from_blocks(entry, *block_manager);
+
+                internal_node_type::allocate_blocks(entry, target);
+                for(auto & child : node.children)
+                    copy_subtree(child, target);
+                node.save_to_blocks(entry, target);
+            }
+            break;
+        case entry_t::IO_LEAF_TYPE:
+            {
+                leaf_node_type node;
+                node.load_from_blocks(entry, *block_manager);
+
+                leaf_node_type::allocate_blocks(entry, target);
+                node.save_to_blocks(entry, target);
+            }
+            break;
+        default:
+            throw std::runtime_error("IOLayers::relayout only IO nodes that are not loaded can be moved");
+    }
+}
+
 TDECL
 void
 IOLayers TARGS::save_to_file(void) 
 {
     iolayers_file.seekp(0);
     dump_value(iolayers_file, parameters);
-    dump_array(iolayers_file, top_layer);
+    if(parameters.node_format >= 2)
+        dump_array<uint32_t>(iolayers_file, top_layer);
+    else
+        dump_array<uint16_t>(iolayers_file, top_layer);
 }
 
 TDECL
@@ -397,7 +535,10 @@ IOLayers TARGS::load_from_file(void)
 {
     iolayers_file.seekg(0);
     load_value(iolayers_file, parameters);
-    load_array(iolayers_file, top_layer);
+    if(parameters.node_format >= 2)
+        load_array<uint32_t>(iolayers_file, top_layer);
+    else
+        load_array<uint16_t>(iolayers_file, top_layer);
     std::cerr << "top_layer size: " << top_layer.size() << std::endl;
     std::cerr << "block size: " << parameters.block_size << std::endl;
 }
@@ -414,22 +555,38 @@ IOLayers TARGS::build_leaves(Iterator first, Iterator last, size_t min_leaf_size
 
     auto iter = first;
 
+    size_t max_leaf_bytes = parameters.block_size * parameters.fill_ratio;
+
     while(element_left > 0)
     {
         // build the next leaf node
         leaf_node_type cur_leaf_node;
 
-        // determine how many values in the leaf
-        size_t size = next_fanout(element_left, min_leaf_size, max_leaf_size);
-        element_left -= size;
-
         auto min_key = iter->second;
 
-        cur_leaf_node.values.reserve(size);
-        for(size_t i = 0; i < size; ++i)
+        if(compress_leaves())
         {
-            cur_leaf_node.values.push_back(*(iter->first));
-            ++iter;
+            // take values while they fit once encoded
+            leaf_size_counter<Value> counter;
+            do {
+                counter.append(*(iter->first));
+                cur_leaf_node.values.push_back(*(iter->first));
+                ++iter;
+                --element_left;
+            } while(element_left > 0 && counter.size_with(*(iter->first)) <= max_leaf_bytes);
+        }
+        else
+        {
+            // determine how many values in the leaf
+            size_t size = next_fanout(element_left, min_leaf_size, max_leaf_size);
+            element_left -= size;
+
+            cur_leaf_node.values.reserve(size);
+            for(size_t i = 0; i < size; ++i)
+            {
+                cur_leaf_node.values.push_back(*(iter->first));
+                ++iter;
+            }
         }
 
         entry_t cur_entry;
@@ -458,29 +615,39 @@ IOLayers TARGS::build_leaves(stxxl::vector<builder_type> &input_vec, size_t elem
     stxxl::stream::vector_iterator2stream<typename stxxl::vector<builder_type>::const_iterator>
         input(input_vec.begin(), input_vec.end());
 
-    builder_type cur_item = *input;
-    ++input;
+    size_t max_leaf_bytes = parameters.block_size * parameters.fill_ratio;
 
     while (element_left > 0)
     {
         // build the next leaf node
         leaf_node_type cur_leaf_node;
 
-        // determine how many values in the leaf
-        size_t size = next_fanout(element_left, min_leaf_size, max_leaf_size);
-        element_left -= size;
-
         // we want to assign a minimum min_key for the first leaf
-        auto min_key = cur_item.second;
+        auto min_key = (*input).second;
 
-        cur_leaf_node.values.reserve(size);
-        cur_leaf_node.values.push_back(cur_item.first);
-        for (size_t i = 0; i < size-1; ++i)
+        if (compress_leaves())
+        {
+            // take values while they fit once encoded
+            leaf_size_counter<Value> counter;
+            do {
+                counter.append((*input).first);
+                cur_leaf_node.values.push_back((*input).first);
+                ++input;
+                --element_left;
+            } while (element_left > 0 && counter.size_with((*input).first) <= max_leaf_bytes);
+        }
+        else
         {
-            cur_item = *input;
-            ++input;
-            
-            cur_leaf_node.values.push_back(cur_item.first);
+            // determine how many values in the leaf
+            size_t size = next_fanout(element_left, min_leaf_size, max_leaf_size);
+            element_left -= size;
+
+            cur_leaf_node.values.reserve(size);
+            for (size_t i = 0; i < size; ++i)
+            {
+                cur_leaf_node.values.push_back((*input).first);
+                ++input;
+            }
         }
 
         entry_t cur_entry;
@@ -0,0 +1,84 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Recycled objects of the io nodes
+ *
+ * every io node visited that is not loaded in memory is created, read from
+ * its blocks, and freed right away. instead of going back to the heap,
+ * freed nodes are kept in a small per thread pool and handed out again,
+ * with the capacity of their containers, so visiting them in a steady
+ * state allocates nothing.
+ *
+ * Node must have a `clear` method emptying it but keeping the memory
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace rtree {
+
+template <typename Node>
+struct io_node_pool
+{
+    // more than the io levels of any tree, the nodes above are deleted
+    static constexpr
+    size_t capacity = 16;
+
+    static Node * acquire(void) {
+        auto & nodes = free_nodes();
+        if(nodes.empty())
+            return new Node();
+        Node * node = nodes.back();
+        nodes.pop_back();
+        return node;
+    }
+
+    // `node` must come from `new`, acquire or not
+    static void release(Node * node) {
+        auto & nodes = free_nodes();
+        if(nodes.size() >= capacity)
+        {
+            delete node;
+            return;
+        }
+        node->clear();
+        nodes.push_back(node);
+    }
+
+private:
+    struct node_list
+    {
+        ~node_list() {
+            for(auto * node : nodes)
+                delete node;
+        }
+        std::vector<Node*> nodes;
+    };
+
+    static std::vector<Node*> & free_nodes(void) {
+        static thread_local node_list list;
+        return list.nodes;
+    }
+};
+
+} // namespace rtree
@@ -70,7 +70,7 @@ struct mem_node_cleaner
         {
             if(child_entry.is_mem_node() || child_entry.is_loaded_io_node())
             {
-                child_entry.apply_visitor(*this);
+                child_entry.apply_static(*this);
                 delete child_entry.node_ptr;
             }
         }
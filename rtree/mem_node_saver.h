@@ -21,6 +21,12 @@ SOFTWARE.
 */
 #pragma once
 
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
 #define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
 #define TARGS <Box, Key, Value, SampleValue>
 
@@ -28,6 +34,7 @@ namespace rtree {
 
 /*
  * walk and load all the nodes
+ * the nodes are saved as a mem_node_snapshot, the older formats can still be loaded
  */
 template<
     typename Box, typename Key, typename Value, typename SampleValue
@@ -44,23 +51,23 @@ struct mem_node_saver
     using entry_t = typename base_t::entry_t;
     using base_t::block_manager;
 
-    mem_node_saver(BlockManager & block_manager, std::string const& filename)
+    using slab_type = sample_slab<SampleValue>;
+
+    using snapshot_type = mem_node_snapshot<Box, Key, Value, SampleValue>;
+
+    // the slots of the snapshot are as large as those of `slab`
+    mem_node_saver(BlockManager & block_manager, std::string const& filename, slab_type const * slab = nullptr)
         : base_t(block_manager)
-        , outf(filename.c_str(), std::ofstream::binary)
+        , filename(filename)
+        , slot_size(slab ? slab->get_slot_size() : 0)
     { }
 
+    // the whole subtree is saved from the node it is applied to
     void apply (internal_node_type & node, entry_t & entry) {
-        dump_value(outf, entry);
-        dump_array(outf, node.samples);
-        dump_value(outf, (size_t)node.children.size());
-        for(auto & child_entry : node.children) 
-            child_entry.apply_visitor(*this);
+        snapshot_type::save(filename, entry, slot_size);
     }
     void apply (leaf_node_type & node, entry_t & entry) {
-        dump_value(outf, entry);
-        dump_array(outf, node.samples);
-        dump_array(outf, node.buffer);
-        dump_array(outf, node.children);
+        snapshot_type::save(filename, entry, slot_size);
     }
     void apply (io_internal_node_type & node, entry_t & entry) {
         assert(false);
@@ -70,16 +77,89 @@ struct mem_node_saver
         assert(false);
     }
 
+    // `slab` receives the slab of the file, it is left empty by the files without one
     static
-    entry_t load(std::string const& filename) {
+    entry_t load(std::string const& filename, std::unique_ptr<slab_type> & slab) {
         std::ifstream inf(filename.c_str(), std::ifstream::binary);
-        assert(inf);
-        return load_entry(inf);
+        uint32_t version = file_version(inf, filename);
+        if(version == snapshot_type::version)
+        {
+            inf.close();
+            return snapshot_type::load(filename, slab);
+        }
+
+        slab.reset();
+        if(version >= 2)
+        {
+            uint64_t slot_size;
+            load_value(inf, slot_size);
+            node_vector<SampleValue> samples;
+            load_array<uint64_t>(inf, samples);
+            if(slot_size > 0)
+                slab.reset(new slab_type(slot_size, std::move(samples)));
+        }
+        return load_entry(inf, version, slab.get());
+    }
+
+    // whether `filename` is older than the snapshot, which loads much faster
+    static
+    bool is_outdated(std::string const& filename) {
+        std::ifstream inf(filename.c_str(), std::ifstream::binary);
+        return file_version(inf, filename) != snapshot_type::version;
     }
 
 private:
+    // 0: no header, 16 bit array sizes
+    // 1: 32 bit array sizes
+    // 2: the samples of the nodes in a slab
+    // 3: mem_node_snapshot
+    static
+    uint32_t file_version(std::ifstream & inf, std::string const& filename) {
+        if(!inf)
+            throw std::runtime_error("mem_node_saver: cannot open " + filename);
+
+        // the files written before the header start with the type of the root entry
+        uint32_t version = 0;
+        if(inf.peek() == memnodes_magic[0])
+        {
+            char file_magic[sizeof(memnodes_magic)];
+            inf.read(file_magic, sizeof(file_magic));
+            load_value(inf, version);
+            if(!inf || !std::equal(file_magic, file_magic + sizeof(file_magic), memnodes_magic) ||
+                    version == 0 || version > snapshot_type::version)
+                throw std::runtime_error("mem_node_saver: " + filename + " is not a memnodes file this version can read");
+        }
+        return version;
+    }
+
+    static
+    void load_samples(std::istream & in, internal_node_type & node, uint32_t version, slab_type * slab) {
+        if(version < 2)
+            return load_sized_array(in, node.samples, version);
+
+        uint32_t slot;
+        load_value(in, slot);
+        if(slot == sample_array<SampleValue>::NO_SLOT)
+            return load_array<uint32_t>(in, node.samples);
+
+        uint32_t size;
+        load_value(in, size);
+        if(slab == nullptr || slot >= slab->get_slot_count() || size > slab->get_slot_size())
+            throw std::runtime_error("mem_node_saver: a node refers to a slot out of the sample slab");
+        node.samples.use_slot(*slab, slot, size);
+    }
+
+    template <typename ArrayType>
+    static
+    void load_sized_array(std::istream & in, ArrayType & at, uint32_t version) {
+        if(version >= 1)
+            load_array<uint32_t>(in, at);
+        else
+            load_array<uint16_t>(in, at);
+    }
+
     static
-    entry_t load_entry(std::ifstream & inf) {
+    entry_t load_entry(std::ifstream & inf, uint32_t version, slab_type * slab) {
         assert(inf);
         entry_t entry;
         load_value(inf, entry);
@@ -88,14 +168,14 @@ private:
         {
             auto * node = new internal_node_type();
             entry.node_ptr = node;
-            load_array(inf, node->samples);
+            load_samples(inf, *node, version, slab);
 
             size_t children_count;
             load_value(inf, children_count);
             node->children.reserve(children_count);
             for(size_t i = 0; i < children_count; ++i)
             {
-                node->children.push_back(load_entry(inf));
+                node->children.push_back(load_entry(inf, version, slab));
             }
         }
         else
@@ -103,14 +183,15 @@ private:
             // leaf
             auto * node = new leaf_node_type();
             entry.node_ptr = node;
-            load_array(inf, node->samples);
-            load_array(inf, node->buffer);
-            load_array(inf, node->children);
+            load_samples(inf, *node, version, slab);
+            load_sized_array(inf, node->buffer, version);
+            load_sized_array(inf, node->children, version);
         }
         return entry;
     }
 
-    std::ofstream outf;
+    std::string filename;
+    size_t slot_size;
 };
 
 } // namespace rtree 
@@ -0,0 +1,395 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Snapshot of the mem nodes, mapped and used in place
+ *
+ * loading the mem nodes through a stream, field by field and node by node,
+ * takes minutes on the largest trees. the snapshot is laid out to be mapped
+ * instead: every section is an array of fixed size records, the mem nodes
+ * are numbered in breadth first order and refer to each other by number,
+ * and the samples section is the slab of the rtree, slot i for node i.
+ * loading maps the file, creates the nodes in one pass over the records and
+ * turns the numbers into pointers. the samples are used where they are in
+ * the mapping (copy on write), they are read when they are first touched
+ *
+ * layout, each section starts at a multiple of `alignment`:
+ *  header    mem_node_snapshot_header
+ *  nodes     a mem_node_snapshot_record per mem node
+ *  entries   the root entry then the children of the nodes, as fixed_layout<entry_t>,
+ *            the bid of a mem entry is the number of its node
+ *  buffers   the buffered values of the leaf nodes, serializer<Value>::size bytes each
+ *  samples   slot_size samples per node, serializer<SampleValue>::size bytes each
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include "mapped_file.h"
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+// the start of all the memnodes files with a header,
+// can't be mistaken for the type of an entry
+constexpr char memnodes_magic[8] = {'R', 'S', 'M', 'E', 'M', 'N', 'O', 'D'};
+
+struct mem_node_snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    // the sizes of an entry, a value and a sample,
+    // a file written for other types is refused
+    uint32_t entry_size;
+    uint32_t value_size;
+    uint32_t sample_size;
+
+    uint64_t node_count;
+    uint64_t entry_count;
+    uint64_t buffered_count;
+    uint64_t slot_size;
+
+    uint64_t nodes_offset;
+    uint64_t entries_offset;
+    uint64_t buffers_offset;
+    uint64_t samples_offset;
+    uint64_t file_size;
+};
+
+struct mem_node_snapshot_record
+{
+    // in the entries and in the buffers
+    uint64_t first_child;
+    uint64_t first_buffered;
+    uint32_t child_count;
+    uint32_t buffered_count;
+    // the samples are in slot i of the samples
+    uint32_t sample_count;
+    uint32_t is_leaf;
+};
+
+TDECL
+struct mem_node_snapshot
+{
+    using entry_t = node_entry TARGS;
+    using internal_node_type = internal_node TARGS;
+    using leaf_node_type = leaf_node TARGS;
+    using slab_type = sample_slab<SampleValue>;
+
+    static constexpr
+    uint32_t version = 3;
+
+    static constexpr
+    size_t alignment = 64;
+
+    /*
+     * write the mem nodes under `root`, the slots hold at least `slot_size` samples
+     * the file is written aside then renamed, a mapping of the old one stays valid
+     */
+    static
+    void save(std::string const& filename, entry_t const& root, size_t slot_size) {
+        assert(root.is_mem_node());
+
+        std::vector<internal_node_type const*> nodes;
+        std::vector<mem_node_snapshot_record> records;
+        std::vector<entry_t> entries;
+        uint64_t buffered_count = 0;
+
+        entries.push_back(root);
+        entries.back().bid = 0;
+        nodes.push_back(static_cast<internal_node_type const*>(root.node_ptr));
+        records.push_back(mem_node_snapshot_record());
+        records.back().is_leaf = root.is_leaf_node();
+
+        for(size_t i = 0; i < nodes.size(); ++i)
+        {
+            auto const& node = *nodes[i];
+            // records may move when the children are added
+            mem_node_snapshot_record r = records[i];
+            r.first_child = entries.size();
+            r.child_count = node.children.size();
+            r.sample_count = node.samples.size();
+            slot_size = std::max(slot_size, node.samples.size());
+            for(auto const& child : node.children)
+            {
+                entries.push_back(child);
+                if(child.is_mem_node())
+                {
+                    entries.back().bid = nodes.size();
+                    nodes.push_back(static_cast<internal_node_type const*>(child.node_ptr));
+                    records.push_back(mem_node_snapshot_record());
+                    records.back().is_leaf = child.is_leaf_node();
+                }
+            }
+            r.first_buffered = buffered_count;
+            r.buffered_count = r.is_leaf ? static_cast<leaf_node_type const&>(node).buffer.size() : 0;
+            buffered_count += r.buffered_count;
+            records[i] = r;
+        }
+
+        mem_node_snapshot_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::copy(memnodes_magic, memnodes_magic + sizeof(memnodes_magic), h.magic);
+        h.version = version;
+        h.entry_size = entry_layout::size;
+        h.value_size = serializer<Value>::size;
+        h.sample_size = serializer<SampleValue>::size;
+        h.node_count = nodes.size();
+        h.entry_count = entries.size();
+        h.buffered_count = buffered_count;
+        h.slot_size = slot_size;
+        h.nodes_offset = align(sizeof(h));
+        h.entries_offset = align(h.nodes_offset + h.node_count * sizeof(mem_node_snapshot_record));
+        h.buffers_offset = align(h.entries_offset + h.entry_count * h.entry_size);
+        h.samples_offset = align(h.buffers_offset + h.buffered_count * h.value_size);
+        h.file_size = h.samples_offset + h.node_count * h.slot_size * h.sample_size;
+
+        std::string tmp_filename = filename + ".tmp";
+        {
+            std::ofstream outf(tmp_filename.c_str(), std::ofstream::binary);
+            outf.write(reinterpret_cast<char const *>(&h), sizeof(h));
+
+            pad(outf, h.nodes_offset);
+            outf.write(reinterpret_cast<char const *>(records.data()), records.size() * sizeof(mem_node_snapshot_record));
+
+            pad(outf, h.entries_offset);
+            write_values(outf, entries.data(), entries.size());
+
+            pad(outf, h.buffers_offset);
+            for(size_t i = 0; i < nodes.size(); ++i)
+            {
+                if(records[i].is_leaf)
+                {
+                    auto const& buffer = static_cast<leaf_node_type const*>(nodes[i])->buffer;
+                    write_values(outf, buffer.data(), buffer.size());
+                }
+            }
+
+            pad(outf, h.samples_offset);
+            std::vector<SampleValue> filler(slot_size);
+            for(auto const * node : nodes)
+            {
+                write_values(outf, node->samples.data(), node->samples.size());
+                write_values(outf, filler.data(), slot_size - node->samples.size());
+            }
+
+            if(!outf)
+                throw std::runtime_error("mem_node_snapshot: cannot write " + tmp_filename);
+        }
+        if(std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+            throw std::runtime_error("mem_node_snapshot: cannot replace " + filename);
+    }
+
+    /*
+     * map the snapshot and rebuild the mem nodes on top of it
+     * `slab` receives the samples, it keeps the mapping alive
+     */
+    static
+    entry_t load(std::string const& filename, std::unique_ptr<slab_type> & slab) {
+        std::shared_ptr<mapped_file> file = std::make_shared<mapped_file>(filename);
+        mem_node_snapshot_header h;
+        if(file->size < sizeof(h))
+            throw std::runtime_error("mem_node_snapshot: " + filename + " is truncated");
+        std::memcpy(&h, file->data, sizeof(h));
+        check_header(h, file->size, filename);
+
+        char const * data = file->data;
+        auto const * records = reinterpret_cast<mem_node_snapshot_record const*>(data + h.nodes_offset);
+        char const * entries = data + h.entries_offset;
+        char const * buffers = data + h.buffers_offset;
+        char * samples = file->data + h.samples_offset;
+
+        slab.reset();
+        if(h.slot_size > 0)
+        {
+            if(sample_layout_is_memory_image && h.samples_offset % alignof(SampleValue) == 0)
+            {
+                slab.reset(new slab_type(h.slot_size, h.node_count, reinterpret_cast<SampleValue*>(samples), file));
+            }
+            else
+            {
+                node_vector<SampleValue> copy(h.slot_size * h.node_count);
+                read_values(samples, copy.data(), copy.size());
+                slab.reset(new slab_type(h.slot_size, std::move(copy)));
+            }
+        }
+
+        for(size_t i = 0; i < h.node_count; ++i)
+        {
+            auto const& r = records[i];
+            if(r.first_child + r.child_count > h.entry_count ||
+                    r.first_buffered + r.buffered_count > h.buffered_count ||
+                    r.sample_count > h.slot_size ||
+                    (!r.is_leaf && r.buffered_count > 0))
+                throw std::runtime_error("mem_node_snapshot: node " + std::to_string(i) + " of " + filename + " is out of the sections");
+        }
+
+        std::vector<internal_node_type*> nodes(h.node_count);
+        for(size_t i = 0; i < h.node_count; ++i)
+            nodes[i] = records[i].is_leaf ? new leaf_node_type() : new internal_node_type();
+
+        // the numbers of the nodes to pointers, every node but the root has one parent
+        std::vector<bool> referenced(h.node_count, false);
+        auto fix = [&](entry_t & entry) {
+            if(!entry.is_mem_node())
+                return;
+            if(entry.bid >= h.node_count || referenced[entry.bid] ||
+                    entry.is_leaf_node() != (bool)records[entry.bid].is_leaf)
+                throw std::runtime_error("mem_node_snapshot: " + filename + " has a bad mem entry");
+            referenced[entry.bid] = true;
+            entry.node_ptr = nodes[entry.bid];
+        };
+
+        entry_t root;
+        read_values(entries, &root, 1);
+        if(!root.is_mem_node() || root.bid != 0)
+            throw std::runtime_error("mem_node_snapshot: the root of " + filename + " is not its first node");
+        fix(root);
+
+        for(size_t i = 0; i < h.node_count; ++i)
+        {
+            auto const& r = records[i];
+            auto & node = *nodes[i];
+            node.children.resize(r.child_count);
+            read_values(entries + r.first_child * h.entry_size, node.children.data(), r.child_count);
+            for(auto & child : node.children)
+                fix(child);
+
+            if(r.is_leaf)
+            {
+                auto & buffer = static_cast<leaf_node_type&>(node).buffer;
+                buffer.resize(r.buffered_count);
+                read_values(buffers + r.first_buffered * h.value_size, buffer.data(), r.buffered_count);
+            }
+
+            if(slab)
+                node.samples.use_slot(*slab, i, r.sample_count);
+        }
+
+        return root;
+    }
+
+private:
+    using entry_layout = fixed_layout<entry_t>;
+
+    template <typename T, bool = fixed_layout<T>::value>
+    struct is_memory_image : std::false_type { };
+
+    template <typename T>
+    struct is_memory_image<T, true> : std::integral_constant<bool, fixed_layout<T>::is_memory_image> { };
+
+    static constexpr
+    bool sample_layout_is_memory_image = is_memory_image<SampleValue>::value;
+
+    static
+    size_t align(size_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+    static
+    void pad(std::ostream & out, size_t offset) {
+        static char const zeros[alignment] = { };
+        out.write(zeros, offset - (size_t)out.tellp());
+    }
+
+    static
+    void check_header(mem_node_snapshot_header const& h, size_t file_size, std::string const& filename) {
+        if(!std::equal(h.magic, h.magic + sizeof(h.magic), memnodes_magic) || h.version != version)
+            throw std::runtime_error("mem_node_snapshot: " + filename + " is not a snapshot of the mem nodes");
+        if(h.entry_size != entry_layout::size || h.value_size != serializer<Value>::size || h.sample_size != serializer<SampleValue>::size)
+            throw std::runtime_error("mem_node_snapshot: " + filename + " was written for other types");
+        if(h.file_size != file_size || h.node_count == 0 || h.entry_count == 0 ||
+                h.nodes_offset + h.node_count * sizeof(mem_node_snapshot_record) > h.entries_offset ||
+                h.entries_offset + h.entry_count * h.entry_size > h.buffers_offset ||
+                h.buffers_offset + h.buffered_count * h.value_size > h.samples_offset ||
+                h.samples_offset + h.node_count * h.slot_size * h.sample_size > h.file_size ||
+                h.nodes_offset % alignof(mem_node_snapshot_record) != 0)
+            throw std::runtime_error("mem_node_snapshot: the sections of " + filename + " don't fit in it");
+    }
+
+    // the values as fixed_layout<T> when they have one, through serializer<T> otherwise
+    template <typename T>
+    static
+    void write_values(std::ostream & out, T const * first, size_t count) {
+        write_values(out, first, count, std::integral_constant<bool, fixed_layout<T>::value>());
+    }
+
+    template <typename T>
+    static
+    void write_values(std::ostream & out, T const * first, size_t count, std::true_type) {
+        std::vector<char> buffer(count * fixed_layout<T>::size);
+        encode_fixed(buffer.data(), first, count);
+        out.write(buffer.data(), buffer.size());
+    }
+
+    template <typename T>
+    static
+    void write_values(std::ostream & out, T const * first, size_t count, std::false_type) {
+        for(size_t i = 0; i < count; ++i)
+            dump_value(out, first[i]);
+    }
+
+    template <typename T>
+    static
+    void read_values(char const * in, T * first, size_t count) {
+        read_values(in, first, count, std::integral_constant<bool, fixed_layout<T>::value>());
+    }
+
+    template <typename T>
+    static
+    void read_values(char const * in, T * first, size_t count, std::true_type) {
+        decode_fixed(in, first, count);
+    }
+
+    template <typename T>
+    static
+    void read_values(char const * in, T * first, size_t count, std::false_type) {
+        boost::iostreams::stream<boost::iostreams::basic_array_source<char>> stream(in, count * serializer<T>::size);
+        for(size_t i = 0; i < count; ++i)
+            load_value(stream, first[i]);
+    }
+};
+
+TDECL
+constexpr uint32_t mem_node_snapshot TARGS::version;
+
+TDECL
+constexpr size_t mem_node_snapshot TARGS::alignment;
+
+TDECL
+constexpr bool mem_node_snapshot TARGS::sample_layout_is_memory_image;
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
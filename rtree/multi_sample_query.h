@@ -0,0 +1,250 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * sample_query over a batch of queries sharing one traversal
+ *
+ * every query keeps its own cursor, but the frontiers are expanded together,
+ * one level of the tree at a time. a node in the frontier of several queries
+ * is visited once for all of them: its samples are routed to every query whose
+ * range intersects it, and its blocks are read once per batch.
+ * so the blocks read follow the union of the queries, not the sum of them
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+struct multi_sample_query
+{
+    using cursor_type = sample_query_cursor<Geometry, Box, Key, Value, SampleValue>;
+    using node_type = node TARGS;
+    using internal_node_type = internal_node TARGS;
+    using leaf_node_type = leaf_node TARGS;
+    using io_internal_node_type = io_internal_node TARGS;
+    using io_leaf_node_type = io_leaf_node TARGS;
+    using entry_t = typename node_type::entry_t;
+    using planned_entry = typename cursor_type::planned_entry;
+    using inserter_type = std::back_insert_iterator<std::vector<SampleValue>>;
+    using sampler_type = typename cursor_type::template sampler<inserter_type>;
+
+    multi_sample_query(std::vector<cursor_type> & cursors, BlockManager & block_manager)
+        : cursors(cursors)
+        , block_manager(block_manager)
+    { }
+
+    // put (at least) `sample_sizes[i]` samples into the sample buffer of `cursors[i]`
+    void run(std::vector<size_t> const& sample_sizes)
+    {
+        size_t cost0 = block_manager.get_stats().cost();
+
+        // the samplers of an earlier run are done with
+        samplers.clear();
+        for(auto & cursor : cursors)
+            samplers.emplace_back(new sampler_type(cursor, std::back_inserter(cursor.sample_buffer), cursor.rng));
+
+        // samples out of the range of a query are rejected, so like get_samples
+        // there are rounds until every query has enough, each one a single traversal
+        std::vector<planned_entry> plan;
+        while(true)
+        {
+            bool pending = false;
+            level current;
+            for(size_t q = 0; q < cursors.size(); ++q)
+            {
+                auto & cursor = cursors[q];
+                if(cursor.count == 0 || cursor.sample_buffer.size() >= sample_sizes[q])
+                    continue;
+                pending = true;
+                size_t ss = std::max<size_t>(sample_sizes[q] - cursor.sample_buffer.size(), cursor.nodes.size() * 4);
+                plan.clear();
+                samplers[q]->plan_samples(ss, plan);
+                add_demands(current, q, plan);
+            }
+            if(!pending)
+                break;
+
+            while(!current.empty())
+            {
+                prefetch(current);
+                level next;
+                for(auto const& group : current)
+                    serve(group.second, next);
+                current.swap(next);
+            }
+        }
+
+        for(auto & cursor : cursors)
+            std::shuffle(cursor.sample_buffer.begin(), cursor.sample_buffer.end(), cursor.rng);
+
+        io_cost = block_manager.get_stats().cost() - cost0;
+    }
+
+    // the cost of the blocks read by the batch, for all the queries
+    size_t get_io_cost(void) const { return io_cost; }
+
+private:
+    // samples drawn for a node by one of the queries
+    struct demand {
+        size_t query;
+        planned_entry plan;
+    };
+
+    // the demands on one level of the tree, grouped by node:
+    // the block of an io node, the address of the others
+    using node_key = std::pair<char, uintptr_t>;
+    using level = std::map<node_key, std::vector<demand>>;
+
+    static node_key
+    key_of(entry_t const& entry) {
+        if(entry.type == entry_t::IO_INTERNAL_TYPE || entry.type == entry_t::IO_LEAF_TYPE)
+            return node_key(entry.type, (uintptr_t)entry.bid);
+        return node_key(entry.type, (uintptr_t)entry.node_ptr);
+    }
+
+    static void
+    add_demands(level & l, size_t query, std::vector<planned_entry> const& plan) {
+        for(auto const& p : plan)
+            l[key_of(p.iter->node_entry)].push_back(demand{query, p});
+    }
+
+    // read the blocks of the IO nodes of the level as one batch
+    void prefetch(level const& l)
+    {
+        std::vector<bid_t> bids;
+        size_t sample_capacity = io_internal_node_type::sample_capacity(block_manager.get_block_size());
+        for(auto const& group : l)
+        {
+            auto const& entry = group.second.front().plan.iter->node_entry;
+            if(entry.type == entry_t::IO_LEAF_TYPE)
+            {
+                bids.push_back(entry.bid);
+            }
+            else if(entry.type == entry_t::IO_INTERNAL_TYPE)
+            {
+                bids.push_back(io_internal_node_type::sample_bid(entry));
+                // the samples can't be enough for one of the queries
+                for(auto const& d : group.second)
+                {
+                    if(d.plan.iter->sample_used + d.plan.sample_size > sample_capacity)
+                    {
+                        bids.push_back(io_internal_node_type::children_and_buffer_bid(entry));
+                        break;
+                    }
+                }
+            }
+        }
+
+        // a single read gains nothing from being batched
+        if(bids.size() > 1)
+            block_manager.prefetch_blocks(bids);
+    }
+
+    // the demands on one node
+    void serve(std::vector<demand> const& demands, level & next)
+    {
+        auto const& entry = demands.front().plan.iter->node_entry;
+        switch(entry.type)
+        {
+            case entry_t::INTERNAL_TYPE:
+                serve_node(static_cast<internal_node_type &>(*entry.node_ptr), demands, next);
+                return;
+            case entry_t::LEAF_TYPE:
+                serve_node(static_cast<leaf_node_type &>(*entry.node_ptr), demands, next);
+                return;
+            case entry_t::LOADED_IO_INTERNAL_TYPE:
+                serve_node(static_cast<io_internal_node_type &>(*entry.node_ptr), demands, next);
+                return;
+            case entry_t::LOADED_IO_LEAF_TYPE:
+                serve_node(static_cast<io_leaf_node_type &>(*entry.node_ptr), demands, next);
+                return;
+            case entry_t::IO_INTERNAL_TYPE:
+            {
+                auto * node = static_cast<io_internal_node_type *>(node_type::create(entry));
+                if(demands.size() > 1)
+                {
+                    // load what any of the queries needs,
+                    // then the node is in memory for all of them
+                    node->load_samples_from_blocks(entry, block_manager);
+                    for(auto const& d : demands)
+                    {
+                        if(d.plan.iter->sample_used + d.plan.sample_size > node->samples.size())
+                        {
+                            node->load_children_and_buffer_from_blocks(entry, block_manager);
+                            break;
+                        }
+                    }
+                    node->mem_resident = true;
+                }
+                serve_node(*node, demands, next);
+                node->mem_resident = false;
+                node->io_internal_node_type::free_from_entry();
+                return;
+            }
+            case entry_t::IO_LEAF_TYPE:
+            {
+                auto * node = static_cast<io_leaf_node_type *>(node_type::create(entry));
+                // a single query reads only what it needs (see load_covered_from_blocks)
+                if(demands.size() > 1)
+                {
+                    node->load_from_blocks(entry, block_manager);
+                    node->mem_resident = true;
+                }
+                serve_node(*node, demands, next);
+                node->mem_resident = false;
+                node->io_leaf_node_type::free_from_entry();
+                return;
+            }
+        }
+        assert(false);
+    }
+
+    template <typename Node>
+    void serve_node(Node & node, std::vector<demand> const& demands, level & next)
+    {
+        std::vector<planned_entry> children_plan;
+        for(auto const& d : demands)
+        {
+            children_plan.clear();
+            samplers[d.query]->sample_loaded_entry(node, d.plan.iter, d.plan.sample_size, d.plan.ground_size, children_plan);
+            add_demands(next, d.query, children_plan);
+        }
+    }
+
+    std::vector<cursor_type> & cursors;
+    BlockManager & block_manager;
+    std::vector<std::unique_ptr<sampler_type>> samplers;
+    size_t io_cost = 0;
+};
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
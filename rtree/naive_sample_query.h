@@ -37,8 +37,10 @@ struct naive_sample_query_cursor
         : block_manager(block_manager)
         , rng(rng_dev())
     {
+        size_t allocations0 = node_allocations();
         query_decomposer<Geometry> qd(query, *this);
-        root_entry.apply_visitor(qd);
+        root_entry.apply_static(qd);
+        stats.node_allocations += node_allocations() - allocations0;
 
         count = values.size();
         for(auto const& n : nodes)
@@ -89,39 +91,49 @@ private:
         }
         void apply (leaf_node_type & node, entry_t & entry) {
             visit_node(node, entry);
+            take_buffer(node);
             ++ cursor.stats.leaf_nodes;
         }
         void apply (io_internal_node_type & node, entry_t & entry) {
             node.load_children_and_buffer_from_blocks(entry, block_manager);
             visit_node(node, entry);
+            take_buffer(node);
             ++ cursor.stats.io_internal_nodes;
         }
 
         void apply (io_leaf_node_type & node, entry_t & entry) {
-            node.load_from_blocks(entry, cursor.block_manager);
-            for(auto const& v : node.values)
-            {
-                if(bg::covered_by(v.get_point(), query))
-                    cursor.values.push_back(v);
-            }
+            auto out = std::back_inserter(cursor.values);
+            node.load_covered_from_blocks(entry, cursor.block_manager, query, out);
             ++ cursor.stats.io_leaf_nodes;
         }
 
         template <typename NodeType>
         void visit_node(NodeType & node, entry_t const& entry) {
-            for(auto & child_entry : node.children) 
+            child_box_masks masks;
+            node.test_children(query, masks);
+            for(size_t i = 0; i < node.children.size(); ++i)
             {
-                if(bg::covered_by(child_entry.bbox, query))
+                auto & child_entry = node.children[i];
+                if(masks.covered(i))
                 {
                     cursor.nodes.push_back(child_entry);
                 }
-                else if (bg::intersects(child_entry.bbox, query))
+                else if (masks.intersects(i))
                 {
-                    child_entry.apply_visitor(*this);
+                    child_entry.apply_static(*this);
                 }
             }
         }
 
+        // the values inserted into a node on the border are in none of its children
+        void take_buffer(leaf_node_type const& node) {
+            for(auto const& v : node.buffer)
+            {
+                if(bg::covered_by(v.get_point(), query))
+                    cursor.values.push_back(v);
+            }
+        }
+
         cursor_type & cursor;
         Geometry const query;
     };
@@ -154,6 +166,7 @@ private:
             if(cursor.count == 0) return;
 
             size_t cost0 = block_manager.get_stats().cost();
+            size_t allocations0 = node_allocations();
 
             size_t samples_from_values = next_sample_size(sample_size, cursor.values.size(), cursor.count, rng);
             if(samples_from_values > 0)
@@ -169,6 +182,7 @@ private:
             }
 
             cursor.io_cost += block_manager.get_stats().cost() - cost0;
+            cursor.stats.node_allocations += node_allocations() - allocations0;
         }
 
         template<typename ValueIter>
@@ -196,7 +210,7 @@ private:
                 if(s > 0)
                 {
                     apply_arg.sample_size = s;
-                    iter->apply_visitor(*this);
+                    iter->apply_static(*this);
                     sample_size -= s;
                 }
 
@@ -212,12 +226,12 @@ private:
             ++ cursor.stats.internal_nodes;
         }
         void apply (leaf_node_type & node, entry_t & entry) {
-            visit_node(node, entry);
+            visit_node_and_buffer(node, entry);
             ++ cursor.stats.leaf_nodes;
         }
         void apply (io_internal_node_type & node, entry_t & entry) {
             node.load_children_and_buffer_from_blocks(entry, block_manager);
-            visit_node(node, entry);
+            visit_node_and_buffer(node, entry);
             ++ cursor.stats.io_internal_nodes;
         }
 
@@ -234,6 +248,18 @@ private:
             sample_from_entries(node.children.begin(), node.children.end(), entry.subtree_size, apply_arg.sample_size);
         }
 
+        // the values inserted into the node, not in its children, are in its subtree_size
+        void visit_node_and_buffer(leaf_node_type & node, entry_t const& entry) {
+            assert(apply_arg.sample_size > 0);
+            size_t sample_size = apply_arg.sample_size;
+            size_t samples_from_buffer = next_sample_size(sample_size, node.buffer.size(), entry.subtree_size, rng);
+            if(samples_from_buffer > 0)
+                sample_from_values(node.buffer.begin(), node.buffer.end(), samples_from_buffer);
+            if(sample_size > samples_from_buffer)
+                sample_from_entries(node.children.begin(), node.children.end(),
+                    entry.subtree_size - node.buffer.size(), sample_size - samples_from_buffer);
+        }
+
         // transfer information for apply
         struct {
             size_t sample_size; 
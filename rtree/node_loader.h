@@ -49,20 +49,30 @@ struct node_loader
         , load_all(load_all)
         , memory_limit(memory_limit)
     { 
+        // the layers are read in full, undo the RANDOM of the sample queries
+        // (see sample_query_cursor) for as long as they are loaded
+        block_manager.advise(AccessAdvice::SEQUENTIAL);
         cur_layer.push_back(&root_entry);
 
         while(!cur_layer.empty() && (load_all || this->memory_limit > 0))
         {
+            // the kernel reads the layer ahead, the buffer pool is not filled with it
+            advise_layer(AccessAdvice::WILLNEED);
             std::random_shuffle(cur_layer.begin(), cur_layer.end());
             for(auto * p : cur_layer)
             {
                 if(load_all || this->memory_limit > 0)
                 {
-                    p->apply_visitor(*this);
+                    p->apply_static(*this);
                 }
                 else
                     break;
             }
+            // the loaded nodes are not read from the blocks anymore,
+            // neither from the page cache nor from the buffer pool
+            block_manager.advise(std::move(loaded_extents), AccessAdvice::DONTNEED);
+            loaded_extents.clear();
+
             if(load_all || this->memory_limit > 0)
             {
                 std::swap(cur_layer, next_layer);
@@ -71,6 +81,7 @@ struct node_loader
             else
                 break;
         }
+        block_manager.advise(AccessAdvice::NORMAL);
     }
 
     void apply (internal_node_type & node, entry_t & entry) {
@@ -95,6 +106,7 @@ struct node_loader
         if(check_size(node_size))
         {
             add_children(node, entry);
+            loaded_extents.emplace_back(entry.bid, 2);
             node.mem_resident = true;
             entry.type = entry_t::LOADED_IO_INTERNAL_TYPE;
             entry.node_ptr = &node;
@@ -109,6 +121,7 @@ struct node_loader
 
         if(check_size(node_size))
         {
+            loaded_extents.emplace_back(entry.bid, 1);
             node.mem_resident = true;
             entry.type = entry_t::LOADED_IO_LEAF_TYPE;
             entry.node_ptr = &node;
@@ -136,11 +149,26 @@ struct node_loader
             next_layer.push_back(&child_entry);
     }
 
+    // the blocks of the IO nodes in the current layer
+    void advise_layer(AccessAdvice advice) {
+        std::vector<std::pair<bid_t, size_t>> extents;
+        for(auto * p : cur_layer)
+        {
+            if(p->type == entry_t::IO_INTERNAL_TYPE)
+                extents.emplace_back(p->bid, 2);
+            else if(p->type == entry_t::IO_LEAF_TYPE)
+                extents.emplace_back(p->bid, 1);
+        }
+        block_manager.advise_storage(std::move(extents), advice);
+    }
+
     Stats stats;
     bool load_all;
     size_t memory_limit;
 
     std::vector<entry_t*> cur_layer, next_layer;
+    // (bid, count) of the IO nodes loaded from the current layer
+    std::vector<std::pair<bid_t, size_t>> loaded_extents;
 };
 
 } // namespace rtree 
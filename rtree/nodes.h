@@ -62,8 +62,12 @@ struct node_entry
 {
     using node_type = node TARGS;
     using visitor_type = typename node_type::visitor_type;
+    using aggregate_t = subtree_aggregate<aggregate_fields<Value>::count>;
 
     char type;
+    // the aggregates of the values of the subtree, see subtree_aggregate
+    // (kept next to `type`, an empty one fits in the padding after it)
+    aggregate_t aggregate;
 
     static constexpr 
     char INTERNAL_TYPE = 0;
@@ -103,6 +107,12 @@ struct node_entry
 
     void apply_visitor(visitor_type & visitor);
 
+    // same as apply_visitor, but the node type is found from `type` and
+    // Visitor::apply is called directly, so it can be inlined
+    // Visitor must be the most derived type of the visitor
+    template <typename Visitor>
+    void apply_static(Visitor & visitor);
+
     void dump_to(std::ostream & out) const;
     void load_from(std::istream & in);
 
@@ -112,7 +122,8 @@ struct node_entry
         serializer<size_t>::size +
         serializer<Box>::size +
         serializer<bid_t>::size +
-        serializer<Key>::size;
+        serializer<Key>::size +
+        serializer<aggregate_t>::size;
 };
 
 } // namespace rtree
@@ -123,6 +134,18 @@ struct has_dump_load_method<rtree::node_entry TARGS>
     static constexpr bool value = true;
 };
 
+// the layout of node_entry::dump_to
+TDECL
+struct fixed_layout<rtree::node_entry TARGS>
+    : fixed_fields<rtree::node_entry TARGS,
+        FIXED_FIELD(rtree::node_entry TARGS, type),
+        FIXED_FIELD(rtree::node_entry TARGS, subtree_size),
+        FIXED_FIELD(rtree::node_entry TARGS, bbox),
+        FIXED_FIELD(rtree::node_entry TARGS, bid),
+        FIXED_FIELD(rtree::node_entry TARGS, min_key),
+        FIXED_FIELD(rtree::node_entry TARGS, aggregate)>
+{ };
+
 
 namespace rtree {
 
@@ -172,6 +195,10 @@ struct node
     virtual ~node() {}
     virtual void apply_visitor(visitor_type &, entry_t &) = 0;
 
+    // from the HugePageArena when it is enabled
+    static void * operator new(size_t size) { return arena_allocate(size); }
+    static void operator delete(void * p, size_t size) { arena_deallocate(p, size); }
+
     /*
      * mostly used for io nodes
      * doesn't do much things for mem nodes
@@ -202,8 +229,22 @@ struct internal_node
     // Build everything in entry
     void build_entry(entry_t & entry) const;
 
-    std::vector<SampleValue> samples;
-    std::vector<entry_t> children;
+    // which children have a box intersecting / covered by `query`
+    // the boxes are tested all at once against a packed copy for a Box query
+    void test_children(Box const& query, child_box_masks & masks) const { child_boxes.test(children, query, masks); }
+
+    template <typename Geometry>
+    void test_children(Geometry const& query, child_box_masks & masks) const { child_box_cache::test_each(children, query, masks); }
+
+    // to call before changing the children or their boxes
+    void invalidate_child_boxes(void) { child_boxes.invalidate(); }
+
+    // in the sample slab of the rtree for the mem nodes, see sample_slab
+    sample_array<SampleValue> samples;
+    node_vector<entry_t> children;
+
+private:
+    child_box_cache child_boxes;
 };
 
 /*
@@ -252,7 +293,7 @@ struct leaf_node
     using base_t::samples;
     using base_t::children;
 
-    using value_list_t = std::vector<Value>;
+    using value_list_t = node_vector<Value>;
     value_list_t buffer;
 };
 
@@ -276,7 +317,11 @@ struct io_internal_node
     using entry_t = typename base_t::entry_t;
 
     virtual void apply_visitor (visitor_type & v, entry_t & e) { v.apply(*this, e); }
-    virtual void free_from_entry(void) { if(!mem_resident) delete this; }
+    // the node goes back to the pool of the thread
+    virtual void free_from_entry(void) { if(!mem_resident) io_node_pool<io_internal_node>::release(this); }
+
+    // empty the node for io_node_pool, the containers keep their memory
+    void clear(void);
 
     static size_t
     capacity(size_t block_size) { 
@@ -313,11 +358,9 @@ struct io_internal_node
 
     using base_t::buffer_offset;
 
-private:
     static bid_t sample_bid (entry_t const& entry) { return entry.bid; }
     static bid_t children_and_buffer_bid (entry_t const& entry) { return entry.bid + 1; }
 
-public:
     bool mem_resident = false;
 };
 
@@ -335,16 +378,29 @@ struct io_leaf_node
     using entry_t = typename base_t::entry_t;
 
     virtual void apply_visitor (visitor_type & v, entry_t & e) { v.apply(*this, e); }
-    virtual void free_from_entry(void) { if(!mem_resident) delete this; }
+    // the node goes back to the pool of the thread
+    virtual void free_from_entry(void) { if(!mem_resident) io_node_pool<io_leaf_node>::release(this); }
 
+    // empty the node for io_node_pool, the containers keep their memory
+    void clear(void) {
+        values.clear();
+        mem_resident = false;
+    }
+
+    // the number of values in a block when they are not compressed
         static size_t 
     capacity(size_t block_size) {
         return block_size / serializer<Value>::size;
     }
 
+    // whether the values [first, last) fit in one block
+    template <typename Iterator>
+        static bool
+    fits(Iterator first, Iterator last, BlockManager const& block_manager);
+
         bool
-    overflow(size_t block_size) const {
-        return values.size() > capacity(block_size);
+    overflow(BlockManager const& block_manager) const {
+        return !fits(values.begin(), values.end(), block_manager);
     }
 
     // Build everything in entry
@@ -357,8 +413,20 @@ struct io_leaf_node
     void save_to_blocks(entry_t const& entry, BlockManager & block_manager) const;
     void load_from_blocks(entry_t const& entry, BlockManager & block_manager);
 
+    // the values covered by `query` go to `out`, returns how many
+    // when the leaf is in columns and not loaded, a box query only reads those values from the block
+    template <typename Geometry, typename OutputIterator>
+    size_t load_covered_from_blocks(entry_t const& entry, BlockManager & block_manager, Geometry const& query, OutputIterator & out);
+
     bool mem_resident = false;
-    std::vector<Value> values;
+    node_vector<Value> values;
+
+private:
+    // false if the query is not a box
+    template <typename OutputIterator>
+    bool select_from_columns(entry_t const& entry, BlockManager & block_manager, Box const& query, OutputIterator & out, size_t & selected);
+    template <typename Geometry, typename OutputIterator>
+    bool select_from_columns(entry_t const&, BlockManager &, Geometry const&, OutputIterator &, size_t &) { return false; }
 };
 
 
@@ -35,6 +35,44 @@ namespace rtree {
         node->free_from_entry();
     }
 
+    TDECL
+    template <typename Visitor>
+        void
+        node_entry TARGS
+        ::apply_static(Visitor & visitor)
+    {
+        switch(type)
+        {
+            case INTERNAL_TYPE:
+                visitor.Visitor::apply(static_cast<internal_node TARGS &>(*node_ptr), *this);
+                return;
+            case LEAF_TYPE:
+                visitor.Visitor::apply(static_cast<leaf_node TARGS &>(*node_ptr), *this);
+                return;
+            case LOADED_IO_INTERNAL_TYPE:
+                visitor.Visitor::apply(static_cast<io_internal_node TARGS &>(*node_ptr), *this);
+                return;
+            case LOADED_IO_LEAF_TYPE:
+                visitor.Visitor::apply(static_cast<io_leaf_node TARGS &>(*node_ptr), *this);
+                return;
+            case IO_INTERNAL_TYPE:
+            {
+                auto * node = static_cast<io_internal_node TARGS *>(node_type::create(*this));
+                visitor.Visitor::apply(*node, *this);
+                node->io_internal_node TARGS::free_from_entry();
+                return;
+            }
+            case IO_LEAF_TYPE:
+            {
+                auto * node = static_cast<io_leaf_node TARGS *>(node_type::create(*this));
+                visitor.Visitor::apply(*node, *this);
+                node->io_leaf_node TARGS::free_from_entry();
+                return;
+            }
+        }
+        assert(false);
+    }
+
     // need to be consistent with serialization_size
     TDECL
         void
@@ -51,6 +89,7 @@ namespace rtree {
         dump_value(out, bbox);
         dump_value(out, bid);
         dump_value(out, min_key);
+        dump_value(out, aggregate);
     }
 
     // need to be consistent with serialization_size
@@ -65,6 +104,7 @@ namespace rtree {
         load_value(in, bbox);
         load_value(in, bid);
         load_value(in, min_key);
+        load_value(in, aggregate);
     }
     
     TDECL
@@ -77,12 +117,12 @@ namespace rtree {
 
         if (entry.type == entry_t::IO_INTERNAL_TYPE)
         {
-            return new io_internal_node TARGS();
+            return io_node_pool<io_internal_node TARGS>::acquire();
         }
 
         if (entry.type == entry_t::IO_LEAF_TYPE)
         {
-            return new io_leaf_node TARGS();
+            return io_node_pool<io_leaf_node TARGS>::acquire();
         }
 
         assert(false);
@@ -117,11 +157,13 @@ namespace rtree {
             entry.min_key = children.front().min_key;
         // go through the children
         entry.subtree_size = 0;
+        entry.aggregate.clear();
         bg::assign_inverse(entry.bbox);
         for (auto const& child : children)
         {
             bg::expand(entry.bbox, child.bbox);
             entry.subtree_size += child.subtree_size;
+            entry.aggregate.add(child.aggregate);
         }
     }
 
@@ -136,7 +178,10 @@ namespace rtree {
         // check buffer
         entry.subtree_size += buffer.size();
         for (auto const& v : buffer)
+        {
             bg::expand(entry.bbox, v.get_point());
+            entry.aggregate.add_value(v);
+        }
     }
 
     TDECL
@@ -148,6 +193,18 @@ namespace rtree {
         entry.type = entry_t::IO_INTERNAL_TYPE;
     }
 
+    TDECL
+        void
+        io_internal_node TARGS
+        ::clear(void)
+    {
+        samples.clear();
+        children.clear();
+        buffer.clear();
+        this->invalidate_child_boxes();
+        mem_resident = false;
+    }
+
     TDECL
         void
         io_internal_node TARGS
@@ -163,7 +220,7 @@ namespace rtree {
         io_internal_node TARGS
         ::free_blocks(entry_t const& entry, BlockManager & block_manager)
     {
-        block_manager.free_blocks(entry.bid, 3);
+        block_manager.free_blocks(entry.bid, 2);
     }
 
     TDECL
@@ -181,10 +238,8 @@ namespace rtree {
         ::save_children_and_buffer_to_blocks(entry_t const& entry, BlockManager & block_manager) const
     {
         auto block = block_manager.get_block(children_and_buffer_bid(entry), Block::WRITE);
-        auto & stream = block->get_stream();
-        dump_array(stream, children);
-        stream.seekp(buffer_offset());
-        dump_array(stream, buffer);
+        dump_array_to_block(*block, 0, children);
+        dump_array_to_block(*block, buffer_offset(), buffer);
     }
 
     TDECL
@@ -193,11 +248,10 @@ namespace rtree {
         ::load_children_and_buffer_from_blocks(entry_t const& entry, BlockManager & block_manager)
     {
         if(mem_resident) return;
-        auto block = block_manager.get_block(children_and_buffer_bid(entry), Block::READ);
-        auto & stream = block->get_stream();
-        load_array(stream, children);
-        stream.seekg(buffer_offset());
-        load_array(stream, buffer);
+        BlockView view(block_manager, children_and_buffer_bid(entry));
+        this->invalidate_child_boxes();
+        load_array_from_block(view, 0, children);
+        load_array_from_block(view, buffer_offset(), buffer);
     }
 
     TDECL
@@ -206,8 +260,7 @@ namespace rtree {
         ::save_samples_to_blocks(entry_t const& entry, BlockManager & block_manager) const
     {
         auto block = block_manager.get_block(sample_bid(entry), Block::WRITE);
-        auto & stream = block->get_stream();
-        dump_array(stream, samples);
+        dump_array_to_block(*block, 0, samples);
     }
 
     TDECL
@@ -216,9 +269,8 @@ namespace rtree {
         ::load_samples_from_blocks(entry_t const& entry, BlockManager & block_manager)
     {
         if(mem_resident) return;
-        auto block = block_manager.get_block(sample_bid(entry), Block::READ);
-        auto & stream = block->get_stream();
-        load_array(stream, samples);
+        BlockView view(block_manager, sample_bid(entry));
+        load_array_from_block(view, 0, samples);
     }
 
     TDECL
@@ -230,9 +282,13 @@ namespace rtree {
         entry.subtree_size = values.size();
 
         // go through the values
+        entry.aggregate.clear();
         bg::assign_inverse(entry.bbox);
         for (auto const& v : values)
+        {
             bg::expand(entry.bbox, v.get_point());
+            entry.aggregate.add_value(v);
+        }
     }
 
     TDECL
@@ -251,17 +307,33 @@ namespace rtree {
         block_manager.free_blocks(entry.bid, 1);
     }
 
+    TDECL
+    template <typename Iterator>
+        bool
+        io_leaf_node TARGS
+        ::fits(Iterator first, Iterator last, BlockManager const& block_manager)
+    {
+        if(block_manager.get_columnar_leaves())
+            return (size_t)std::distance(first, last) * leaf_column_io<Value>::row_size() <= block_manager.get_block_size();
+        if(!block_manager.get_compress_leaves())
+            return (size_t)std::distance(first, last) <= capacity(block_manager.get_block_size());
+        return encoded_size(first, last) <= block_manager.get_block_size();
+    }
+
     TDECL
         void
         io_leaf_node TARGS
         ::save_to_blocks(entry_t const& entry, BlockManager & block_manager) const
     {
         auto block = block_manager.get_block(entry.bid, Block::WRITE);
-        auto & stream = block->get_stream();
         // no need to dump size
         // the value is saved in the entry
-        for (auto const& v : values)
-            dump_value(stream, v);
+        if(block_manager.get_compress_leaves())
+            encode_values(block->get_stream(), values.begin(), values.end());
+        else if(block_manager.get_columnar_leaves())
+            leaf_column_io<Value>::store(values.data(), values.size(), block->data);
+        else
+            dump_values_to_block(*block, values);
     }
 
     TDECL
@@ -270,11 +342,49 @@ namespace rtree {
         ::load_from_blocks(entry_t const& entry, BlockManager & block_manager)
     {
         if(mem_resident) return;
-        auto block = block_manager.get_block(entry.bid, Block::READ);
-        auto & stream = block->get_stream();
+        BlockView view(block_manager, entry.bid);
         values.resize(entry.subtree_size);
-        for (auto & v : values)
-            load_value(stream, v);
+        if(block_manager.get_compress_leaves())
+            decode_values(view.get_stream(), values);
+        else if(block_manager.get_columnar_leaves())
+            leaf_column_io<Value>::load(view.get_data(), values.size(), values.data());
+        else
+            load_values_from_block(view, values);
+    }
+
+    TDECL
+    template <typename Geometry, typename OutputIterator>
+        size_t
+        io_leaf_node TARGS
+        ::load_covered_from_blocks(entry_t const& entry, BlockManager & block_manager, Geometry const& query, OutputIterator & out)
+    {
+        size_t selected = 0;
+        if(!mem_resident && block_manager.get_columnar_leaves()
+                && select_from_columns(entry, block_manager, query, out, selected))
+            return selected;
+
+        load_from_blocks(entry, block_manager);
+        for(auto const& v : values)
+        {
+            if(bg::covered_by(v.get_point(), query))
+            {
+                *out = v;
+                ++out;
+                ++selected;
+            }
+        }
+        return selected;
+    }
+
+    TDECL
+    template <typename OutputIterator>
+        bool
+        io_leaf_node TARGS
+        ::select_from_columns(entry_t const& entry, BlockManager & block_manager, Box const& query, OutputIterator & out, size_t & selected)
+    {
+        BlockView view(block_manager, entry.bid);
+        selected = leaf_column_io<Value>::select(view.get_data(), entry.subtree_size, query, out);
+        return true;
     }
 } // namespace rtree
 
@@ -0,0 +1,125 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * the aggregates of the values in a query range, see subtree_aggregate
+ *
+ * like range_reporter, but a child covered by the query adds the aggregate
+ * of its entry instead of being visited, and the values in range are added
+ * instead of being reported. the buffers of the nodes on the border are
+ * counted as well, so the result is the same as aggregating every value in range
+ */
+#pragma once
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+template<
+    typename Geometry, 
+    typename Box, typename Key, typename Value, typename SampleValue
+    >
+struct range_aggregator
+    : visitor TARGS
+{
+    using base_t = visitor<Box, Key, Value, SampleValue>;
+    using node_type = typename base_t::node_type;
+    using internal_node_type = typename base_t::internal_node_type;
+    using leaf_node_type = typename base_t::leaf_node_type;
+    using io_internal_node_type = typename base_t::io_internal_node_type;
+    using io_leaf_node_type = typename base_t::io_leaf_node_type;
+    using entry_t = typename base_t::entry_t;
+    using base_t::block_manager;
+
+    using result_type = range_aggregate<aggregate_fields<Value>::count>;
+
+    range_aggregator(Geometry const& query, BlockManager & block_manager)
+        : base_t(block_manager)
+        , query(query)
+    { }
+
+    void apply (internal_node_type & node, entry_t & entry) {
+        visit_node(node, entry);
+        ++stats.internal_nodes;
+    }
+    void apply (leaf_node_type & node, entry_t & entry) {
+        visit_node(node, entry);
+        add_values(node.buffer);
+        ++stats.leaf_nodes;
+    }
+    void apply (io_internal_node_type & node, entry_t & entry) {
+        node.load_children_and_buffer_from_blocks(entry, block_manager);
+        visit_node(node, entry);
+        add_values(node.buffer);
+        ++stats.io_internal_nodes;
+    }
+
+    void apply (io_leaf_node_type & node, entry_t & entry) {
+        adding_iterator out{result};
+        node.load_covered_from_blocks(entry, block_manager, query, out);
+        ++stats.io_leaf_nodes;
+    }
+
+    template <typename NodeType>
+    void visit_node(NodeType & node, entry_t const& /* entry */) {
+        child_box_masks masks;
+        node.test_children(query, masks);
+        for(size_t i = 0; i < node.children.size(); ++i)
+        {
+            auto & child_entry = node.children[i];
+            if(masks.covered(i))
+                result.add(child_entry.aggregate, child_entry.subtree_size);
+            else if(masks.intersects(i))
+                child_entry.apply_static(*this);
+        }
+    }
+
+    template <typename Values>
+    void add_values(Values const& values) {
+        for(auto const& v : values)
+        {
+            if(bg::covered_by(v.get_point(), query))
+                result.add_value(v);
+        }
+    }
+
+    // the values written go to the result
+    struct adding_iterator {
+        result_type & result;
+
+        adding_iterator & operator * (void) { return *this; }
+        adding_iterator & operator ++ (void) { return *this; }
+        adding_iterator & operator = (Value const& v) {
+            result.add_value(v);
+            return *this;
+        }
+    };
+
+    Geometry const query;
+    result_type result;
+    Stats stats;
+};
+
+} // namespace rtree 
+
+#undef TDECL
+#undef TARGS
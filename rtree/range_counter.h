@@ -0,0 +1,315 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * the number of values in a query range, without reporting them
+ *
+ * a subtree covered by the query counts as its subtree_size, only the nodes
+ * on the border of the query are opened. a node on the border is estimated
+ * from its samples until it is opened (or as half of its subtree when they
+ * are on the disk), so counting can stop at any point with an estimate and
+ * its standard deviation. the border nodes with the largest variance are opened first
+ */
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#define TDECL template <typename Box, typename Key, typename Value, typename SampleValue>
+#define TARGS <Box, Key, Value, SampleValue>
+
+namespace rtree {
+
+// how far rtree::count opens the border of the query
+struct CountMode
+{
+    enum Kind {
+        EXACT,          // down to the leaves
+        BOUNDED_ERROR,  // until the standard deviation is at most `error` times the count
+        IO_BUDGET,      // as far as `io_budget` block reads allow
+    };
+
+    Kind kind;
+    double error;
+    size_t io_budget;
+
+    static CountMode exact(void) { return CountMode{EXACT, 0.0, 0}; }
+    static CountMode bounded_error(double error) { return CountMode{BOUNDED_ERROR, error, 0}; }
+    static CountMode with_io_budget(size_t blocks) { return CountMode{IO_BUDGET, 0.0, blocks}; }
+};
+
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+struct range_counter
+{
+    using node_type = node TARGS;
+    using internal_node_type = internal_node TARGS;
+    using leaf_node_type = leaf_node TARGS;
+    using io_internal_node_type = io_internal_node TARGS;
+    using io_leaf_node_type = io_leaf_node TARGS;
+    using entry_t = typename node_type::entry_t;
+
+    range_counter(Geometry const& query, BlockManager & block_manager, CountMode mode)
+        : query(query)
+        , block_manager(block_manager)
+        , mode(mode)
+    { }
+
+    void run(entry_t const& root_entry)
+    {
+        if(bg::covered_by(root_entry.bbox, query))
+            exact += root_entry.subtree_size;
+        else if(bg::intersects(root_entry.bbox, query))
+            add_border(root_entry);
+
+        // the border nodes that are left for lack of I/O budget
+        std::vector<border_entry> left;
+        while(!border.empty() && !precise_enough())
+        {
+            std::pop_heap(border.begin(), border.end());
+            border_entry b = border.back();
+            border.pop_back();
+
+            if(mode.kind == CountMode::IO_BUDGET && io_cost + blocks_to_open(b) > mode.io_budget)
+            {
+                left.push_back(b);
+                continue;
+            }
+            estimate -= b.estimate;
+            variance -= b.variance;
+            open(b);
+        }
+
+        // sum again what is still estimated, without the rounding errors of the updates
+        border.insert(border.end(), left.begin(), left.end());
+        estimate = 0.0;
+        variance = 0.0;
+        for(auto const& b : border)
+        {
+            estimate += b.estimate;
+            variance += b.variance;
+        }
+    }
+
+    size_t get_count(void) const { return exact + (size_t)std::llround(estimate); }
+    // 0 when the count is exact
+    double get_sd(void) const { return std::sqrt(variance); }
+
+    Stats get_stats(void) const { return stats; }
+    // the blocks read
+    size_t get_io_cost(void) const { return io_cost; }
+
+private:
+    // a node on the border of the query, and what it is estimated to hold
+    struct border_entry {
+        entry_t entry;
+        double estimate;
+        double variance;
+        // the samples of an io internal node were read
+        bool sampled;
+
+        bool operator < (border_entry const& b) const { return variance < b.variance; }
+    };
+
+    bool precise_enough(void) const {
+        if(mode.kind != CountMode::BOUNDED_ERROR)
+            return false;
+        double bound = mode.error * (exact + estimate);
+        return variance <= bound * bound;
+    }
+
+    static size_t blocks_to_open(border_entry const& b) {
+        return b.entry.type == entry_t::IO_INTERNAL_TYPE || b.entry.type == entry_t::IO_LEAF_TYPE ? 1 : 0;
+    }
+
+    // a child intersected but not covered by the query
+    void add_border(entry_t const& entry)
+    {
+        border_entry b{entry, 0.0, 0.0, false};
+        switch(entry.type)
+        {
+            case entry_t::LOADED_IO_LEAF_TYPE:
+            {
+                // everything is in memory already
+                auto const& node = static_cast<io_leaf_node_type const&>(*entry.node_ptr);
+                for(auto const& v : node.values)
+                {
+                    if(bg::covered_by(v.get_point(), query))
+                        ++exact;
+                }
+                ++stats.leaf_nodes;
+                return;
+            }
+            case entry_t::INTERNAL_TYPE:
+            case entry_t::LEAF_TYPE:
+            case entry_t::LOADED_IO_INTERNAL_TYPE:
+                // the order doesn't matter to an exact count, don't bother with the samples
+                if(mode.kind != CountMode::EXACT)
+                    estimate_from_samples(static_cast<internal_node_type const&>(*entry.node_ptr), b);
+                break;
+            default:
+                // the samples are on the disk
+                b.estimate = entry.subtree_size / 2.0;
+                b.variance = b.estimate * b.estimate;
+                break;
+        }
+        push_border(b);
+    }
+
+    void push_border(border_entry const& b)
+    {
+        estimate += b.estimate;
+        variance += b.variance;
+        border.push_back(b);
+        std::push_heap(border.begin(), border.end());
+    }
+
+    // the samples in the query range are as many as the values in it, proportionally
+    // the variance is the largest one of the proportion, p (1 - p) <= 1/4
+    template <typename Node>
+    void estimate_from_samples(Node const& node, border_entry & b)
+    {
+        double ss = b.entry.subtree_size;
+        if(node.samples.empty())
+        {
+            b.estimate = ss / 2.0;
+            b.variance = b.estimate * b.estimate;
+            return;
+        }
+        size_t c = 0;
+        for(auto const& s : node.samples)
+        {
+            if(bg::covered_by(s.get_point(), query))
+                ++c;
+        }
+        b.estimate = ss * c / node.samples.size();
+        b.variance = ss * ss / (4.0 * node.samples.size());
+    }
+
+    void open(border_entry & b)
+    {
+        entry_t const& entry = b.entry;
+        switch(entry.type)
+        {
+            case entry_t::INTERNAL_TYPE:
+                open_node(static_cast<internal_node_type const&>(*entry.node_ptr));
+                ++stats.internal_nodes;
+                return;
+            case entry_t::LOADED_IO_INTERNAL_TYPE:
+                open_node(static_cast<leaf_node_type const&>(*entry.node_ptr));
+                count_buffer(static_cast<leaf_node_type const&>(*entry.node_ptr));
+                ++stats.internal_nodes;
+                return;
+            case entry_t::LEAF_TYPE:
+                open_node(static_cast<leaf_node_type const&>(*entry.node_ptr));
+                count_buffer(static_cast<leaf_node_type const&>(*entry.node_ptr));
+                ++stats.leaf_nodes;
+                return;
+            case entry_t::IO_INTERNAL_TYPE:
+            {
+                auto * node = static_cast<io_internal_node_type *>(node_type::create(entry));
+                ++io_cost;
+                if(mode.kind != CountMode::EXACT && !b.sampled)
+                {
+                    // the samples first, the children may not be needed
+                    node->load_samples_from_blocks(entry, block_manager);
+                    estimate_from_samples(*node, b);
+                    b.sampled = true;
+                    push_border(b);
+                    ++stats.io_sample_nodes;
+                }
+                else
+                {
+                    node->load_children_and_buffer_from_blocks(entry, block_manager);
+                    open_node(*node);
+                    count_buffer(*node);
+                    ++stats.io_internal_nodes;
+                }
+                node->io_internal_node_type::free_from_entry();
+                return;
+            }
+            case entry_t::IO_LEAF_TYPE:
+            {
+                auto * node = static_cast<io_leaf_node_type *>(node_type::create(entry));
+                ++io_cost;
+                discarding_iterator out;
+                exact += node->load_covered_from_blocks(entry, block_manager, query, out);
+                ++stats.io_leaf_nodes;
+                node->io_leaf_node_type::free_from_entry();
+                return;
+            }
+        }
+        assert(false);
+    }
+
+    template <typename Node>
+    void open_node(Node const& node)
+    {
+        child_box_masks masks;
+        node.test_children(query, masks);
+        for(size_t i = 0; i < node.children.size(); ++i)
+        {
+            auto const& child_entry = node.children[i];
+            if(masks.covered(i))
+                exact += child_entry.subtree_size;
+            else if(masks.intersects(i))
+                add_border(child_entry);
+        }
+    }
+
+    // the values inserted into a node on the border and not pushed down yet,
+    // they are in its subtree_size but in none of its children
+    void count_buffer(leaf_node_type const& node)
+    {
+        for(auto const& v : node.buffer)
+        {
+            if(bg::covered_by(v.get_point(), query))
+                ++exact;
+        }
+    }
+
+    // only the number of values written matters
+    struct discarding_iterator {
+        discarding_iterator & operator * (void) { return *this; }
+        discarding_iterator & operator ++ (void) { return *this; }
+        template <typename T>
+        discarding_iterator & operator = (T const&) { return *this; }
+    };
+
+    Geometry const query;
+    BlockManager & block_manager;
+    CountMode const mode;
+
+    // the values counted exactly, and the estimation of the border
+    size_t exact = 0;
+    double estimate = 0.0;
+    double variance = 0.0;
+    // a heap on the variance
+    std::vector<border_entry> border;
+
+    Stats stats;
+    size_t io_cost = 0;
+};
+
+} // namespace rtree
+
+#undef TDECL
+#undef TARGS
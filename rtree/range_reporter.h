@@ -47,7 +47,15 @@ struct range_reporter
         : query(query)
         , base_t(block_manager)
         , out_iter(out_iter)
-    { }
+    {
+        // the subtrees in the range are read through, the readahead turned off
+        // by the sample queries (see sample_query_cursor) is back until we are done
+        block_manager.advise(AccessAdvice::SEQUENTIAL);
+    }
+
+    ~range_reporter() {
+        block_manager.advise(AccessAdvice::NORMAL);
+    }
 
     void apply (internal_node_type & node, entry_t & entry) {
         visit_node(node, entry);
@@ -64,25 +72,36 @@ struct range_reporter
     }
 
     void apply (io_leaf_node_type & node, entry_t & entry) {
-        node.load_from_blocks(entry, block_manager);
-        for(auto const& v : node.values)
-        {
-            if(bg::covered_by(v.get_point(), query)) 
-            {
-                *out_iter = v;
-                ++ out_iter;
-            }
-        }
+        node.load_covered_from_blocks(entry, block_manager, query, out_iter);
         ++stats.io_leaf_nodes;
     }
 
     template <typename NodeType>
     void visit_node(NodeType & node, entry_t const& entry) {
-        for(auto & child_entry : node.children) 
+        // the blocks of the children to descend into are asked for at once,
+        // so they are read ahead while the first ones are processed
+        child_box_masks masks;
+        node.test_children(query, masks);
+
+        std::vector<std::pair<bid_t, size_t>> extents;
+        for(size_t i = 0; i < node.children.size(); ++i)
+        {
+            if (!masks.intersects(i))
+                continue;
+            auto const& child_entry = node.children[i];
+            if (child_entry.type == entry_t::IO_LEAF_TYPE)
+                extents.emplace_back(child_entry.bid, 1);
+            else if (child_entry.type == entry_t::IO_INTERNAL_TYPE)
+                extents.emplace_back(io_internal_node_type::children_and_buffer_bid(child_entry), 1);
+        }
+        if (extents.size() > 1)
+            block_manager.advise(std::move(extents), AccessAdvice::WILLNEED);
+
+        for(size_t i = 0; i < node.children.size(); ++i)
         {
-            if (bg::intersects(child_entry.bbox, query))
+            if (masks.intersects(i))
             {
-                child_entry.apply_visitor(*this);
+                node.children[i].apply_static(*this);
             }
         }
     }
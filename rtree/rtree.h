@@ -35,6 +35,13 @@ SOFTWARE.
 #include <algorithm>
 #include <random>
 #include <ctime>
+#include <stdexcept>
+#include <exception>
+#include <functional>
+#include <unordered_set>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <boost/geometry/geometry.hpp>
 #include <boost/mpl/integral_c.hpp>
@@ -46,6 +53,8 @@ SOFTWARE.
 
 #include "hilbert/hilbert.h"
 #include "serialization/serializer.h"
+#include "serialization/leaf_codec.h"
+#include "serialization/leaf_columns.h"
 
 #include "util.h"
 
@@ -64,6 +73,8 @@ struct Stats {
     size_t io_internal_nodes = 0;
     size_t io_leaf_nodes = 0;
     size_t io_sample_nodes = 0;
+    // allocations of node objects and node containers, see node_allocations()
+    size_t node_allocations = 0;
 
     Stats& operator += (Stats const& stats) {
         internal_nodes += stats.internal_nodes;
@@ -71,6 +82,12 @@ struct Stats {
         io_internal_nodes += stats.io_internal_nodes;
         io_leaf_nodes += stats.io_leaf_nodes;
         io_sample_nodes += stats.io_sample_nodes;
+        node_allocations += stats.node_allocations;
+#ifdef RSTREE_PROFILING
+        values_reported += stats.values_reported;
+        values_rejected += stats.values_rejected;
+        leaf_values_scanned += stats.leaf_values_scanned;
+#endif //RSTREE_PROFILING
         return *this;
     }
 
@@ -88,6 +105,12 @@ struct Stats {
  * these are internal files for the rtree implementation
  * do not use them out of this file
  */
+#include "huge_page_arena.h"
+#include "sample_slab.h"
+#include "io_node_pool.h"
+#include "column_filter.h"
+#include "child_boxes.h"
+#include "subtree_aggregate.h"
 #include "nodes.h"
 #include "block_manager.h"
 #include "io_layers.h"
@@ -95,13 +118,19 @@ struct Stats {
 #include "sample_builder.h"
 #include "naive_sample_query.h"
 #include "sample_query.h"
+#include "multi_sample_query.h"
 #include "range_reporter.h"
+#include "range_counter.h"
+#include "range_aggregator.h"
 #include "node_loader.h"
 #include "mem_node_cleaner.h"
+#include "mem_node_snapshot.h"
 #include "mem_node_saver.h"
 #include "inserter.h"
 #include "eraser.h"
 #include "finder.h"
+#include "frozen_tree.h"
+#include "frozen_query.h"
 
 namespace rtree {
     /*
@@ -148,16 +177,23 @@ namespace rtree {
         using visitor_type = typename node TARGS::visitor_type;
 
         using io_layers_type = IOLayers < Box, HilbertValueComputer, Value, SampleValue > ;
+        using frozen_tree_type = frozen_tree TARGS;
 
         rtree(std::string const& filename, 
-              bool in_memory = false, // if in_memory is true, block_cache is set to unlimited
+              bool in_memory = false, // if in_memory is true, the nodes are loaded and the buffer pool is dropped
               bool load_mem_nodes = false,
               size_t memory_limit = 0, 
               std::shared_ptr<HilbertValueComputer> hvc = nullptr
         );
         ~rtree();
+        // filename + ".memnodes", as a snapshot that is mapped when loaded
         void save_mem_nodes(void);
 
+        // whether the memnodes of `filename` are in a format older than the snapshot
+        static bool mem_nodes_outdated(std::string const& filename) {
+            return mem_node_saver<Box, hilbert_value_type, Value, SampleValue>::is_outdated(filename + ".memnodes");
+        }
+
         template<bool UPDATE_SAMPLE=true>
         void insert(Value const& value);
 
@@ -199,6 +235,13 @@ namespace rtree {
             get_block_manager().flush_cache();
         }
 
+        /*
+         * Rewrite the data file so that every IO subtree is stored contiguously
+         * (see IOLayers::relayout), the IO subtrees under the mem leaves become the new top layer.
+         * the IO nodes must not be loaded (in_memory/memory_limit) and no cursor may be alive
+         */
+        void relayout(void);
+
         /*
          * Get samples without using the samples associated to the nodes
          * The baseline algorithm
@@ -220,6 +263,28 @@ namespace rtree {
             return sample_query_cursor<Geometry, Box, hilbert_value_type, Value, SampleValue> (query, root_node_entry, get_block_manager(), rng_dev);
         }
 
+        /*
+         * Get samples for a batch of queries, in one traversal
+         * every cursor starts with `sample_sizes[i]` samples of `queries[i]` in its buffer
+         * `io_cost_ptr` is to optionally receive the I/O cost of the whole batch
+         */
+        template<typename Geometry>
+        std::vector<sample_query_cursor<Geometry, Box, hilbert_value_type, Value, SampleValue>>
+        multi_sample_query(std::vector<Geometry> const& queries, std::vector<size_t> const& sample_sizes, size_t * io_cost_ptr = nullptr) {
+            using cursor_type = sample_query_cursor<Geometry, Box, hilbert_value_type, Value, SampleValue>;
+            if(queries.size() != sample_sizes.size())
+                throw std::runtime_error("multi_sample_query: one sample size is needed per query");
+            std::vector<cursor_type> cursors;
+            cursors.reserve(queries.size());
+            for(auto const& query : queries)
+                cursors.emplace_back(query, root_node_entry, get_block_manager(), rng_dev);
+            ::rtree::multi_sample_query<Geometry, Box, hilbert_value_type, Value, SampleValue> batch(cursors, get_block_manager());
+            batch.run(sample_sizes);
+            if(io_cost_ptr)
+                *io_cost_ptr = batch.get_io_cost();
+            return cursors;
+        }
+
         /*
          * Get all items within the query range
          */
@@ -228,11 +293,55 @@ namespace rtree {
         range_report(Geometry const& query, Iterator out_iter) {
             range_reporter<Geometry, Iterator, Box, hilbert_value_type, Value, SampleValue>
                 rr(query, get_block_manager(), out_iter);
-            apply_visitor(rr);
+            size_t allocations0 = node_allocations();
+            root_node_entry.apply_static(rr);
+            rr.stats.node_allocations += node_allocations() - allocations0;
             return rr.stats;
         }
 
 
+        /*
+         * The number of values within the query range, without reading them
+         * `mode` trades accuracy for blocks read, see CountMode
+         * `sd_ptr` is to optionally receive the standard deviation of the count, 0 if it is exact
+         */
+        template<typename Geometry>
+        size_t
+        count(Geometry const& query, CountMode mode = CountMode::exact(), double * sd_ptr = nullptr) {
+            range_counter<Geometry, Box, hilbert_value_type, Value, SampleValue>
+                rc(query, get_block_manager(), mode);
+            rc.run(root_node_entry);
+            if(sd_ptr)
+                *sd_ptr = rc.get_sd();
+            return rc.get_count();
+        }
+
+        /*
+         * The aggregates of the fields of the values within the query range, exact
+         * the fields are chosen by aggregate_fields<Value>, without any only the count is there
+         */
+        template<typename Geometry>
+        range_aggregate<aggregate_fields<Value>::count>
+        aggregate(Geometry const& query, Stats * stats_ptr = nullptr) {
+            range_aggregator<Geometry, Box, hilbert_value_type, Value, SampleValue>
+                ra(query, get_block_manager());
+            size_t allocations0 = node_allocations();
+            root_node_entry.apply_static(ra);
+            ra.stats.node_allocations += node_allocations() - allocations0;
+            if(stats_ptr)
+                *stats_ptr = ra.stats;
+            return ra.result;
+        }
+
+        /*
+         * A read-only copy of the whole tree in a few arrays, see frozen_tree
+         * the io nodes that are not loaded are read from the disk
+         */
+        frozen_tree_type
+        freeze(void) {
+            return frozen_tree_type::freeze(root_node_entry, get_block_manager());
+        }
+
         /*
          * Build the disk/io layers from the raw data
          */
@@ -296,7 +405,7 @@ namespace rtree {
         Stats
         count_nodes(void) {
             walker<Box, hilbert_value_type, Value, SampleValue> w(io_layers->get_block_manager());
-            apply_visitor(w);
+            root_node_entry.apply_static(w);
             return w.stats;
         }
         */
@@ -309,7 +418,12 @@ namespace rtree {
         std::vector<entry_t>
         build_layer(Iterator first, Iterator last, size_t min_fanout, size_t max_fanout);
 
+        // give the mem nodes a slot of samples_slab each
+        void pack_samples(void);
+
         entry_t root_node_entry;
+        // the samples of the mem nodes
+        std::unique_ptr<sample_slab<SampleValue>> samples_slab;
         std::unique_ptr<io_layers_type> io_layers;
         std::shared_ptr<HilbertValueComputer> hilbert_value_computer;
 
@@ -331,5 +445,6 @@ namespace rtree {
  * do not use them out of this file
  */
 #include "nodes_impl.h"
+#include "frozen_tree_impl.h"
 #include "io_layers_impl.h"
 #include "rtree_impl.h"
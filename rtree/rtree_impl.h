@@ -51,7 +51,7 @@ namespace rtree {
         if(load_mem_nodes)
         {
             root_node_entry = mem_node_saver<Box, hilbert_value_type, Value, SampleValue>
-                ::load(filename + ".memnodes");
+                ::load(filename + ".memnodes", samples_slab);
         }
         else
         {
@@ -84,10 +84,14 @@ namespace rtree {
             {
                 sample_builder<NodeSampleSize, Box, hilbert_value_type, Value, SampleValue>
                     sb(io_layers->get_block_manager(), true);
-                apply_visitor(sb);
+                root_node_entry.apply_static(sb);
             }
         }
 
+        // the memnodes files with a slab come with the samples in place
+        if(!samples_slab)
+            pack_samples();
+
         if(in_memory || memory_limit > 0)
         {
             if(in_memory && memory_limit != 0)
@@ -104,7 +108,7 @@ namespace rtree {
     rtree TARGS::~rtree()
     {
         mem_node_cleaner<Box, hilbert_value_type, Value, SampleValue> mnc(io_layers->get_block_manager());
-        apply_visitor(mnc);
+        root_node_entry.apply_static(mnc);
         delete root_node_entry.node_ptr;
     }
 
@@ -114,10 +118,63 @@ namespace rtree {
     save_mem_nodes(void)
     {
         mem_node_saver<Box, hilbert_value_type, Value, SampleValue> mds(io_layers->get_block_manager(), 
-                filename + ".memnodes");
-        apply_visitor(mds);
+                filename + ".memnodes", samples_slab.get());
+        root_node_entry.apply_static(mds);
     }
 
+    TDECL
+    void
+    rtree TARGS::
+    pack_samples(void)
+    {
+        if(NodeSampleSize == 0)
+            return;
+
+        // the mem nodes in breadth first order, the io nodes below them keep their samples
+        std::vector<mem_internal_node_type*> mem_nodes;
+        if(root_node_entry.is_mem_node())
+            mem_nodes.push_back(static_cast<mem_internal_node_type*>(root_node_entry.node_ptr));
+        for(size_t i = 0; i < mem_nodes.size(); ++i)
+        {
+            for(auto & child : mem_nodes[i]->children)
+                if(child.is_mem_node())
+                    mem_nodes.push_back(static_cast<mem_internal_node_type*>(child.node_ptr));
+        }
+
+        samples_slab.reset(new sample_slab<SampleValue>(NodeSampleSize, mem_nodes.size()));
+        for(size_t i = 0; i < mem_nodes.size(); ++i)
+            mem_nodes[i]->samples.move_to_slot(*samples_slab, i);
+    }
+
+
+    TDECL
+    void
+    rtree TARGS::
+    relayout(void)
+    {
+        // the IO entries in the mem leaves, from left to right
+        std::vector<entry_t*> entries;
+        std::function<void(entry_t &)> collect = [&](entry_t & entry) {
+            auto & node = static_cast<mem_internal_node_type&>(*entry.node_ptr);
+            for (auto & child : node.children)
+            {
+                if (child.is_io_node())
+                    entries.push_back(&child);
+                else
+                    collect(child);
+            }
+        };
+        if (root_node_entry.is_mem_node())
+            collect(root_node_entry);
+        else
+            entries.push_back(&root_node_entry);
+
+        io_layers->relayout(entries);
+
+        // the saved mem nodes point to the old bids
+        if (std::ifstream(filename + ".memnodes"))
+            save_mem_nodes();
+    }
 
     TDECL
     template<bool UPDATE_SAMPLE>
@@ -133,7 +190,7 @@ namespace rtree {
                  >::type::value,
                  HilbertValueComputer, Box, hilbert_value_type, Value, SampleValue>
             ins(value, io_layers->get_block_manager(), hilbert_value_computer.get());
-        root_node_entry.apply_visitor(ins);
+        root_node_entry.apply_static(ins);
         if (!ins.apply_ret.new_entries.empty())
         {
             // create new root
@@ -149,7 +206,7 @@ namespace rtree {
 
             sample_builder<NodeSampleSize, Box, hilbert_value_type, Value, SampleValue>
                 sb(io_layers->get_block_manager());
-            apply_visitor(sb);
+            root_node_entry.apply_static(sb);
         }
     }
 
@@ -167,7 +224,7 @@ namespace rtree {
                  >::type::value,
                 HilbertValueComputer, Box, hilbert_value_type, Value, SampleValue>
             era(value, io_layers->get_block_manager(), hilbert_value_computer.get());
-        root_node_entry.apply_visitor(era);
+        root_node_entry.apply_static(era);
         return era.apply_ret.erased;
     }
 
@@ -215,6 +272,7 @@ namespace rtree {
 
             // go through the children
             size_t size = 0;
+            cur_entry.aggregate.clear();
             bg::assign_inverse(cur_entry.bbox);
             for (size_t i = 0; i < children_count; ++i)
             {
@@ -225,6 +283,7 @@ namespace rtree {
                 }
                 bg::expand(cur_entry.bbox, iter->bbox);
                 size += iter->subtree_size;
+                cur_entry.aggregate.add(iter->aggregate);
 
                 ++iter;
             }
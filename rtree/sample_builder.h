@@ -135,7 +135,7 @@ namespace rtree {
                 if (visit_all || (cur_sample_size > 0))
                 {
                     // build samples for children
-                    child_entry.apply_visitor(*this);
+                    child_entry.apply_static(*this);
 
                     // get samples from sample_buffer
                     assert(sample_buffer.size() >= ss2);
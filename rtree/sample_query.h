@@ -40,6 +40,11 @@ struct sample_query_cursor
         , query(query)
         , rng(rng_dev())
     {
+        // the blocks are read all over the file, readahead would only waste I/O
+        // (the frontier expansion asks for the blocks it needs, see prefetch),
+        // the range reports and the preload put it back for their scans
+        block_manager.advise(AccessAdvice::RANDOM);
+
         nodes.emplace_back(root_entry, 0);
         count = root_entry.subtree_size;
     }
@@ -47,10 +52,44 @@ struct sample_query_cursor
     sample_query_cursor(sample_query_cursor const& sample_query_cursor) = delete;
     sample_query_cursor(sample_query_cursor && sample_query_cursor) = default;
 
+    static constexpr
+    size_t default_parallel_min_samples = 4096;
+
+    // sample the subtrees of the frontier with OpenMP tasks, when at least `min_samples`
+    // are drawn at once over several of them. 0 (the default) keeps to the calling thread
+    void set_parallel(size_t min_samples = default_parallel_min_samples) { parallel_min_samples = min_samples; }
+
+    /*
+     * return every value of the range at most once, before the first get_samples.
+     * the frontier is still sampled with replacement, as a superset of what is left,
+     * and the values already returned are rejected like those out of the range:
+     *  - the node samples are walked once, `sample_used` moves past them
+     *  - the positions drawn in `values` are swapped to the end of the leaf they came
+     *    from (partial Fisher-Yates), a draw landing there is rejected, and they are
+     *    dropped from `values` before the next round
+     *  - the node samples returned are kept in a hash set until their leaf is loaded,
+     *    where they are taken out of the leaf values and out of the set. so the set
+     *    holds at most the node samples used by the frontier, not every value returned.
+     *    `Hash` and operator== must tell the values apart by their key (the OID of
+     *    mongo_types::sample_entry)
+     * the values that are left are then sampled uniformly, and a fresh sample costs
+     * about 1/(1-f) draws when a fraction f of the range has been returned.
+     * the frontier is sampled by the calling thread only (see set_parallel)
+     */
+    template <typename Hash = std::hash<SampleValue>>
+    void set_without_replacement(void) {
+        if(started)
+            throw std::runtime_error("sample_query_cursor: samples were already taken with replacement");
+        returned.reset(new returned_value_set<Hash>());
+    }
+    bool is_without_replacement(void) const { return (bool)returned; }
+
     template<typename OutIter>
     void
     get_samples(size_t sample_size, OutIter out_iter) {
         size_t cost0 = block_manager.get_stats().cost();
+        size_t allocations0 = node_allocations();
+        started = true;
         auto sample_buffer_inserter = std::back_inserter(sample_buffer);
         sampler<decltype(sample_buffer_inserter)> s(*this, sample_buffer_inserter, rng);
         while(sample_size > 0) 
@@ -74,6 +113,7 @@ struct sample_query_cursor
             }
         }
         io_cost += block_manager.get_stats().cost() - cost0;
+        stats.node_allocations += node_allocations() - allocations0;
     }
 
     // estimates the number of elements in the query range
@@ -105,6 +145,17 @@ private:
         { }
     };
 
+    using frontier_iterator = typename std::list<sample_node_entry>::iterator;
+
+    // samples drawn for an entry of the frontier
+    struct planned_entry {
+        frontier_iterator iter;
+        // sample size on this node
+        size_t sample_size;
+        // the size of the ground set when the node was drawn
+        size_t ground_size;
+    };
+
     template<typename OutIter>
     struct sampler
         : visitor TARGS
@@ -120,6 +171,9 @@ private:
 
         using cursor_type = sample_query_cursor;
 
+        // apply_static calls the apply methods, which are private
+        friend entry_t;
+
         sampler(cursor_type & cursor, OutIter out_iter, RNG & rng)
             : base_t(cursor.block_manager)
             , cursor(cursor)
@@ -127,9 +181,27 @@ private:
             , rng(rng)
         { }
 
+        // take `sample_size` samples from the entry at `iter` of `cursor.nodes`,
+        // drawn from `ground_size` values (see sample_from_entries)
+        void get_samples_from_entry(frontier_iterator iter, size_t sample_size, size_t ground_size)
+        {
+            sample_size_wanted = sample_size;
+            sample_planned_entry(iter, sample_size, ground_size);
+        }
+
         void get_samples(size_t sample_size)
+        {
+            std::vector<planned_entry> plan;
+            plan_samples(sample_size, plan);
+            sample_plan(plan, cursor.nodes.end());
+        }
+
+        // the first half of get_samples: the samples from `cursor.values` are taken,
+        // those from the nodes of the frontier are split over them into `plan`
+        void plan_samples(size_t sample_size, std::vector<planned_entry> & plan)
         {
             sample_size_wanted = sample_size;
+            cursor.drop_returned_values();
             
             // now we are filling sample buffer, and we don't need to go too deep
             //while(sample_size_wanted > 0)
@@ -152,105 +224,322 @@ private:
                 sample_size_this_round -= samples_from_values;
                 if(sample_size_this_round > 0)
                 {
-                    sample_from_entries(cursor.nodes.begin(), cursor.nodes.end(), 
+                    plan_entries(cursor.nodes.begin(), cursor.nodes.end(), 
                             cur_count - cursor.values.size(), 
-                            sample_size_this_round);
+                            sample_size_this_round, plan);
                 }
 
             }
         }
 
+        /*
+         * sample_planned_entry for multi_sample_query, which loads `node` (the node of the entry
+         * at `iter`) once for all the queries. the samples to take from the children
+         * are split over them into `children_plan` instead of being taken
+         */
+        template<typename Node>
+        void sample_loaded_entry(Node & node, frontier_iterator iter, size_t sample_size, size_t ground_size,
+                std::vector<planned_entry> & children_plan)
+        {
+            apply_arg.sample_size = sample_size;
+            apply_arg.cur_sample_node_entry = &(*iter);
+            apply(node, iter->node_entry);
+
+            auto children = replace_by_children(iter);
+            if(children.first != children.second)
+                plan_entries(children.first, children.second,
+                        ground_size, apply_ret.sample_size_from_children, children_plan);
+        }
+
     private:
-        // all the values must be in the query range
+        // all the values must be in the query range, [first, last) within `cursor.values`
         template<typename ValueIter>
         void 
         sample_from_values(ValueIter first, ValueIter last, size_t sample_size)
         {
             //std::uniform_int_distribution<size_t> 
-            boost::random::uniform_smallint<size_t> dist(0, (size_t)std::distance(first, last) - 1);
+            size_t n = (size_t)std::distance(first, last);
+            boost::random::uniform_smallint<size_t> dist(0, n - 1);
+            if(!cursor.returned)
+            {
+                for(size_t i = 0; i < sample_size; ++i)
+                    report(*(first + dist(rng)));
+                assert(sample_size_wanted >= sample_size);
+                sample_size_wanted -= sample_size;
+                return;
+            }
+
+            // without replacement, the values drawn are swapped to the end of [first, last),
+            // where a later draw is rejected like a duplicate of the draws with replacement.
+            // they are dropped from `cursor.values` before the next round
+            size_t drawn = 0;
             for(size_t i = 0; i < sample_size; ++i)
             {
-                *out_iter = first[dist(rng)];
-                ++out_iter; 
+                size_t j = dist(rng);
+                if(j >= n - drawn)
+                {
 #ifdef RSTREE_PROFILING
-                ++cursor.stats.values_reported;
+                    ++cursor.stats.values_rejected;
 #endif 
+                    continue;
+                }
+                ++drawn;
+                auto iter = first + (n - drawn);
+                std::swap(*(first + j), *iter);
+                report(*iter);
+                cursor.returned_value_positions.push_back(iter - cursor.values.begin());
             } 
-            assert(sample_size_wanted >= sample_size);
-            sample_size_wanted -= sample_size;
+            assert(sample_size_wanted >= drawn);
+            sample_size_wanted -= drawn;
         }
 
-        // iterators must be from `cursor.nodes`
-        template<typename Iterator>
         void
-        sample_from_entries(Iterator first, Iterator last, size_t subtree_size, size_t sample_size)
+        report(SampleValue const& v)
         {
-            auto iter = first;
-            while(iter != last)
+            *out_iter = v;
+            ++out_iter;
+#ifdef RSTREE_PROFILING
+            ++cursor.stats.values_reported;
+#endif 
+        }
+
+        // output a sample of a node, unless it was already returned without replacement
+        bool
+        report_node_sample(SampleValue const& v)
+        {
+            if(cursor.returned && !cursor.returned->insert(v))
             {
-                if(sample_size == 0) return;
+#ifdef RSTREE_PROFILING
+                ++cursor.stats.values_rejected;
+#endif 
+                return false;
+            }
+            report(v);
+            return true;
+        }
 
-                bool do_increment = true;
+        // iterators must be from `cursor.nodes`
+        void
+        sample_from_entries(frontier_iterator first, frontier_iterator last, size_t subtree_size, size_t sample_size)
+        {
+            std::vector<planned_entry> plan;
+            plan_entries(first, last, subtree_size, sample_size, plan);
+            sample_plan(plan, last);
 
-                // sample size on this node
-                size_t s = next_sample_size(sample_size, iter->node_entry.subtree_size, subtree_size, rng);
+            // [first, last) is the valid range, and `subtree_size` is the size of ground set
+            // it's not necessary that the sum of subtree sizes over [first, last) equals to `subtree_size`
+            // so it's possible that `sample_size > 0` at this point
+            // this means that those samples are out of the query range
+            // so we just ignore them
+        }
 
+        // split the samples over the entries [first, last) of `cursor.nodes`
+        // the split doesn't depend on the content of the nodes,
+        // so every block needed at this level can be read in one batch
+        void
+        plan_entries(frontier_iterator first, frontier_iterator last, size_t subtree_size, size_t sample_size,
+                std::vector<planned_entry> & plan)
+        {
+            for(auto iter = first; iter != last && sample_size > 0; ++iter)
+            {
+                size_t s = next_sample_size(sample_size, iter->node_entry.subtree_size, subtree_size, rng);
                 if(s > 0)
+                    plan.push_back(planned_entry{iter, s, subtree_size});
+
+                sample_size -= s;
+                // subtree_size is the number of elements that are to be sampled (within this function)
+                subtree_size -= iter->node_entry.subtree_size;
+            }
+        }
+
+        // take the samples of `plan`, whose entries are before `last`
+        void
+        sample_plan(std::vector<planned_entry> const& plan, frontier_iterator last)
+        {
+            prefetch(plan);
+
+            size_t planned = 0;
+            for(auto const& p : plan)
+                planned += p.sample_size;
+
+            // (the tasks can't share the values returned without replacement)
+            if(plan.size() > 1 && cursor.parallel_min_samples > 0 && planned >= cursor.parallel_min_samples
+                    && !cursor.returned)
+            {
+                sample_plan_in_parallel(plan, last);
+            }
+            else
+            {
+                for(auto const& p : plan)
+                    sample_planned_entry(p.iter, p.sample_size, p.ground_size);
+            }
+        }
+
+        // take the `sample_size` samples drawn for the entry at `iter`
+        void
+        sample_planned_entry(frontier_iterator iter, size_t sample_size, size_t ground_size)
+        {
+            apply_arg.sample_size = sample_size;
+            apply_arg.cur_sample_node_entry = &(*iter);
+            iter->node_entry.apply_static(*this);
+
+            auto children = replace_by_children(iter);
+            if(children.first != children.second)
+                sample_from_entries(children.first, children.second,
+                        ground_size, apply_ret.sample_size_from_children);
+        }
+
+        // after apply() on the entry at `iter`: the entry leaves the frontier if it is a leaf,
+        // or if its samples were not enough, then its children in range take its place
+        // returns the range of those children, empty when there are none
+        std::pair<frontier_iterator, frontier_iterator>
+        replace_by_children(frontier_iterator iter)
+        {
+            if(apply_ret.sample_size_from_children > 0) 
+            {
+                assert(iter->node_entry.type != entry_t::IO_LEAF_TYPE);
+                assert(iter->node_entry.type != entry_t::LOADED_IO_LEAF_TYPE);
+                // there are not enough samples at this node
+                // remove it
+                iter = cursor.nodes.erase(iter);
+
+                // go deeper
+
+                // it's possible that there is no children in the query range
+                // in which case nothing will be outputted
+                // and we will need to get more samples in the next round
+                // with more accurate information
+                if(!apply_ret.children_list.empty())
                 {
-                    apply_arg.sample_size = s;
-                    apply_arg.cur_sample_node_entry = &(*iter);
-                    iter->node_entry.apply_visitor(*this);
+                    // make a node of the first child
+                    auto first_child_iter = apply_ret.children_list.begin();
+                    cursor.nodes.splice(iter, apply_ret.children_list);
+
+                    // now `first_child_iter` marks the first child node
+                    // `iter` marks the next sibling, which just follows the last child node
+                    // (list iterators in the plan of the caller are not invalidated by erase/splice)
+                    return std::make_pair(first_child_iter, iter);
+                }
+                return std::make_pair(iter, iter);
+            }
+            else if(iter->node_entry.type == entry_t::IO_LEAF_TYPE || iter->node_entry.type == entry_t::LOADED_IO_LEAF_TYPE)
+            {
+                // the values must have been copied to `cursor.values`
+                // just remove this node 
+                iter = cursor.nodes.erase(iter);
+            }
+            return std::make_pair(iter, iter);
+        }
 
-                    if(apply_ret.sample_size_from_children > 0) 
-                    {
-                        assert(iter->node_entry.type != entry_t::IO_LEAF_TYPE);
-                        assert(iter->node_entry.type != entry_t::LOADED_IO_LEAF_TYPE);
-                        // there are not enough samples at this node
-                        // remove it
-                        iter = cursor.nodes.erase(iter);
-                        do_increment = false;
-
-                        // go deeper
-
-                        // it's possible that there is no children in the query range
-                        // in which case nothing will be outputted
-                        // and we will need to get more samples in the next round
-                        // with more accurate information
-                        if(!apply_ret.children_list.empty())
-                        {
-                            // make a node of the first child
-                            auto first_child_iter = apply_ret.children_list.begin();
-                            cursor.nodes.splice(iter, apply_ret.children_list);
+        /*
+         * the same as sample_planned_entry over the whole plan, with one OpenMP task per entry
+         * every entry moves to a cursor of its own (frontier, values, RNG seeded from `rng`, stats),
+         * which is merged back once all the tasks are done.
+         * the samples of an entry only depend on the number drawn for it,
+         * so they are as uniform as when the entries are sampled one after the other.
+         * an exception can't leave a task, the first one (in the order of the plan)
+         * is thrown once the frontier is merged back, without the samples of the plan
+         */
+        void
+        sample_plan_in_parallel(std::vector<planned_entry> const& plan, frontier_iterator last)
+        {
+            std::vector<std::unique_ptr<subtree_task>> tasks;
+            for(auto const& p : plan)
+            {
+                std::unique_ptr<subtree_task> t(new subtree_task(cursor, rng(), p.sample_size, p.ground_size));
+                t->cursor.nodes.splice(t->cursor.nodes.end(), cursor.nodes, p.iter);
+                t->cursor.count = p.iter->node_entry.subtree_size;
+                cursor.count -= t->cursor.count;
+                tasks.push_back(std::move(t));
+            }
 
-                            // now `first_child_iter` marks the first child node
-                            // `iter` marks the next sibling, which just follows the last child node
+            size_t allocations0 = node_allocations();
+#ifdef _OPENMP
+            if(omp_in_parallel())
+            {
+                // a task of an outer plan, or a parallel region of the caller
+                for(auto & t : tasks)
+                {
+                    subtree_task * tp = t.get();
+                    #pragma omp task
+                    tp->run();
+                }
+                #pragma omp taskwait
+            }
+            else
+            {
+                #pragma omp parallel
+                #pragma omp single
+                for(auto & t : tasks)
+                {
+                    subtree_task * tp = t.get();
+                    #pragma omp task
+                    tp->run();
+                }
+            }
+#else
+            for(auto & t : tasks)
+                t->run();
+#endif
+            // the tasks run by this thread are in their own stats too
+            size_t allocations_in_thread = node_allocations() - allocations0;
+
+            std::exception_ptr error;
+            for(auto & t : tasks)
+            {
+                if(!error)
+                    error = t->error;
+            }
 
-                            sample_from_entries(first_child_iter, iter,
-                                    subtree_size, apply_ret.sample_size_from_children);
-                        }
-                    }
-                    else if(iter->node_entry.type == entry_t::IO_LEAF_TYPE || iter->node_entry.type == entry_t::LOADED_IO_LEAF_TYPE)
+            for(auto & t : tasks)
+            {
+                if(!error)
+                {
+                    for(auto const& v : t->samples)
                     {
-                        // the values must have been copied to `cursor.values`
-                        // just remove this node 
-                        iter = cursor.nodes.erase(iter);
-                        do_increment = false;
+                        *out_iter = v;
+                        ++out_iter;
                     }
-
-                    sample_size -= s;
+                    assert(sample_size_wanted >= t->samples.size());
+                    sample_size_wanted -= t->samples.size();
                 }
 
-                // subtree_size is the number of elements that are to be sampled (within this function)
-                subtree_size -= iter->node_entry.subtree_size;
-                if(do_increment)
-                    ++iter;
+                cursor.nodes.splice(last, t->cursor.nodes);
+                cursor.values.insert(cursor.values.end(), t->cursor.values.begin(), t->cursor.values.end());
+                cursor.count += t->cursor.count;
+                cursor.stats += t->cursor.stats;
             }
+            cursor.stats.node_allocations -= allocations_in_thread;
 
-            // [first, last) is the valid range, and `subtree_size` is the size of ground set
-            // it's not necessary that the sum of subtree sizes over [first, last) equals to `subtree_size`
-            // so it's possible that `sample_size > 0` at this point
-            // this means that those samples are out of the query range
-            // so we just ignore them
+            if(error)
+                std::rethrow_exception(error);
+        }
+
+        // read the blocks of the IO nodes in `plan` as one batch
+        template<typename Plan>
+        void
+        prefetch(Plan const& plan)
+        {
+            std::vector<bid_t> bids;
+            for(auto const& p : plan)
+            {
+                auto const& entry = p.iter->node_entry;
+                if(entry.type == entry_t::IO_LEAF_TYPE)
+                {
+                    bids.push_back(entry.bid);
+                }
+                else if(entry.type == entry_t::IO_INTERNAL_TYPE)
+                {
+                    bids.push_back(io_internal_node_type::sample_bid(entry));
+                    // the samples can't be enough, we'll surely go down to the children
+                    if(p.iter->sample_used + p.sample_size > io_internal_node_type::sample_capacity(block_manager.get_block_size()))
+                        bids.push_back(io_internal_node_type::children_and_buffer_bid(entry));
+                }
+            }
+
+            // a single read gains nothing from being batched
+            if(bids.size() > 1)
+                block_manager.prefetch_blocks(bids);
         }
 
         void apply (internal_node_type & node, entry_t & entry) {
@@ -267,6 +556,7 @@ private:
             if(apply_ret.sample_size_from_children > 0)
             {
                 prepare_children_list(node, entry);
+                take_buffer(node);
                 ++cursor.stats.leaf_nodes;
             }
         }
@@ -282,6 +572,7 @@ private:
             {
                 node.load_children_and_buffer_from_blocks(entry, block_manager);
                 prepare_children_list(node, entry);
+                take_buffer(node);
                 if(!entry.is_loaded_io_node())
                     ++cursor.stats.io_internal_nodes;
             }
@@ -289,34 +580,36 @@ private:
 
         void apply (io_leaf_node_type & node, entry_t & entry) {
             assert(apply_arg.sample_size > 0);
-            node.load_from_blocks(entry, cursor.block_manager);
             if(!entry.is_loaded_io_node())
                 ++cursor.stats.io_leaf_nodes;
             else
                 ++cursor.stats.leaf_nodes;
 
             // filter values and save those in the query range
+            // (with columnar leaves, only those are read from the block)
             size_t old_values_size = cursor.values.size();
-            for(auto const& v : node.values)
-            {
-                if(bg::covered_by(v.get_point(), cursor.query))
-                {
-                    cursor.values.push_back(v);
+            auto out = std::back_inserter(cursor.values);
+            size_t count_in_range = node.load_covered_from_blocks(entry, cursor.block_manager, cursor.query, out);
 #ifdef RSTREE_PROFILING
-                    // will be counted in sample_from_values()
-                    //++cursor.stats.values_reported;
+            // the values reported will be counted in sample_from_values()
+            cursor.stats.values_rejected += entry.subtree_size - count_in_range;
+            cursor.stats.leaf_values_scanned += entry.subtree_size;
 #endif 
-                }
-#ifdef RSTREE_PROFILING
-                else
+            if(cursor.returned && !cursor.returned->empty())
+            {
+                // without replacement, the values returned from the samples of the ancestors
+                // are not in the range any more. this is their leaf, they leave the set
+                size_t kept = old_values_size;
+                for(size_t i = old_values_size; i < cursor.values.size(); ++i)
                 {
-                    ++cursor.stats.values_rejected;
+                    if(!cursor.returned->erase(cursor.values[i]))
+                        cursor.values[kept++] = std::move(cursor.values[i]);
                 }
-                ++cursor.stats.leaf_values_scanned;
-#endif 
+                size_t dropped = cursor.values.size() - kept;
+                cursor.values.resize(kept);
+                count_in_range -= dropped;
+                cursor.returned_value_count += dropped;
             }
-
-            size_t count_in_range = cursor.values.size() - old_values_size;
             // update `cursor.count` since we might have removed some elements
             cursor.count -= entry.subtree_size;
             cursor.count += count_in_range;
@@ -350,13 +643,12 @@ private:
             {
                 while(iter1 != iter2)
                 {
-                    *out_iter = *iter1;
-                    assert(sample_size_wanted > 0);
-                    --sample_size_wanted;
+                    if(report_node_sample(*iter1))
+                    {
+                        assert(sample_size_wanted > 0);
+                        --sample_size_wanted;
+                    }
                     ++iter1;
-#ifdef RSTREE_PROFILING
-                    ++cursor.stats.values_reported;
-#endif 
                 }
             }
             else
@@ -365,12 +657,11 @@ private:
                 {
                     if(bg::covered_by(iter1->get_point(), cursor.query))
                     {
-                        *out_iter = *iter1;
-                        assert(sample_size_wanted > 0);
-                        --sample_size_wanted;
-#ifdef RSTREE_PROFILING
-                        ++cursor.stats.values_reported;
-#endif 
+                        if(report_node_sample(*iter1))
+                        {
+                            assert(sample_size_wanted > 0);
+                            --sample_size_wanted;
+                        }
                     }
 #ifdef RSTREE_PROFILING
                     else
@@ -392,16 +683,39 @@ private:
         prepare_children_list(internal_node_type & node, entry_t const& entry) {
             cursor.count -= entry.subtree_size;
             assert(apply_ret.children_list.empty());
-            for(auto & child_entry : node.children)
+            child_box_masks masks;
+            node.test_children(cursor.query, masks);
+            for(size_t i = 0; i < node.children.size(); ++i)
             {
-                if(bg::intersects(child_entry.bbox, cursor.query))
+                if(masks.intersects(i))
                 {
+                    auto & child_entry = node.children[i];
                     apply_ret.children_list.emplace_back(child_entry, 0);
                     cursor.count += child_entry.subtree_size;
                 }
             }
         }
 
+        // the values inserted into a node that is replaced by its children are in none of them,
+        // those in the query range go to `cursor.values` (like the values of a leaf)
+        void
+        take_buffer(leaf_node_type const& node) {
+            for(auto const& v : node.buffer)
+            {
+                if(!bg::covered_by(v.get_point(), cursor.query))
+                    continue;
+                SampleValue sample = v;
+                // it was returned as a sample of this node or of an ancestor
+                if(cursor.returned && cursor.returned->erase(sample))
+                {
+                    ++cursor.returned_value_count;
+                    continue;
+                }
+                cursor.values.push_back(std::move(sample));
+                ++cursor.count;
+            }
+        }
+
         // transfer information for apply()
         struct {
             size_t sample_size; 
@@ -428,6 +742,62 @@ private:
         RNG & rng;
     };
 
+    // a subtree sampled by a task of sampler::sample_plan_in_parallel
+    struct subtree_task;
+
+    // the node samples returned in the mode without replacement, whose leaf is not loaded yet
+    struct returned_values
+    {
+        virtual ~returned_values() { }
+        // false if `v` was already there
+        virtual bool insert(SampleValue const& v) = 0;
+        // false if `v` was not there
+        virtual bool erase(SampleValue const& v) = 0;
+        virtual bool empty(void) const = 0;
+    };
+
+    template <typename Hash>
+    struct returned_value_set
+        : returned_values
+    {
+        virtual bool insert(SampleValue const& v) { return set.insert(v).second; }
+        virtual bool erase(SampleValue const& v) { return set.erase(v) > 0; }
+        virtual bool empty(void) const { return set.empty(); }
+
+        std::unordered_set<SampleValue, Hash> set;
+    };
+
+    // swap the values returned in the last round out of `values` (partial Fisher-Yates)
+    void drop_returned_values(void) {
+        if(returned_value_positions.empty())
+            return;
+        // from the back, so the value moved into a dropped one is never to drop as well
+        std::sort(returned_value_positions.begin(), returned_value_positions.end(), std::greater<size_t>());
+        for(size_t i : returned_value_positions)
+        {
+            // the last one just goes
+            if(i + 1 != values.size())
+                values[i] = std::move(values.back());
+            values.pop_back();
+        }
+        count -= returned_value_positions.size();
+        returned_value_count += returned_value_positions.size();
+        returned_value_positions.clear();
+    }
+
+    // drives the samplers of a batch of cursors
+    template <typename, typename, typename, typename, typename>
+    friend struct multi_sample_query;
+
+    // the cursor of a subtree_task, its frontier is filled by the task
+    sample_query_cursor(sample_query_cursor const& parent, typename RNG::result_type seed)
+        : count(0)
+        , block_manager(parent.block_manager)
+        , query(parent.query)
+        , rng(seed)
+        , parallel_min_samples(parent.parallel_min_samples)
+    { }
+
     struct count_estimator 
     {
         using cursor_type = sample_query_cursor;
@@ -435,7 +805,7 @@ private:
         count_estimator(cursor_type & cursor)
             : cursor(cursor)
         { 
-            count = cursor.values.size();
+            count = cursor.values.size() + cursor.returned_value_count;
             variance = 0.0;
 
             for(auto const& sample_entry : cursor.nodes)
@@ -534,8 +904,53 @@ private:
 
     Stats stats;
     size_t io_cost = 0;
+
+    size_t parallel_min_samples = 0;
+
+    bool started = false;
+    // null with replacement, the node samples returned otherwise
+    std::unique_ptr<returned_values> returned;
+    // the values of the range no longer in `values`, as they were returned
+    size_t returned_value_count = 0;
+    // the positions in `values` of those returned since the last round
+    std::vector<size_t> returned_value_positions;
 };
 
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+struct sample_query_cursor<Geometry, Box, Key, Value, SampleValue>::subtree_task
+{
+    subtree_task(sample_query_cursor const& parent, typename RNG::result_type seed, size_t sample_size, size_t ground_size)
+        : cursor(parent, seed)
+        , sample_size(sample_size)
+        , ground_size(ground_size)
+    { }
+
+    // an exception leaving an OpenMP task terminates the program, it is kept in `error`
+    void run(void) {
+        size_t allocations0 = node_allocations();
+        try
+        {
+            auto out = std::back_inserter(samples);
+            sampler<decltype(out)> s(cursor, out, cursor.rng);
+            s.get_samples_from_entry(cursor.nodes.begin(), sample_size, ground_size);
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+        cursor.stats.node_allocations += node_allocations() - allocations0;
+    }
+
+    sample_query_cursor cursor;
+    std::vector<SampleValue> samples;
+    size_t sample_size;
+    size_t ground_size;
+    std::exception_ptr error;
+};
+
+template <typename Geometry, typename Box, typename Key, typename Value, typename SampleValue>
+constexpr size_t sample_query_cursor<Geometry, Box, Key, Value, SampleValue>::default_parallel_min_samples;
+
 } // namespace rtree
 
 #undef TDECL
@@ -0,0 +1,230 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Storage of the samples of the mem nodes
+ *
+ * every mem node has up to NodeSampleSize samples. with one vector per node
+ * there are as many allocations (and allocator headers) as mem nodes, all
+ * over the heap. instead the rtree allocates one slab with a slot of
+ * NodeSampleSize samples per mem node, numbered in breadth first order, and
+ * the samples of each node live in its slot. the memnodes file dumps and
+ * loads the slab as a whole.
+ *
+ * sample_array is the container of the samples of a node, it works like a
+ * vector. the nodes without a slot (io nodes, and mem nodes created by
+ * splits after the slab was allocated) and those growing past the size of
+ * a slot keep their samples in a vector of their own.
+ * the slab can also be a section of a mapped memnodes snapshot
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "huge_page_arena.h"
+
+namespace rtree {
+
+template <typename T>
+struct sample_slab
+{
+    sample_slab(size_t slot_size, size_t slot_count)
+        : sample_slab(slot_size, node_vector<T>(slot_size * slot_count))
+    { }
+
+    // the slots are `samples`, one after the other
+    sample_slab(size_t slot_size, node_vector<T> && samples)
+        : slot_size(slot_size)
+        , storage(std::move(samples))
+        , memory(storage.data())
+        , sample_count(storage.size())
+    {
+        check_slot_count();
+    }
+
+    // the slots are in memory kept alive by `owner` (a mapped file)
+    sample_slab(size_t slot_size, size_t slot_count, T * memory, std::shared_ptr<void> owner)
+        : slot_size(slot_size)
+        , memory(memory)
+        , sample_count(slot_size * slot_count)
+        , owner(std::move(owner))
+    {
+        check_slot_count();
+    }
+
+    // the arrays point into the slab
+    sample_slab(sample_slab const&) = delete;
+    sample_slab & operator = (sample_slab const&) = delete;
+
+    T * slot(uint32_t id) { return memory + (size_t)id * slot_size; }
+
+    size_t get_slot_size(void) const { return slot_size; }
+    size_t get_slot_count(void) const { return slot_size == 0 ? 0 : sample_count / slot_size; }
+
+    // the samples of all the slots
+    T const * data(void) const { return memory; }
+    size_t size(void) const { return sample_count; }
+
+    bool is_mapped(void) const { return (bool)owner; }
+
+private:
+    void check_slot_count(void) {
+        if(get_slot_count() > std::numeric_limits<uint32_t>::max())
+            throw std::runtime_error("sample_slab: too many slots");
+    }
+
+    size_t slot_size;
+    node_vector<T> storage;
+    T * memory;
+    size_t sample_count;
+    std::shared_ptr<void> owner;
+};
+
+template <typename T>
+struct sample_array
+{
+    using value_type = T;
+    using size_type = size_t;
+    using reference = T &;
+    using const_reference = T const&;
+    using iterator = T *;
+    using const_iterator = T const *;
+
+    static constexpr
+    uint32_t NO_SLOT = std::numeric_limits<uint32_t>::max();
+
+    sample_array() = default;
+
+    // a copy has its own vector
+    sample_array(sample_array const& other) : own(other.begin(), other.end()) { }
+    sample_array & operator = (sample_array const& other) {
+        if(this != &other)
+        {
+            node_vector<T> copy(other.begin(), other.end());
+            leave_slot();
+            own.swap(copy);
+        }
+        return *this;
+    }
+
+    /*
+     * move the samples to slot `id` of `slab`
+     * nothing changes if they don't fit
+     */
+    void move_to_slot(sample_slab<T> & slab, uint32_t id) {
+        if(in_slot() || own.size() > slab.get_slot_size())
+            return;
+        T * s = slab.slot(id);
+        std::copy(own.begin(), own.end(), s);
+        use_slot(slab, id, own.size());
+        node_vector<T>().swap(own);
+    }
+
+    // the slot already has `size` samples
+    void use_slot(sample_slab<T> & slab, uint32_t id, size_t size) {
+        slot = slab.slot(id);
+        slot_capacity = slab.get_slot_size();
+        slot_size = size;
+        slot_id = id;
+    }
+
+    bool in_slot(void) const { return slot != nullptr; }
+    uint32_t get_slot_id(void) const { return slot_id; }
+
+    size_t size(void) const { return in_slot() ? slot_size : own.size(); }
+    bool empty(void) const { return size() == 0; }
+
+    T * data(void) { return in_slot() ? slot : own.data(); }
+    T const * data(void) const { return in_slot() ? slot : own.data(); }
+
+    iterator begin(void) { return data(); }
+    iterator end(void) { return data() + size(); }
+    const_iterator begin(void) const { return data(); }
+    const_iterator end(void) const { return data() + size(); }
+
+    T & operator [] (size_t i) { return data()[i]; }
+    T const& operator [] (size_t i) const { return data()[i]; }
+    T & back(void) { return data()[size() - 1]; }
+    T const& back(void) const { return data()[size() - 1]; }
+
+    void clear(void) {
+        if(in_slot())
+            slot_size = 0;
+        else
+            own.clear();
+    }
+
+    void resize(size_t n) {
+        if(in_slot() && n > slot_capacity)
+            leave_slot();
+        if(!in_slot())
+            return own.resize(n);
+        std::fill(slot + std::min(n, slot_size), slot + n, T());
+        slot_size = n;
+    }
+
+    void push_back(T const& v) { emplace_back(v); }
+
+    template <typename... Args>
+    void emplace_back(Args&&... args) {
+        if(in_slot() && slot_size == slot_capacity)
+            leave_slot();
+        if(!in_slot())
+            return own.emplace_back(std::forward<Args>(args)...);
+        slot[slot_size++] = T(std::forward<Args>(args)...);
+    }
+
+    void pop_back(void) {
+        if(in_slot())
+            --slot_size;
+        else
+            own.pop_back();
+    }
+
+private:
+    // the samples go to the vector, the slot is not used anymore
+    void leave_slot(void) {
+        if(!in_slot())
+            return;
+        own.assign(slot, slot + slot_size);
+        slot = nullptr;
+        slot_capacity = slot_size = 0;
+        slot_id = NO_SLOT;
+    }
+
+    T * slot = nullptr;
+    size_t slot_capacity = 0;
+    size_t slot_size = 0;
+    uint32_t slot_id = NO_SLOT;
+
+    node_vector<T> own;
+};
+
+template <typename T>
+constexpr uint32_t sample_array<T>::NO_SLOT;
+
+} // namespace rtree
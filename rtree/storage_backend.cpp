@@ -0,0 +1,593 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+
+#include "rtree/rtree.h"
+
+namespace rtree {
+
+namespace {
+
+void
+read_fully(int fd, char * data, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t rv = pread(fd, data + done, size - done, offset + done);
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+            throw std::runtime_error("StorageBackend: failed to read a block");
+        done += rv;
+    }
+}
+
+void
+write_fully(int fd, char const * data, size_t size, off_t offset)
+{
+    size_t done = 0;
+    while(done < size)
+    {
+        ssize_t rv = pwrite(fd, data + done, size - done, offset + done);
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+            throw std::runtime_error("StorageBackend: failed to write a block");
+        done += rv;
+    }
+}
+
+struct aligned_buffer
+{
+    aligned_buffer(size_t alignment, size_t size) {
+        if(posix_memalign((void**)&data, alignment, size) != 0)
+            throw std::bad_alloc();
+    }
+    ~aligned_buffer() { free(data); }
+
+    char * data;
+};
+
+bool
+is_aligned(void const * p, size_t alignment) {
+    return ((uintptr_t)p) % alignment == 0;
+}
+
+size_t
+page_size(void) {
+    static const size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+size_t
+round_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+int
+madvise_advice(AccessAdvice advice)
+{
+    switch(advice)
+    {
+        case AccessAdvice::RANDOM: return MADV_RANDOM;
+        case AccessAdvice::SEQUENTIAL: return MADV_SEQUENTIAL;
+        case AccessAdvice::WILLNEED: return MADV_WILLNEED;
+        case AccessAdvice::DONTNEED: return MADV_DONTNEED;
+        default: return MADV_NORMAL;
+    }
+}
+
+int
+fadvise_advice(AccessAdvice advice)
+{
+    switch(advice)
+    {
+        case AccessAdvice::RANDOM: return POSIX_FADV_RANDOM;
+        case AccessAdvice::SEQUENTIAL: return POSIX_FADV_SEQUENTIAL;
+        case AccessAdvice::WILLNEED: return POSIX_FADV_WILLNEED;
+        case AccessAdvice::DONTNEED: return POSIX_FADV_DONTNEED;
+        default: return POSIX_FADV_NORMAL;
+    }
+}
+
+// the advice holds for the blocks appended later
+bool
+is_persistent(AccessAdvice advice)
+{
+    return advice == AccessAdvice::NORMAL || advice == AccessAdvice::RANDOM || advice == AccessAdvice::SEQUENTIAL;
+}
+
+} // anonymous namespace
+
+std::unique_ptr<StorageBackend>
+StorageBackend::open(StorageKind kind, std::string const& file_name, size_t block_size, bool huge_pages)
+{
+    int flags = O_RDWR;
+    if(kind == StorageKind::DIRECT)
+    {
+        if(block_size % 512 != 0)
+            throw std::runtime_error("StorageBackend: direct I/O needs the block size to be a multiple of 512");
+        flags |= O_DIRECT;
+    }
+
+    int fd = ::open(file_name.c_str(), flags);
+    if(fd < 0)
+        throw std::runtime_error("StorageBackend: cannot open " + file_name + ": " + strerror(errno));
+
+    // if a constructor throws, the base destructor closes the file
+    switch(kind)
+    {
+        case StorageKind::MMAP:
+            return std::unique_ptr<StorageBackend>(new MmapStorage(fd, block_size, huge_pages));
+        case StorageKind::SYSCALL:
+            return std::unique_ptr<StorageBackend>(new SyscallStorage(fd, block_size));
+        case StorageKind::DIRECT:
+            return std::unique_ptr<StorageBackend>(new DirectStorage(fd, block_size));
+        default:
+            break;
+    }
+
+    close(fd);
+    throw std::runtime_error("StorageBackend: unknown storage kind");
+}
+
+std::unique_ptr<StorageBackend>
+StorageBackend::open(StorageKind kind, std::string const& name, StripingParameters const& striping, size_t block_size, bool huge_pages)
+{
+    if(striping.file_count() == 1)
+        return open(kind, striping.file_name(name, 0), block_size, huge_pages);
+
+    if(striping.width == 0)
+        throw std::runtime_error("StorageBackend: the stripe width must not be 0");
+
+    std::vector<std::unique_ptr<StorageBackend>> stripes;
+    for(size_t i = 0; i < striping.file_count(); ++i)
+        stripes.push_back(open(kind, striping.file_name(name, i), block_size, huge_pages));
+    return std::unique_ptr<StorageBackend>(new StripedStorage(std::move(stripes), block_size, striping.width));
+}
+
+StorageBackend::StorageBackend(int fd, size_t block_size)
+    : fd(fd)
+    , block_size(block_size)
+{ }
+
+StorageBackend::~StorageBackend()
+{
+    // a StripedStorage has no file of its own
+    if(fd >= 0)
+        close(fd);
+}
+
+std::string
+StripingParameters::file_name(std::string const& name, size_t i) const
+{
+    if(directories.empty())
+        return name + ".data";
+    std::string base = name.substr(name.rfind('/') + 1);
+    return directories[i] + "/" + base + ".data." + std::to_string(i);
+}
+
+void
+StorageBackend::read_batch(std::vector<ReadRequest> & batch)
+{
+    for(auto & request : batch)
+    {
+        try {
+            read(request.bid, request.data);
+            request.done = true;
+        } catch(std::runtime_error const&) {
+            request.done = false;
+        }
+    }
+}
+
+/*
+ * MmapStorage
+ */
+
+// they are passed by reference to std::max
+constexpr size_t MmapStorage::min_reserved_size;
+constexpr size_t MmapStorage::reserve_factor;
+constexpr size_t MmapStorage::min_growth;
+constexpr size_t MmapStorage::huge_page_size;
+
+MmapStorage::MmapStorage(int fd, size_t block_size, bool huge_pages)
+    : StorageBackend(fd, block_size)
+    , huge_pages(huge_pages)
+{
+    size_t size = lseek(fd, 0, SEEK_END);
+    file_size = size;
+    mapped_size = round_up(size, page_size());
+    reserved_size = std::max(min_reserved_size, mapped_size * reserve_factor);
+
+    // reserve the address space, the file is mapped at its beginning
+    // so the addresses stay the same when it grows.
+    // a huge page can only back an aligned range, hence the extra room to align the start
+    if(huge_pages)
+        reserved_size += huge_page_size;
+    reservation = (char*)mmap(NULL, reserved_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reservation == MAP_FAILED)
+        throw std::runtime_error("MmapStorage: cannot reserve the address space");
+    memory = huge_pages ? (char*)round_up((uintptr_t)reservation, huge_page_size) : reservation;
+
+    if(mapped_size > 0 &&
+        mmap(memory, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(reservation, reserved_size);
+        throw std::runtime_error("MmapStorage: mmap failed");
+    }
+    advise_huge_pages(0, mapped_size);
+}
+
+MmapStorage::~MmapStorage()
+{
+    if(mapped_size > 0)
+        msync(memory, mapped_size, MS_SYNC);
+    munmap(reservation, reserved_size);
+}
+
+void
+MmapStorage::advise_huge_pages(size_t begin, size_t end)
+{
+#ifdef MADV_HUGEPAGE
+    if(huge_pages && begin < end)
+        madvise(memory + begin, end - begin, MADV_HUGEPAGE);
+#endif
+}
+
+char *
+MmapStorage::block_address(bid_t bid) const
+{
+    if((bid + 1) * block_size > file_size)
+        throw std::runtime_error("MmapStorage: block out of the mapped range");
+    return memory + bid * block_size;
+}
+
+void
+MmapStorage::grow(size_t size)
+{
+    std::lock_guard<std::mutex> lck(grow_lock);
+    if(size <= file_size)
+        return;
+
+    // grow in proportion to the file so this stays rare, without padding small files much
+    size_t new_size = round_up(std::max(size, file_size + std::max(min_growth, file_size / 4)),
+            huge_pages ? huge_page_size : page_size());
+
+    if(fallocate(fd, 0, 0, new_size) != 0)
+    {
+        // not supported by every file system
+        if(ftruncate(fd, new_size) != 0)
+            throw std::runtime_error("MmapStorage: cannot extend the data file");
+    }
+
+    // after shrink_to, the pages up to `mapped_size` are still mapped
+    if(new_size > mapped_size)
+    {
+        reserve(new_size);
+        // mapping over the reserved range doesn't touch what is already mapped,
+        // so readers are not disturbed
+        if(mmap(memory + mapped_size, new_size - mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, mapped_size) == MAP_FAILED)
+            throw std::runtime_error("MmapStorage: mmap failed");
+        if(file_advice != AccessAdvice::NORMAL)
+            madvise(memory + mapped_size, new_size - mapped_size, madvise_advice(file_advice));
+        advise_huge_pages(mapped_size, new_size);
+        mapped_size = new_size;
+    }
+
+    file_size = new_size;
+}
+
+void
+MmapStorage::reserve(size_t size)
+{
+    char * end = reservation + reserved_size;
+    if(memory + size <= end)
+        return;
+
+    // the address space right after the reservation, double what is needed so this stays rare
+    size_t extra = round_up(memory + size - end, page_size()) * 2;
+    void * p = mmap(end, extra, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED)
+        throw std::runtime_error("MmapStorage: cannot reserve the address space");
+    if(p != end)
+    {
+        // taken by another mapping, the hint was not followed
+        munmap(p, extra);
+        throw std::runtime_error("MmapStorage: the data file outgrew the reserved address space");
+    }
+    reserved_size += extra;
+}
+
+void
+MmapStorage::shrink_to(size_t block_count)
+{
+    std::lock_guard<std::mutex> lck(grow_lock);
+    size_t size = block_count * block_size;
+    if(size >= file_size)
+        return;
+
+    msync(memory, mapped_size, MS_SYNC);
+    if(ftruncate(fd, size) != 0)
+        return;
+    // the mapping stays, grow() makes the pages valid again
+    file_size = size;
+}
+
+void
+MmapStorage::read(bid_t bid, char * data)
+{
+    memcpy(data, block_address(bid), block_size);
+}
+
+void
+MmapStorage::write(bid_t bid, char const * data)
+{
+    if((bid + 1) * block_size > file_size)
+        grow((bid + 1) * block_size);
+    memcpy(block_address(bid), data, block_size);
+}
+
+void
+MmapStorage::read_batch(std::vector<ReadRequest> & batch)
+{
+    // let the kernel start reading everything before we touch anything
+    for(auto const& request : batch)
+        will_need(request.bid);
+    StorageBackend::read_batch(batch);
+}
+
+void
+MmapStorage::advise(bid_t bid, size_t count, AccessAdvice advice)
+{
+    if(count == 0)
+    {
+        std::lock_guard<std::mutex> lck(grow_lock);
+        if(is_persistent(advice))
+            file_advice = advice;
+        if(mapped_size > 0)
+            madvise(memory, mapped_size, madvise_advice(advice));
+        return;
+    }
+
+    // only what is in the file
+    size_t end = std::min((bid + count) * block_size, (size_t)file_size);
+    size_t offset = bid * block_size;
+    if(offset >= end)
+        return;
+    size_t begin = offset - offset % page_size();
+    madvise(memory + begin, end - begin, madvise_advice(advice));
+}
+
+void
+MmapStorage::sync(bool wait)
+{
+    std::lock_guard<std::mutex> lck(grow_lock);
+    if(mapped_size > 0)
+        msync(memory, mapped_size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+/*
+ * SyscallStorage
+ */
+
+SyscallStorage::SyscallStorage(int fd, size_t block_size)
+    : StorageBackend(fd, block_size)
+{ }
+
+void
+SyscallStorage::read(bid_t bid, char * data)
+{
+    read_fully(fd, data, block_size, bid * block_size);
+}
+
+void
+SyscallStorage::write(bid_t bid, char const * data)
+{
+    write_fully(fd, data, block_size, bid * block_size);
+}
+
+void
+SyscallStorage::read_batch(std::vector<ReadRequest> & batch)
+{
+    std::call_once(reader_init, [this] { reader.reset(new AsyncReader()); });
+
+    std::vector<AsyncReader::Request> requests;
+    requests.reserve(batch.size());
+    for(auto const& request : batch)
+        requests.push_back({fd, (off_t)(request.bid * block_size), request.data, block_size, 0});
+
+    reader->read(requests);
+
+    for(size_t i = 0; i < batch.size(); ++i)
+        batch[i].done = (requests[i].result == (ssize_t)block_size);
+}
+
+void
+SyscallStorage::advise(bid_t bid, size_t count, AccessAdvice advice)
+{
+    // a length of 0 goes to the end of the file, whatever its size
+    if(count == 0)
+        bid = 0;
+    posix_fadvise(fd, bid * block_size, count * block_size, fadvise_advice(advice));
+}
+
+void
+SyscallStorage::sync(bool wait)
+{
+    if(wait)
+        fdatasync(fd);
+}
+
+/*
+ * DirectStorage
+ */
+
+DirectStorage::DirectStorage(int fd, size_t block_size)
+    : SyscallStorage(fd, block_size)
+{ }
+
+void
+DirectStorage::read(bid_t bid, char * data)
+{
+    if(is_aligned(data, alignment))
+        return SyscallStorage::read(bid, data);
+
+    aligned_buffer buffer(alignment, block_size);
+    SyscallStorage::read(bid, buffer.data);
+    memcpy(data, buffer.data, block_size);
+}
+
+void
+DirectStorage::write(bid_t bid, char const * data)
+{
+    if(is_aligned(data, alignment))
+        return SyscallStorage::write(bid, data);
+
+    aligned_buffer buffer(alignment, block_size);
+    memcpy(buffer.data, data, block_size);
+    SyscallStorage::write(bid, buffer.data);
+}
+
+void
+DirectStorage::read_batch(std::vector<ReadRequest> & batch)
+{
+    // the frames of the buffer pool are aligned, anything else is read one by one
+    for(auto const& request : batch)
+    {
+        if(!is_aligned(request.data, alignment))
+            return StorageBackend::read_batch(batch);
+    }
+    SyscallStorage::read_batch(batch);
+}
+
+/*
+ * StripedStorage
+ */
+
+StripedStorage::StripedStorage(std::vector<std::unique_ptr<StorageBackend>> stripes, size_t block_size, size_t width)
+    : StorageBackend(-1, block_size)
+    , stripes(std::move(stripes))
+    , width(width)
+{ }
+
+void
+StripedStorage::read_batch(std::vector<ReadRequest> & batch)
+{
+    // split by file, in terms of the bids of each file
+    std::vector<std::vector<ReadRequest>> parts(stripes.size());
+    std::vector<std::vector<size_t>> origins(stripes.size());
+    for(size_t i = 0; i < batch.size(); ++i)
+    {
+        size_t s = stripe_of(batch[i].bid);
+        parts[s].push_back(ReadRequest{local_bid(batch[i].bid), batch[i].data, false});
+        origins[s].push_back(i);
+    }
+
+    auto read_part = [this, &parts](size_t s) {
+        try {
+            stripes[s]->read_batch(parts[s]);
+        } catch(std::exception const&) {
+            // the requests not marked done are reported as failed
+        }
+    };
+
+    // one thread per file but the last one, which is read from this thread
+    std::vector<std::thread> threads;
+    size_t last = stripes.size();
+    for(size_t s = 0; s < stripes.size(); ++s)
+    {
+        if(parts[s].empty())
+            continue;
+        if(last != stripes.size())
+            threads.emplace_back(read_part, last);
+        last = s;
+    }
+    if(last != stripes.size())
+        read_part(last);
+    for(auto & t : threads)
+        t.join();
+
+    for(size_t s = 0; s < stripes.size(); ++s)
+    {
+        for(size_t i = 0; i < parts[s].size(); ++i)
+            batch[origins[s][i]].done = parts[s][i].done;
+    }
+}
+
+void
+StripedStorage::advise(bid_t bid, size_t count, AccessAdvice advice)
+{
+    if(count == 0)
+    {
+        for(auto & stripe : stripes)
+            stripe->advise(0, 0, advice);
+        return;
+    }
+
+    // the blocks of a file within [bid, bid + count) are contiguous in that file,
+    // between the first and the last of them
+    size_t n = stripes.size();
+    bid_t end = bid + count;
+    size_t first_unit = bid / width;
+    size_t last_unit = (end - 1) / width;
+    for(size_t k = 0; k < n && first_unit + k <= last_unit; ++k)
+    {
+        size_t unit = first_unit + k;
+        size_t last = unit + (last_unit - unit) / n * n;
+        bid_t first_bid = std::max<bid_t>(bid, unit * width);
+        bid_t last_bid = std::min<bid_t>(end, (last + 1) * width) - 1;
+        bid_t local_first = local_bid(first_bid);
+        stripes[unit % n]->advise(local_first, local_bid(last_bid) - local_first + 1, advice);
+    }
+}
+
+void
+StripedStorage::sync(bool wait)
+{
+    for(auto & stripe : stripes)
+        stripe->sync(wait);
+}
+
+void
+StripedStorage::shrink_to(size_t block_count)
+{
+    // the first `block_count` blocks are whole rounds over the files, then a partial one
+    size_t n = stripes.size();
+    size_t rounds = block_count / (width * n);
+    size_t rest = block_count % (width * n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        size_t in_rest = std::min(width, rest - std::min(rest, i * width));
+        stripes[i]->shrink_to(rounds * width + in_rest);
+    }
+}
+
+} // namespace rtree
@@ -0,0 +1,285 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Storage backends of the block manager
+ *
+ * a backend moves whole blocks between memory and the data file.
+ *  MMAP    - the data file is memory mapped, the OS does the caching.
+ *            the mapping grows with the file without moving, optionally
+ *            aligned for and backed by 2 MB pages
+ *  SYSCALL - pread/pwrite through the page cache
+ *  DIRECT  - pread/pwrite with O_DIRECT, bypassing the page cache,
+ *            so the buffer pool of the block manager is the only cache
+ * any of them can be striped over several data files (StripedStorage)
+ * every backend is safe to use from multiple threads
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "async_reader.h"
+
+namespace rtree {
+
+enum class StorageKind
+{
+    DEFAULT, // let the block manager decide
+    MMAP,
+    SYSCALL,
+    DIRECT,
+};
+
+// how blocks are going to be accessed, see StorageBackend::advise
+enum class AccessAdvice
+{
+    NORMAL,
+    RANDOM,     // no readahead
+    SEQUENTIAL, // aggressive readahead
+    WILLNEED,   // read soon
+    DONTNEED,   // not read again soon, the cached pages may be dropped
+};
+
+/*
+ * How the blocks are spread over several data files
+ *
+ * the blocks go round robin to the files, `width` consecutive blocks at a time,
+ * so a file holds the blocks [0, width), [n * width, (n + 1) * width), ... of the first one.
+ * with the files on different devices, the reads of a tree are spread over all of them
+ */
+struct StripingParameters
+{
+    // the directory of each data file, which is named <directory>/<base name>.data.<i>
+    // empty for the single file <name>.data
+    std::vector<std::string> directories;
+    // in blocks
+    size_t width = 64;
+
+    size_t file_count(void) const { return directories.empty() ? 1 : directories.size(); }
+
+    // the path of the i-th data file of the block manager `name`
+    std::string file_name(std::string const& name, size_t i) const;
+};
+
+struct StorageBackend
+{
+    struct ReadRequest
+    {
+        bid_t bid;
+        char * data;
+        bool done;
+    };
+
+    // `huge_pages` only matters to MMAP
+    static std::unique_ptr<StorageBackend>
+    open(StorageKind kind, std::string const& file_name, size_t block_size, bool huge_pages = false);
+
+    // a StripedStorage over the data files of the block manager `name`, unless there is only one
+    static std::unique_ptr<StorageBackend>
+    open(StorageKind kind, std::string const& name, StripingParameters const& striping, size_t block_size, bool huge_pages = false);
+
+    StorageBackend(StorageBackend const&) = delete;
+    StorageBackend & operator = (StorageBackend const&) = delete;
+
+    virtual ~StorageBackend();
+
+    virtual StorageKind kind(void) const = 0;
+
+    virtual void read(bid_t bid, char * data) = 0;
+    virtual void write(bid_t bid, char const * data) = 0;
+
+    // read all the blocks of `batch` at once, `done` tells which ones succeeded
+    virtual void read_batch(std::vector<ReadRequest> & batch);
+
+    // the address of the block if the storage lives in memory, nullptr otherwise
+    virtual char const * address(bid_t /* bid */) const { return nullptr; }
+
+    /*
+     * hint how the blocks [bid, bid + count) are going to be accessed
+     * count == 0 for the whole file, in which case NORMAL, RANDOM and SEQUENTIAL
+     * also hold for the blocks appended later
+     */
+    virtual void advise(bid_t /* bid */, size_t /* count */, AccessAdvice /* advice */) { }
+
+    // hint that the block will be read soon
+    void will_need(bid_t bid) { advise(bid, 1, AccessAdvice::WILLNEED); }
+
+    // write back to the disk, waiting for completion if `wait` is true
+    virtual void sync(bool /* wait */) { }
+
+    // only the first `block_count` blocks are used, what the storage added after them may go
+    virtual void shrink_to(size_t /* block_count */) { }
+
+protected:
+    StorageBackend(int fd, size_t block_size);
+
+    int fd;
+    size_t block_size;
+};
+
+struct MmapStorage
+    : StorageBackend
+{
+    // the address space reserved for the mapping up front is `reserve_factor` times
+    // the size of the file, and at least `min_reserved_size`.
+    // when the file outgrows it, the reservation is extended in place, the mapping is never moved
+    static constexpr
+    size_t min_reserved_size = 1ULL << 30;
+    static constexpr
+    size_t reserve_factor = 4;
+
+    // the file is extended by a quarter of its size at a time, and at least this much
+    static constexpr
+    size_t min_growth = 1024 * 1024;
+
+    // the alignment of the mapping with `huge_pages`
+    static constexpr
+    size_t huge_page_size = 2 * 1024 * 1024;
+
+    /*
+     * with `huge_pages` the mapping is aligned to huge_page_size and the kernel is asked
+     * to back it with transparent huge pages (MADV_HUGEPAGE). whether it does for a file
+     * depends on the kernel and the file system (e.g. tmpfs with huge=, or CONFIG_READ_ONLY_THP_FOR_FS),
+     * otherwise it is only a hint that costs nothing
+     */
+    MmapStorage(int fd, size_t block_size, bool huge_pages = false);
+    ~MmapStorage();
+
+    StorageKind kind(void) const { return StorageKind::MMAP; }
+
+    void read(bid_t bid, char * data);
+    void write(bid_t bid, char const * data);
+    void read_batch(std::vector<ReadRequest> & batch);
+
+    char const * address(bid_t bid) const { return block_address(bid); }
+
+    void advise(bid_t bid, size_t count, AccessAdvice advice);
+    void sync(bool wait);
+
+    // truncate the padding left by grow()
+    void shrink_to(size_t block_count);
+
+private:
+    char * block_address(bid_t bid) const;
+
+    // make sure the file and the mapping cover the first `size` bytes
+    void grow(size_t size);
+
+    // make the reservation cover the first `size` bytes of the mapping, must hold `grow_lock`
+    void reserve(size_t size);
+
+    // apply MADV_HUGEPAGE to [begin, end) of the mapping
+    void advise_huge_pages(size_t begin, size_t end);
+
+    // `memory` is `reservation` aligned to huge_page_size if huge pages are used
+    char * reservation;
+    char * memory;
+    size_t reserved_size;
+    bool huge_pages;
+
+    // `mapped_size` is a multiple of the page size and never shrinks,
+    // `file_size` may be under it after shrink_to.
+    // blocks under `file_size` can be accessed without locking
+    std::atomic<size_t> file_size;
+    size_t mapped_size;
+    std::mutex grow_lock;
+
+    // the advice for the whole file, applied to the mapping as it grows
+    AccessAdvice file_advice = AccessAdvice::NORMAL;
+};
+
+struct SyscallStorage
+    : StorageBackend
+{
+    SyscallStorage(int fd, size_t block_size);
+
+    StorageKind kind(void) const { return StorageKind::SYSCALL; }
+
+    void read(bid_t bid, char * data);
+    void write(bid_t bid, char const * data);
+    void read_batch(std::vector<ReadRequest> & batch);
+
+    void advise(bid_t bid, size_t count, AccessAdvice advice);
+    void sync(bool wait);
+
+protected:
+    // created on the first batch
+    std::once_flag reader_init;
+    std::unique_ptr<AsyncReader> reader;
+};
+
+struct DirectStorage
+    : SyscallStorage
+{
+    // buffers, offsets and sizes must be aligned to this for O_DIRECT
+    static constexpr
+    size_t alignment = 4096;
+
+    DirectStorage(int fd, size_t block_size);
+
+    StorageKind kind(void) const { return StorageKind::DIRECT; }
+
+    // unaligned buffers go through a bounce buffer
+    void read(bid_t bid, char * data);
+    void write(bid_t bid, char const * data);
+    void read_batch(std::vector<ReadRequest> & batch);
+
+    // the page cache is not used
+    void advise(bid_t /* bid */, size_t /* count */, AccessAdvice /* advice */) { }
+};
+
+/*
+ * A backend over several data files, see StripingParameters
+ *
+ * every file has a backend of its own (of the same kind), so the reads of
+ * different threads landing on different files don't wait on each other,
+ * and a batch is split by file and read from all of them in parallel
+ */
+struct StripedStorage
+    : StorageBackend
+{
+    StripedStorage(std::vector<std::unique_ptr<StorageBackend>> stripes, size_t block_size, size_t width);
+
+    StorageKind kind(void) const { return stripes.front()->kind(); }
+
+    void read(bid_t bid, char * data) { stripes[stripe_of(bid)]->read(local_bid(bid), data); }
+    void write(bid_t bid, char const * data) { stripes[stripe_of(bid)]->write(local_bid(bid), data); }
+    void read_batch(std::vector<ReadRequest> & batch);
+
+    char const * address(bid_t bid) const { return stripes[stripe_of(bid)]->address(local_bid(bid)); }
+
+    void advise(bid_t bid, size_t count, AccessAdvice advice);
+    void sync(bool wait);
+    void shrink_to(size_t block_count);
+
+private:
+    size_t stripe_of(bid_t bid) const { return (bid / width) % stripes.size(); }
+    bid_t local_bid(bid_t bid) const { return bid / (width * stripes.size()) * width + bid % width; }
+
+    std::vector<std::unique_ptr<StorageBackend>> stripes;
+    size_t width;
+};
+
+} // namespace rtree
@@ -0,0 +1,163 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * aggregates of the values of a subtree, carried by its node_entry (an aR-tree)
+ *
+ * aggregate_fields<Value> chooses the fields of the values to aggregate, none by default.
+ * a specialization gives
+ *  count        - the number of fields
+ *  field(v, i)  - the field `i` of `v`, as a double
+ * the entries then have the sum, the sum of squares, the min and the max of every field
+ * over their subtree, so the aggregates over a range (see rtree::aggregate) only need
+ * the entries covered by it and the leaves on its border
+ *
+ * without fields, the aggregate of an entry takes no space in the blocks and files
+ */
+#pragma once
+
+#include <array>
+#include <limits>
+#include <iostream>
+
+#include "serialization/serializer.h"
+
+namespace rtree {
+
+template <typename Value>
+struct aggregate_fields
+{
+    static constexpr size_t count = 0;
+
+    static double field(Value const&, size_t) { return 0.0; }
+};
+
+template <size_t N>
+struct subtree_aggregate
+{
+    std::array<double, N> sum;
+    std::array<double, N> sum_of_squares;
+    std::array<double, N> min;
+    std::array<double, N> max;
+
+    subtree_aggregate() { clear(); }
+
+    void clear(void) {
+        sum.fill(0.0);
+        sum_of_squares.fill(0.0);
+        min.fill(std::numeric_limits<double>::infinity());
+        max.fill(-std::numeric_limits<double>::infinity());
+    }
+
+    template <typename Value>
+    void add_value(Value const& v) {
+        for(size_t i = 0; i < N; ++i)
+        {
+            double x = aggregate_fields<Value>::field(v, i);
+            sum[i] += x;
+            sum_of_squares[i] += x * x;
+            if(x < min[i]) min[i] = x;
+            if(x > max[i]) max[i] = x;
+        }
+    }
+
+    void add(subtree_aggregate const& a) {
+        for(size_t i = 0; i < N; ++i)
+        {
+            sum[i] += a.sum[i];
+            sum_of_squares[i] += a.sum_of_squares[i];
+            if(a.min[i] < min[i]) min[i] = a.min[i];
+            if(a.max[i] > max[i]) max[i] = a.max[i];
+        }
+    }
+
+    // need to be consistent with dump_to & load_from
+    static constexpr size_t serialization_size = 4 * N * sizeof(double);
+
+    void dump_to(std::ostream & out) const { out.write(reinterpret_cast<const char *>(this), serialization_size); }
+    void load_from(std::istream & in) { in.read(reinterpret_cast<char *>(this), serialization_size); }
+};
+
+// nothing to aggregate
+template <>
+struct subtree_aggregate<0>
+{
+    void clear(void) { }
+
+    template <typename Value>
+    void add_value(Value const&) { }
+
+    void add(subtree_aggregate const&) { }
+
+    static constexpr size_t serialization_size = 0;
+
+    void dump_to(std::ostream &) const { }
+    void load_from(std::istream &) { }
+};
+
+/*
+ * the aggregates over a query range
+ */
+template <size_t N>
+struct range_aggregate
+{
+    // the number of values in the range
+    size_t count = 0;
+    subtree_aggregate<N> fields;
+
+    template <typename Value>
+    void add_value(Value const& v) {
+        ++count;
+        fields.add_value(v);
+    }
+
+    void add(subtree_aggregate<N> const& a, size_t size) {
+        count += size;
+        fields.add(a);
+    }
+
+    double mean(size_t i) const { return fields.sum[i] / count; }
+    double variance(size_t i) const {
+        double m = mean(i);
+        return fields.sum_of_squares[i] / count - m * m;
+    }
+};
+
+} // namespace rtree
+
+template <size_t N>
+struct has_dump_load_method<rtree::subtree_aggregate<N>>
+{
+    static constexpr bool value = true;
+};
+
+// the serialized form is the memory image of the arrays
+template <size_t N>
+struct fixed_layout<rtree::subtree_aggregate<N>>
+    : fixed_memory_image<rtree::subtree_aggregate<N>>
+{
+    static_assert(sizeof(rtree::subtree_aggregate<N>) == rtree::subtree_aggregate<N>::serialization_size, "the arrays must be packed");
+};
+
+template <>
+struct fixed_layout<rtree::subtree_aggregate<0>>
+    : fixed_fields<rtree::subtree_aggregate<0>>
+{ };
@@ -0,0 +1,276 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * compile time layout of the serialized values
+ *
+ * serializer<T> goes through the stream for every field of every value.
+ * when each field of the serialized form sits at a fixed offset,
+ * fixed_layout<T> describes it and the values are encoded with memcpy
+ * at offsets known at compile time, arrays as a whole:
+ *  value           - whether T has a fixed layout, the rest is only there if it does
+ *  size            - bytes taken by a value, the same as serializer<T>::size
+ *  is_memory_image - the serialized form is the bytes of T in memory, an array is a single memcpy
+ *  encode(out, v) / decode(in, v)
+ *
+ * the types without dump_to / load_from are dumped as their memory image and have it for free,
+ * the others opt in by specializing fixed_layout with fixed_fields or fixed_memory_image
+ *
+ * included by serializer.h, include that one
+ */
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <iostream>
+
+template <typename T, typename Enable = void>
+struct fixed_layout
+{
+    static constexpr bool value = false;
+};
+
+// the serialized form is the memory image of T
+template <typename T>
+struct fixed_memory_image
+{
+    static_assert(std::is_trivially_copyable<T>::value, "only the trivially copyable types can be copied as they are");
+
+    static constexpr bool value = true;
+    static constexpr bool is_memory_image = true;
+    static constexpr size_t size = sizeof(T);
+
+    static void encode(char * out, T const& v) { std::memcpy(out, &v, size); }
+    static void decode(char const * in, T & v) { std::memcpy(&v, in, size); }
+};
+
+template <typename T>
+struct fixed_layout<T, typename std::enable_if<
+        !has_dump_load_method<T>::value && std::is_trivially_copyable<T>::value>::type>
+    : fixed_memory_image<T>
+{ };
+
+/*
+ * a field of T, written as fixed_layout<M>, see FIXED_FIELD
+ */
+template <typename T, typename M, M T::* Member>
+struct fixed_field
+{
+    using layout = fixed_layout<M>;
+
+    static M const& get(T const& v) { return v.*Member; }
+    static M & get(T & v) { return v.*Member; }
+};
+
+#define FIXED_FIELD(T, member) fixed_field<T, decltype(T::member), &T::member>
+
+/*
+ * the fields of T one after the other, in the order of dump_to
+ * the offset of each field is the sum of the sizes of the fields before it
+ */
+template <typename T, typename... Fields>
+struct fixed_fields;
+
+template <typename T>
+struct fixed_fields<T>
+{
+    static constexpr bool value = true;
+    static constexpr bool is_memory_image = false;
+    static constexpr size_t size = 0;
+
+    static void encode(char * /* out */, T const& /* v */) { }
+    static void decode(char const * /* in */, T & /* v */) { }
+};
+
+template <typename T, typename Field, typename... Fields>
+struct fixed_fields<T, Field, Fields...>
+{
+    using rest = fixed_fields<T, Fields...>;
+
+    static_assert(Field::layout::value, "every field must have a fixed layout");
+
+    static constexpr bool value = true;
+    static constexpr bool is_memory_image = false;
+    static constexpr size_t size = Field::layout::size + rest::size;
+
+    static void encode(char * out, T const& v) {
+        Field::layout::encode(out, Field::get(v));
+        rest::encode(out + Field::layout::size, v);
+    }
+
+    static void decode(char const * in, T & v) {
+        Field::layout::decode(in, Field::get(v));
+        rest::decode(in + Field::layout::size, v);
+    }
+};
+
+template <typename SizeType>
+void check_array_size(size_t size)
+{
+    if(size > std::numeric_limits<SizeType>::max())
+        throw std::runtime_error("dump_array: " + std::to_string(size) + " values do not fit in the size header of the array");
+}
+
+/*
+ * arrays of values with a fixed layout, in contiguous memory
+ */
+template <typename T>
+void encode_fixed(char * out, T const * first, size_t count)
+{
+    using layout = fixed_layout<T>;
+    if(layout::is_memory_image)
+        std::memcpy(out, first, count * layout::size);
+    else
+    {
+        for(size_t i = 0; i < count; ++i, out += layout::size)
+            layout::encode(out, first[i]);
+    }
+}
+
+template <typename T>
+void decode_fixed(char const * in, T * first, size_t count)
+{
+    using layout = fixed_layout<T>;
+    if(layout::is_memory_image)
+        std::memcpy(first, in, count * layout::size);
+    else
+    {
+        for(size_t i = 0; i < count; ++i, in += layout::size)
+            layout::decode(in, first[i]);
+    }
+}
+
+// whether the values of ArrayType have a fixed layout and are contiguous (have data())
+template <typename ArrayType>
+struct has_fixed_array_layout
+{
+private:
+    template <typename A>
+    static auto check(A * a) -> decltype(a->data(), std::true_type());
+    template <typename A>
+    static std::false_type check(...);
+
+public:
+    static constexpr bool value = 
+        decltype(check<ArrayType>(nullptr))::value &&
+        fixed_layout<typename ArrayType::value_type>::value;
+};
+
+/*
+ * the values of an array, the way dump_array / load_array write them after the size
+ * one value at a time through the stream in general,
+ * at once when they have a fixed layout
+ */
+template <typename ArrayType, bool = has_fixed_array_layout<ArrayType>::value>
+struct array_serializer
+{
+    static void dump(std::ostream & out, ArrayType const& at) {
+        for(auto const& v : at)
+            dump_value(out, v);
+    }
+
+    static void load(std::istream & in, ArrayType & at) {
+        for(auto & v : at)
+            load_value(in, v);
+    }
+};
+
+template <typename ArrayType>
+struct array_serializer<ArrayType, true>
+{
+    using value_type = typename ArrayType::value_type;
+    using layout = fixed_layout<value_type>;
+
+    static void dump(std::ostream & out, ArrayType const& at) {
+        if(layout::is_memory_image)
+        {
+            out.write(reinterpret_cast<char const *>(at.data()), at.size() * layout::size);
+            return;
+        }
+        std::vector<char> & buffer = get_buffer(at.size());
+        encode_fixed(buffer.data(), at.data(), at.size());
+        out.write(buffer.data(), at.size() * layout::size);
+    }
+
+    static void load(std::istream & in, ArrayType & at) {
+        if(layout::is_memory_image)
+        {
+            in.read(reinterpret_cast<char *>(at.data()), at.size() * layout::size);
+            return;
+        }
+        std::vector<char> & buffer = get_buffer(at.size());
+        in.read(buffer.data(), at.size() * layout::size);
+        decode_fixed(buffer.data(), at.data(), at.size());
+    }
+
+private:
+    static std::vector<char> & get_buffer(size_t count) {
+        static thread_local std::vector<char> buffer;
+        if(buffer.size() < count * layout::size)
+            buffer.resize(count * layout::size);
+        return buffer;
+    }
+};
+
+/*
+ * dump_array / load_array straight to / from memory, without a stream
+ * the bytes are the same as through the stream. the values must have a fixed layout.
+ * the end of what was written / read is returned,
+ * std::runtime_error is thrown if it is past `end`
+ */
+template <typename SizeType = uint16_t, typename ArrayType>
+char * dump_fixed_array(char * out, char const * end, ArrayType const& at)
+{
+    static_assert(has_fixed_array_layout<ArrayType>::value, "the values must have a fixed layout");
+    using layout = fixed_layout<typename ArrayType::value_type>;
+
+    check_array_size<SizeType>(at.size());
+    SizeType count = at.size();
+    if((size_t)(end - out) < sizeof(count) + (size_t)count * layout::size)
+        throw std::runtime_error("dump_fixed_array: the array does not fit");
+    std::memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+    encode_fixed(out, at.data(), count);
+    return out + count * layout::size;
+}
+
+template <typename SizeType = uint16_t, typename ArrayType>
+char const * load_fixed_array(char const * in, char const * end, ArrayType & at)
+{
+    static_assert(has_fixed_array_layout<ArrayType>::value, "the values must have a fixed layout");
+    using layout = fixed_layout<typename ArrayType::value_type>;
+
+    SizeType count;
+    if(in + sizeof(count) > end)
+        throw std::runtime_error("load_fixed_array: truncated array");
+    std::memcpy(&count, in, sizeof(count));
+    in += sizeof(count);
+    if((size_t)(end - in) < (size_t)count * layout::size)
+        throw std::runtime_error("load_fixed_array: truncated array");
+    at.resize(count);
+    decode_fixed(in, at.data(), count);
+    return in + count * layout::size;
+}
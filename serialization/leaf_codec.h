@@ -0,0 +1,210 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * compact encoding of sorted runs of values (the content of the io leaf nodes)
+ *
+ * each value is encoded against the previous one, values next to each other
+ * in Hilbert order are close, so what changes between them is small:
+ *  - floats are xored with the previous value, sharing the sign, the exponent
+ *    and the high bits of the mantissa the result is a small integer
+ *  - integers are stored as the zigzag encoded difference
+ *  - both are then written as varints
+ *  - byte strings (ObjectIDs) only store what follows the prefix shared with the previous value
+ * the first value of a run is encoded against leaf_codec<T>::origin()
+ *
+ * leaf_codec<T> falls back to serializer<T> for the types without a specialization
+ */
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <iterator>
+
+#include "serialization/serializer.h"
+
+template <typename T>
+struct leaf_codec
+{
+    // false if the values are stored as they are
+    static constexpr bool compressing = false;
+
+    static T origin(void) { return T(); }
+
+    // the number of bytes taken by `cur` following `prev`
+    static size_t size(T const& prev, T const& cur) { return serializer<T>::size; }
+
+    static void encode(std::ostream & out, T const& prev, T const& cur) { dump_value(out, cur); }
+    static void decode(std::istream & in, T const& prev, T & cur) { load_value(in, cur); }
+};
+
+/*
+ * building blocks of the specializations
+ */
+namespace leaf_coding {
+
+inline uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+inline size_t varint_size(uint64_t v)
+{
+    size_t s = 1;
+    while(v >= 0x80)
+    {
+        v >>= 7;
+        ++s;
+    }
+    return s;
+}
+
+inline uint32_t float_bits(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+inline float bits_float(uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+// integers
+inline size_t delta_size(int64_t prev, int64_t cur) { return varint_size(zigzag(cur - prev)); }
+inline void dump_delta(std::ostream & out, int64_t prev, int64_t cur) { dump_varint(out, zigzag(cur - prev)); }
+inline void load_delta(std::istream & in, int64_t prev, int64_t & cur)
+{
+    uint64_t v;
+    load_varint(in, v);
+    cur = prev + unzigzag(v);
+}
+
+// floats
+inline size_t xor_size(float prev, float cur) { return varint_size(float_bits(prev) ^ float_bits(cur)); }
+inline void dump_xor(std::ostream & out, float prev, float cur) { dump_varint(out, float_bits(prev) ^ float_bits(cur)); }
+inline void load_xor(std::istream & in, float prev, float & cur)
+{
+    uint64_t v;
+    load_varint(in, v);
+    cur = bits_float(float_bits(prev) ^ (uint32_t)v);
+}
+
+// byte strings: the length of the shared prefix then the rest
+template <size_t N>
+size_t shared_prefix(std::array<unsigned char, N> const& prev, std::array<unsigned char, N> const& cur)
+{
+    size_t p = 0;
+    while(p < N && prev[p] == cur[p])
+        ++p;
+    return p;
+}
+
+template <size_t N>
+size_t prefixed_size(std::array<unsigned char, N> const& prev, std::array<unsigned char, N> const& cur)
+{
+    return 1 + N - shared_prefix(prev, cur);
+}
+
+template <size_t N>
+void dump_prefixed(std::ostream & out, std::array<unsigned char, N> const& prev, std::array<unsigned char, N> const& cur)
+{
+    size_t p = shared_prefix(prev, cur);
+    out.put((char)p);
+    out.write(reinterpret_cast<const char *>(cur.data() + p), N - p);
+}
+
+template <size_t N>
+void load_prefixed(std::istream & in, std::array<unsigned char, N> const& prev, std::array<unsigned char, N> & cur)
+{
+    char c;
+    in.get(c);
+    size_t p = (unsigned char)c;
+    if(p > N)
+    {
+        in.setstate(std::ios::failbit);
+        return;
+    }
+    std::copy(prev.begin(), prev.begin() + p, cur.begin());
+    in.read(reinterpret_cast<char *>(cur.data() + p), N - p);
+}
+
+} // namespace leaf_coding
+
+/*
+ * the encoded size of a run of values, as values are appended
+ */
+template <typename T>
+struct leaf_size_counter
+{
+    size_t size(void) const { return bytes; }
+
+    // the size if `v` was appended
+    size_t size_with(T const& v) const { return bytes + leaf_codec<T>::size(last, v); }
+
+    void append(T const& v) {
+        bytes += leaf_codec<T>::size(last, v);
+        last = v;
+    }
+
+private:
+    size_t bytes = 0;
+    T last = leaf_codec<T>::origin();
+};
+
+template <typename Iterator>
+size_t encoded_size(Iterator first, Iterator last)
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+    leaf_size_counter<value_type> counter;
+    for(; first != last; ++first)
+        counter.append(*first);
+    return counter.size();
+}
+
+template <typename Iterator>
+void encode_values(std::ostream & out, Iterator first, Iterator last)
+{
+    using value_type = typename std::iterator_traits<Iterator>::value_type;
+    value_type const origin = leaf_codec<value_type>::origin();
+    value_type const * prev = &origin;
+    for(; first != last; ++first)
+    {
+        leaf_codec<value_type>::encode(out, *prev, *first);
+        prev = &*first;
+    }
+}
+
+// `at` must already have the number of values to decode
+template <typename ArrayType>
+void decode_values(std::istream & in, ArrayType & at)
+{
+    using value_type = typename ArrayType::value_type;
+    value_type const origin = leaf_codec<value_type>::origin();
+    value_type const * prev = &origin;
+    for(auto & v : at)
+    {
+        leaf_codec<value_type>::decode(in, *prev, v);
+        prev = &v;
+    }
+}
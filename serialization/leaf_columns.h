@@ -0,0 +1,95 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * columnar layout of the values of a leaf (structure of arrays)
+ *
+ * the rows of a leaf are split in columns stored one after the other in the block:
+ * every first coordinate, then every second coordinate, ... then every id.
+ * a box test then scans three contiguous arrays (see rtree/column_filter.h)
+ * and only the rows that pass it are put back together into values
+ *
+ * leaf_columns<T>::columnar is false for the types without a specialization,
+ * their leaves keep the row layout
+ */
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+template <typename T>
+struct leaf_columns
+{
+    // false if the values can't be stored in columns
+    static constexpr bool columnar = false;
+};
+
+/*
+ * the layout shared by the values of this repo:
+ * two float coordinates, an integer one (a timestamp) and an opaque id of IdSize bytes
+ *
+ * Access is the specialization of leaf_columns, providing
+ *   static void split(T const& v, float & c0, float & c1, int32_t & c2, unsigned char * id);
+ *   static void join(T & v, float c0, float c1, int32_t c2, unsigned char const * id);
+ */
+template <typename T, typename Access, size_t IdSize>
+struct point_id_columns
+{
+    using value_type = T;
+
+    static constexpr bool columnar = true;
+
+    static constexpr
+    size_t row_size = 2 * sizeof(float) + sizeof(int32_t) + IdSize;
+
+    // the columns of `n` rows starting at `in`
+    struct columns
+    {
+        float const * c0;
+        float const * c1;
+        int32_t const * c2;
+        unsigned char const * id;
+    };
+
+    static columns view(char const * in, size_t n) {
+        columns c;
+        c.c0 = reinterpret_cast<float const *>(in);
+        c.c1 = reinterpret_cast<float const *>(in + n * sizeof(float));
+        c.c2 = reinterpret_cast<int32_t const *>(in + 2 * n * sizeof(float));
+        c.id = reinterpret_cast<unsigned char const *>(in + 2 * n * sizeof(float) + n * sizeof(int32_t));
+        return c;
+    }
+
+    // writes the `n` values in n * row_size bytes at `out`
+    static void store(T const * values, size_t n, char * out) {
+        float * c0 = reinterpret_cast<float *>(out);
+        float * c1 = reinterpret_cast<float *>(out + n * sizeof(float));
+        int32_t * c2 = reinterpret_cast<int32_t *>(out + 2 * n * sizeof(float));
+        unsigned char * id = reinterpret_cast<unsigned char *>(out + 2 * n * sizeof(float) + n * sizeof(int32_t));
+        for(size_t i = 0; i < n; ++i)
+            Access::split(values[i], c0[i], c1[i], c2[i], id + i * IdSize);
+    }
+
+    static void load(columns const& c, size_t row, T & v) {
+        Access::join(v, c.c0[row], c.c1[row], c.c2[row], c.id + row * IdSize);
+    }
+};
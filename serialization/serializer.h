@@ -51,23 +51,53 @@ void load_value(std::istream & in, T & t)
     serializer<T>::load(in, t);
 }
 
-template <typename ArrayType>
+// needs has_dump_load_method and dump_value / load_value
+#include "serialization/fixed_layout.h"
+
+/*
+ * arrays are prefixed by their size as a SizeType, uint16_t in the original format
+ * std::runtime_error is thrown if there are too many values for it
+ */
+template <typename SizeType = uint16_t, typename ArrayType>
 void dump_array(std::ostream & out, ArrayType const& at)
 {
-    dump_value(out, (uint16_t)at.size());
-    for(auto const& v : at)
-        dump_value(out, v);
+    check_array_size<SizeType>(at.size());
+    dump_value(out, (SizeType)at.size());
+    array_serializer<ArrayType>::dump(out, at);
 }
 
-template <typename ArrayType>
+template <typename SizeType = uint16_t, typename ArrayType>
 void load_array(std::istream & in, ArrayType & at)
 {
-    uint16_t s;
+    SizeType s;
     load_value(in, s);
     at.resize(s);
-    int id = 0;
-    for (auto & v : at) {
-        load_value(in, v);
-        id++;
+    array_serializer<ArrayType>::load(in, at);
+}
+
+// variable length integers (LEB128), small values take less space
+inline void dump_varint(std::ostream & out, uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        out.put((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.put((char)v);
+}
+
+inline void load_varint(std::istream & in, uint64_t & v)
+{
+    v = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        char c;
+        in.get(c);
+        if(!in)
+            return;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if(!(c & 0x80))
+            return;
     }
+    in.setstate(std::ios::failbit);
 }
@@ -102,7 +102,13 @@ RStree_basic::RStree_basic(std::string input_file, time_t construction_time)
     LOG(INFO) << "Opening RStree_basic from file";
     std::string memnodes_file = input_file + ".memnodes";
     if (fexists(memnodes_file.c_str())) {
+        // the snapshot is mapped, the older formats are read node by node
+        bool outdated = basic_rtree::mem_nodes_outdated(input_file);
         mp_data.reset(new basic_rtree(input_file, false, true));
+        if (outdated) {
+            LOG(INFO) << "Rewriting the memnodes file as a snapshot";
+            mp_data->save_mem_nodes();
+        }
     }
     else {
         LOG(INFO) << "Memnodes file not found.  Rebuilding memnodes";
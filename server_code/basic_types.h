@@ -33,6 +33,8 @@ SOFTWARE.
 
 #include "../serialization/default_serializers.h"
 #include "../serialization/serializer.h"
+#include "../serialization/leaf_codec.h"
+#include "../serialization/leaf_columns.h"
 
 #include "../mongo_types.h"
 
@@ -230,3 +232,70 @@ struct has_dump_load_method<server_types::basic_entry>
 {
     static constexpr bool value = true;
 };
+
+template <>
+struct fixed_layout<server_types::basic_entry>
+    : fixed_fields<server_types::basic_entry,
+        FIXED_FIELD(server_types::basic_entry, loc),
+        FIXED_FIELD(server_types::basic_entry, timestamp),
+        FIXED_FIELD(server_types::basic_entry, oid)>
+{
+    static_assert(fixed_fields::size == server_types::basic_entry::serialization_size, "must be the layout of dump_to");
+};
+
+template <>
+struct leaf_codec<server_types::basic_entry>
+{
+    using value_type = server_types::basic_entry;
+
+    static constexpr bool compressing = true;
+
+    static value_type origin(void) {
+        value_type v;
+        std::memset(&v, 0, sizeof(v));
+        return v;
+    }
+
+    static size_t size(value_type const& prev, value_type const& cur) {
+        return leaf_coding::xor_size(prev.loc.lat, cur.loc.lat)
+            + leaf_coding::xor_size(prev.loc.lon, cur.loc.lon)
+            + leaf_coding::delta_size(prev.timestamp, cur.timestamp)
+            + leaf_coding::prefixed_size(prev.oid.id, cur.oid.id);
+    }
+
+    static void encode(std::ostream & out, value_type const& prev, value_type const& cur) {
+        leaf_coding::dump_xor(out, prev.loc.lat, cur.loc.lat);
+        leaf_coding::dump_xor(out, prev.loc.lon, cur.loc.lon);
+        leaf_coding::dump_delta(out, prev.timestamp, cur.timestamp);
+        leaf_coding::dump_prefixed(out, prev.oid.id, cur.oid.id);
+    }
+
+    static void decode(std::istream & in, value_type const& prev, value_type & cur) {
+        int64_t timestamp;
+        leaf_coding::load_xor(in, prev.loc.lat, cur.loc.lat);
+        leaf_coding::load_xor(in, prev.loc.lon, cur.loc.lon);
+        leaf_coding::load_delta(in, prev.timestamp, timestamp);
+        cur.timestamp = (int)timestamp;
+        leaf_coding::load_prefixed(in, prev.oid.id, cur.oid.id);
+    }
+};
+
+// lat, lon, timestamp and oid in columns
+template <>
+struct leaf_columns<server_types::basic_entry>
+    : point_id_columns<server_types::basic_entry, leaf_columns<server_types::basic_entry>, server_types::OID::oid_len>
+{
+    static void split(value_type const& v, float & c0, float & c1, int32_t & c2, unsigned char * id) {
+        c0 = v.loc.lat;
+        c1 = v.loc.lon;
+        c2 = v.timestamp;
+        std::memcpy(id, v.oid.id.data(), v.oid.id.size());
+    }
+
+    static void join(value_type & v, float c0, float c1, int32_t c2, unsigned char const * id) {
+        v.loc.lat = c0;
+        v.loc.lon = c1;
+        v.timestamp = c2;
+        std::memcpy(v.oid.id.data(), id, v.oid.id.size());
+    }
+};
@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <time.h>
+#include <cstdlib>
 #include <memory>
 #include <vector>
 
@@ -29,6 +30,9 @@ SOFTWARE.
 
 #include "server_code/protobuf/sampling_api.pb.h"
 
+// the standard deviation of the count estimated on StartQuery, relative to the count
+static const double start_count_error = 0.01;
+
 
 query_cursor_basic::query_cursor_basic(std::shared_ptr<basic_rtree> source
                                      , const serverProto::box& query_region
@@ -52,11 +56,11 @@ query_cursor_basic::query_cursor_basic(std::shared_ptr<basic_rtree> source
 
     // setup query cursor
 
-    // count the number of elements in the region (or estimate count if that is the only thing available to us)
-    // we would like to get an exact count.  We don't have good guarantees for approximate counts
-    m_elements_in_range = source->naive_sample_query(get_query_box3d()).get_count();
+    // estimate the number of elements in the region, from the samples of the nodes on its border
+    // it is made exact later if that is needed (see refine_count)
+    m_elements_in_range = source->count(get_query_box3d(), rtree::CountMode::bounded_error(start_count_error), &m_count_sd);
 
-    LOG(INFO) << "for new query, we think there are " << m_elements_in_range << " elements in the range";
+    LOG(INFO) << "for new query, we think there are " << m_elements_in_range << " elements in the range (sd " << m_count_sd << ")";
 
     // setup accumulators and accumulator list
     // accumulators are already setup?
@@ -111,6 +115,14 @@ long query_cursor_basic::get_elements_analyzed_count()
     return m_elements_analyzed;
 }
 
+void query_cursor_basic::refine_count()
+{
+    if (m_count_sd == 0)
+        return;
+    m_elements_in_range = m_source->count(get_query_box3d());
+    m_count_sd = 0;
+}
+
 serverProto::box query_cursor_basic::get_query_region()
 {
     return m_queryRegion;
@@ -177,6 +189,11 @@ void query_cursor_basic::perform_query(int count, serverProto::QueryResponse& to
 
     toReturn.Clear();
 
+    // the estimated count decides between reporting the whole range and sampling it,
+    // make it exact when it is too close to tell
+    if (std::abs(this->m_elements_in_range - count) <= 3 * m_count_sd)
+        refine_count();
+
     // query the data structure, filling the accumulators with the new data
     // as we are filling the accumulators, also fill the QueryResponse.
     // NOTE: if needed, we don't have to do it this way.  We can implemented
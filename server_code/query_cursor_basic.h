@@ -93,6 +93,9 @@ private:
 
     void get_stats(const StreamingStatistics_t& stats, serverProto::ElementStatistics& toRet) const;
 
+    // count the elements in range exactly, if they were estimated
+    void refine_count();
+
     serverProto::box m_queryRegion;
 
     const bool m_returning_OID;
@@ -100,6 +103,8 @@ private:
     const bool m_returning_time;
 
     long m_elements_in_range;
+    // the standard deviation of m_elements_in_range, 0 when it is exact
+    double m_count_sd;
     long m_elements_analyzed;
 
     int m_ttl;
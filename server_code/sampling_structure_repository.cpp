@@ -365,7 +365,7 @@ void sampling_structure_repository::init_from_protobuf(const ServerState::Sampli
     for (int i = 0; i < state.data_size(); ++i)
     {
         struct stat buf;
-        std::string filename_wextention = state.data(i).filename() + ".data";
+        std::string filename_wextention = state.data(i).filename() + ".metadata"; // there is one whatever the striping
         if (stat(filename_wextention.c_str(), &buf) == -1)
         {
             LOG(WARNING) << "Unable to open previous sampling file " << filename_wextention << " because it can not be found";
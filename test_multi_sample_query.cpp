@@ -0,0 +1,167 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Test of the batched sample queries (multi_sample_query)
+ *
+ * a batch of overlapping queries is sampled in one traversal. every query must
+ * get its samples, all of them values within its range, and the batch must not
+ * cost more I/O than the queries sampled one after the other.
+ * the same batch is then run again, for more samples of every query
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <set>
+#include <cstdio>
+
+#include "rtree/rtree.h"
+#include "mongo_types.h"
+
+namespace bg = boost::geometry;
+
+using entry = mongo_types::entry;
+using sample_entry = mongo_types::sample_entry;
+using box = mongo_types::box3d;
+using point = mongo_types::point3d;
+using rtree_t = rtree::rtree<entry, sample_entry>;
+using cursor_t = rtree::sample_query_cursor<box, rtree_t::box_type, rtree_t::key_type, entry, sample_entry>;
+using batch_t = rtree::multi_sample_query<box, rtree_t::box_type, rtree_t::key_type, entry, sample_entry>;
+
+constexpr size_t VALUE_COUNT = 200000;
+constexpr size_t QUERY_COUNT = 8;
+
+std::string oid_key(mongo_types::OID const& oid)
+{
+    return std::string((char const*)oid.id.data(), oid.id.size());
+}
+
+// the number of samples that are not values within `query`
+template <typename Samples>
+size_t count_out_of_range(Samples const& samples, box const& query, std::set<std::string> const& in_range)
+{
+    size_t out = 0;
+    for(auto const& s : samples)
+    {
+        if(!bg::covered_by(s.get_point(), query) || in_range.count(oid_key(s.oid)) == 0)
+            ++out;
+    }
+    return out;
+}
+
+// take `sample_size` samples of every cursor, false if any is missing or out of range
+bool check_samples(std::vector<cursor_t> & cursors, size_t sample_size, std::vector<box> const& queries,
+        std::vector<std::set<std::string>> const& in_range)
+{
+    bool ok = true;
+    for(size_t q = 0; q < cursors.size(); ++q)
+    {
+        std::vector<sample_entry> samples;
+        cursors[q].get_samples(sample_size, std::back_inserter(samples));
+        size_t out = count_out_of_range(samples, queries[q], in_range[q]);
+        if(samples.size() != sample_size || out > 0)
+        {
+            std::cout << "  query " << q << ": " << samples.size() << " samples, " << out << " out of range" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    std::uniform_int_distribution<int> timestamp(0, 1000000);
+
+    std::vector<entry> entries;
+    for(size_t i = 0; i < VALUE_COUNT; ++i)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", i);
+        entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+    }
+
+    std::string filename = "test_multi_sample_query.tree";
+    rtree_t::build_io_layers(entries.begin(), entries.end(), filename);
+    rtree_t tree(filename);
+    auto & block_manager = tree.get_block_manager();
+
+    std::vector<box> queries;
+    std::vector<std::set<std::string>> in_range(QUERY_COUNT);
+    for(size_t q = 0; q < QUERY_COUNT; ++q)
+    {
+        float shift = q;
+        queries.push_back(box(point(-30 + 3 * shift, -60 + 5 * shift, 0), point(20 + 3 * shift, 40 + 5 * shift, 800000)));
+        for(auto const& e : entries)
+        {
+            if(bg::covered_by(e.get_point(), queries[q]))
+                in_range[q].insert(oid_key(e.oid));
+        }
+    }
+
+    bool ok = true;
+    for(size_t sample_size : {200, 5000})
+    {
+        std::vector<size_t> sample_sizes(QUERY_COUNT, sample_size);
+
+        size_t individual_cost = 0;
+        for(auto const& query : queries)
+        {
+            block_manager.flush_cache();
+            block_manager.reset_stats();
+            auto cursor = tree.sample_query(query);
+            std::vector<sample_entry> samples;
+            cursor.get_samples(sample_size, std::back_inserter(samples));
+            individual_cost += block_manager.get_stats().cost();
+        }
+
+        block_manager.flush_cache();
+        block_manager.reset_stats();
+        size_t batch_cost = 0;
+        auto cursors = tree.multi_sample_query(queries, sample_sizes, &batch_cost);
+
+        std::cout << sample_size << " samples per query: I/O cost " << batch_cost
+            << " for the batch, " << individual_cost << " for the queries one by one" << std::endl;
+
+        if(batch_cost > individual_cost)
+            ok = false;
+        if(!check_samples(cursors, sample_size, queries, in_range))
+            ok = false;
+    }
+
+    // a batch run twice fills the buffers again
+    std::vector<cursor_t> cursors;
+    for(auto const& query : queries)
+        cursors.push_back(tree.sample_query(query));
+    batch_t batch(cursors, block_manager);
+    for(size_t sample_size : {1000, 3000})
+    {
+        batch.run(std::vector<size_t>(QUERY_COUNT, sample_size));
+        std::cout << "run for " << sample_size << " samples per query" << std::endl;
+        if(!check_samples(cursors, sample_size, queries, in_range))
+            ok = false;
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Test of the sample queries drawn in parallel (sample_query_cursor::set_parallel)
+ *
+ * the tree is built from random entries, and the samples of a few queries are
+ * drawn by the calling thread and with OpenMP tasks. both must return as many
+ * samples as asked, all of them values within the query range
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <set>
+#include <cstdio>
+
+#include "rtree/rtree.h"
+#include "mongo_types.h"
+
+namespace bg = boost::geometry;
+
+using entry = mongo_types::entry;
+using sample_entry = mongo_types::sample_entry;
+using box = mongo_types::box3d;
+using point = mongo_types::point3d;
+using rtree_t = rtree::rtree<entry, sample_entry>;
+
+constexpr size_t VALUE_COUNT = 200000;
+constexpr size_t SAMPLE_SIZE = 50000;
+
+std::string oid_key(mongo_types::OID const& oid)
+{
+    return std::string((char const*)oid.id.data(), oid.id.size());
+}
+
+// the number of samples that are not values within `query`
+template <typename Samples>
+size_t count_out_of_range(Samples const& samples, box const& query, std::set<std::string> const& in_range)
+{
+    size_t out = 0;
+    for(auto const& s : samples)
+    {
+        if(!bg::covered_by(s.get_point(), query) || in_range.count(oid_key(s.oid)) == 0)
+            ++out;
+    }
+    return out;
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    std::uniform_int_distribution<int> timestamp(0, 1000000);
+
+    std::vector<entry> entries;
+    for(size_t i = 0; i < VALUE_COUNT; ++i)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", i);
+        entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+    }
+
+    std::string filename = "test_parallel_sampling.tree";
+    rtree_t::build_io_layers(entries.begin(), entries.end(), filename);
+    rtree_t tree(filename);
+
+    std::vector<box> queries = {
+        box(point(-70, -160, 0), point(70, 160, 1000000)),
+        box(point(-20, -40, 0), point(30, 60, 600000)),
+        box(point(-5, -5, 0), point(5, 5, 1000000)),
+    };
+
+    bool ok = true;
+    for(auto const& query : queries)
+    {
+        std::set<std::string> in_range;
+        for(auto const& e : entries)
+        {
+            if(bg::covered_by(e.get_point(), query))
+                in_range.insert(oid_key(e.oid));
+        }
+
+        auto serial_cursor = tree.sample_query(query);
+        std::vector<sample_entry> serial;
+        serial_cursor.get_samples(SAMPLE_SIZE, std::back_inserter(serial));
+
+        auto parallel_cursor = tree.sample_query(query);
+        parallel_cursor.set_parallel(1024);
+        std::vector<sample_entry> parallel;
+        parallel_cursor.get_samples(SAMPLE_SIZE, std::back_inserter(parallel));
+        // a second call starts from the frontier the tasks left
+        parallel_cursor.get_samples(SAMPLE_SIZE, std::back_inserter(parallel));
+        serial_cursor.get_samples(SAMPLE_SIZE, std::back_inserter(serial));
+
+        size_t serial_out = count_out_of_range(serial, query, in_range);
+        size_t parallel_out = count_out_of_range(parallel, query, in_range);
+
+        std::cout << in_range.size() << " values in range: "
+            << "serial " << serial.size() << " samples (" << serial_out << " out of range), "
+            << "parallel " << parallel.size() << " samples (" << parallel_out << " out of range)" << std::endl;
+
+        if(serial.size() != 2 * SAMPLE_SIZE || parallel.size() != serial.size() || serial_out > 0 || parallel_out > 0)
+            ok = false;
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
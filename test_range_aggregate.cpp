@@ -0,0 +1,157 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Test of the range aggregates (rtree::aggregate)
+ *
+ * the entries aggregate their latitude, longitude and timestamp, and the
+ * aggregates of random queries are checked against those of a scan of the
+ * values: once the tree is built, with the nodes in memory, and after inserts
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdio>
+
+#include "rtree/subtree_aggregate.h"
+#include "mongo_types.h"
+
+namespace rtree {
+
+template <>
+struct aggregate_fields<mongo_types::entry>
+{
+    static constexpr size_t count = 3;
+
+    static double field(mongo_types::entry const& v, size_t i) {
+        return i == 0 ? v.loc.get<0>() : i == 1 ? v.loc.get<1>() : (double)v.timestamp;
+    }
+};
+
+} // namespace rtree
+
+#include "rtree/rtree.h"
+
+namespace bg = boost::geometry;
+
+using entry = mongo_types::entry;
+using sample_entry = mongo_types::sample_entry;
+using box = mongo_types::box3d;
+using point = mongo_types::point3d;
+using rtree_t = rtree::rtree<entry, sample_entry>;
+using aggregate_t = rtree::range_aggregate<3>;
+
+constexpr size_t VALUE_COUNT = 200000;
+constexpr size_t QUERY_COUNT = 20;
+
+entry random_entry(std::default_random_engine & rng, size_t id)
+{
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    std::uniform_int_distribution<int> timestamp(0, 1000000);
+    char oid[25];
+    snprintf(oid, sizeof(oid), "%024zx", id);
+    return entry(lat(rng), lon(rng), timestamp(rng), oid);
+}
+
+// the sums are added in another order, so they only match up to the rounding
+bool close(double a, double b)
+{
+    return std::fabs(a - b) <= 1e-9 * std::fabs(b) + 1e-6;
+}
+
+bool same(aggregate_t const& a, aggregate_t const& b)
+{
+    if(a.count != b.count)
+        return false;
+    for(size_t i = 0; i < 3; ++i)
+    {
+        if(!close(a.fields.sum[i], b.fields.sum[i]) || !close(a.fields.sum_of_squares[i], b.fields.sum_of_squares[i])
+                || a.fields.min[i] != b.fields.min[i] || a.fields.max[i] != b.fields.max[i])
+            return false;
+    }
+    return true;
+}
+
+// the number of queries whose aggregates don't match those of the scan
+size_t check(rtree_t & tree, std::vector<entry> const& entries, std::default_random_engine & rng, std::string const& name)
+{
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    size_t failures = 0;
+    for(size_t q = 0; q < QUERY_COUNT; ++q)
+    {
+        float a = lat(rng), b = lon(rng);
+        box query(point(a, b, 0), point(a + 30, b + 50, q % 2 ? 700000 : 2000000));
+
+        aggregate_t truth;
+        for(auto const& e : entries)
+        {
+            if(bg::covered_by(e.get_point(), query))
+                truth.add_value(e);
+        }
+
+        auto result = tree.aggregate(query);
+        if(!same(result, truth))
+        {
+            std::cout << "  " << name << ": " << result.count << " values aggregated for " << truth.count
+                << ", sum of the latitudes " << result.fields.sum[0] << " for " << truth.fields.sum[0] << std::endl;
+            ++failures;
+        }
+    }
+    std::cout << name << ": " << failures << " of " << QUERY_COUNT << " queries wrong" << std::endl;
+    return failures;
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+
+    std::vector<entry> entries;
+    for(size_t i = 0; i < VALUE_COUNT; ++i)
+        entries.push_back(random_entry(rng, i));
+
+    std::string filename = "test_range_aggregate.tree";
+    rtree_t::build_io_layers(entries.begin(), entries.end(), filename);
+
+    size_t failures = 0;
+    {
+        rtree_t tree(filename);
+        failures += check(tree, entries, rng, "built");
+    }
+    {
+        rtree_t tree(filename, true);
+        failures += check(tree, entries, rng, "in memory");
+    }
+    {
+        // the values inserted stay in the buffers of the nodes first
+        rtree_t tree(filename);
+        for(size_t i = 0; i < 20000; ++i)
+        {
+            entries.push_back(random_entry(rng, VALUE_COUNT + i));
+            tree.insert(entries.back());
+        }
+        failures += check(tree, entries, rng, "inserted");
+    }
+
+    std::cout << (failures == 0 ? "OK" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Test of the range counts (rtree::count)
+ *
+ * the counts of random queries are checked against a scan of the values:
+ * the exact mode must find them all, as the aggregates do, and the bounded error
+ * mode must stop with a standard deviation within its bound. whatever the distribution
+ * of the estimates, no more than 1/9 of them are off by more than 3 standard deviations
+ * (Chebyshev). once with the tree as built, once after inserts, which stay in the
+ * buffers of the nodes first
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdio>
+
+#include "rtree/rtree.h"
+#include "mongo_types.h"
+
+namespace bg = boost::geometry;
+
+using entry = mongo_types::entry;
+using sample_entry = mongo_types::sample_entry;
+using box = mongo_types::box3d;
+using point = mongo_types::point3d;
+using rtree_t = rtree::rtree<entry, sample_entry>;
+
+constexpr size_t VALUE_COUNT = 200000;
+constexpr size_t QUERY_COUNT = 50;
+constexpr size_t INSERT_COUNT = 20000;
+
+// the number of wrong counts over `queries`
+size_t check(rtree_t & tree, std::vector<entry> const& entries, std::vector<box> const& queries, std::string const& name)
+{
+    size_t exact_failures = 0, bound_failures = 0, estimates = 0, off_estimates = 0;
+    for(auto const& query : queries)
+    {
+        size_t truth = 0;
+        for(auto const& e : entries)
+        {
+            if(bg::covered_by(e.get_point(), query))
+                ++truth;
+        }
+
+        double sd = -1;
+        size_t exact = tree.count(query, rtree::CountMode::exact(), &sd);
+        size_t aggregated = tree.aggregate(query).count;
+        if(exact != truth || aggregated != truth || sd != 0.0)
+        {
+            std::cout << "  exact count " << exact << " (sd " << sd << "), aggregate count " << aggregated
+                << " for " << truth << " values" << std::endl;
+            ++exact_failures;
+        }
+
+        for(double error : {0.01, 0.05, 0.2})
+        {
+            size_t count = tree.count(query, rtree::CountMode::bounded_error(error), &sd);
+            // the count is rounded from the estimate the bound is checked on
+            if(sd > error * (count + 1.0))
+            {
+                std::cout << "  bounded error " << error << ": sd " << sd << " for a count of " << count << std::endl;
+                ++bound_failures;
+            }
+            ++estimates;
+            if(std::fabs((double)count - truth) > 3 * sd + 1.0)
+                ++off_estimates;
+        }
+    }
+
+    std::cout << name << ", " << queries.size() << " queries: " << exact_failures << " wrong exact counts, "
+        << bound_failures << " over the bound, " << off_estimates << " of " << estimates
+        << " estimates off by more than 3 sd" << std::endl;
+    return exact_failures + bound_failures + (off_estimates * 9 > estimates ? 1 : 0);
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    std::uniform_int_distribution<int> timestamp(0, 1000000);
+
+    std::vector<entry> entries;
+    for(size_t i = 0; i < VALUE_COUNT; ++i)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", i);
+        entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+    }
+
+    std::string filename = "test_range_count.tree";
+    rtree_t::build_io_layers(entries.begin(), entries.end(), filename);
+    rtree_t tree(filename);
+
+    // the whole data, nothing, then random boxes of all sizes
+    std::vector<box> queries = {
+        box(point(-90, -180, 0), point(90, 180, 1000000)),
+        box(point(10, 10, 0), point(10.001, 10.001, 10)),
+    };
+    while(queries.size() < QUERY_COUNT)
+    {
+        point a(lat(rng), lon(rng), timestamp(rng)), b(lat(rng), lon(rng), timestamp(rng));
+        queries.push_back(box(
+            point(std::min(a.get<0>(), b.get<0>()), std::min(a.get<1>(), b.get<1>()), std::min(a.get<2>(), b.get<2>())),
+            point(std::max(a.get<0>(), b.get<0>()), std::max(a.get<1>(), b.get<1>()), std::max(a.get<2>(), b.get<2>()))));
+    }
+
+    size_t failures = check(tree, entries, queries, "built");
+
+    for(size_t i = 0; i < INSERT_COUNT; ++i)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", VALUE_COUNT + i);
+        entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+        tree.insert(entries.back());
+    }
+    failures += check(tree, entries, queries, "inserted");
+
+    bool ok = failures == 0;
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Microbenchmark of the serialization of the node contents
+ *
+ * the arrays stored in the blocks (entries of the children, values of the leaves)
+ * are written to and read from a block sized buffer, value by value through
+ * a boost::iostreams stream (serializer<T>) and with fixed_layout<T>
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+
+#include <boost/timer/timer.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+
+#include "rtree/rtree.h"
+#include "mongo_types.h"
+
+namespace bi = boost::iostreams;
+
+using rtree_t = rtree::rtree<mongo_types::entry, mongo_types::sample_entry>;
+using node_entry_t = rtree_t::entry_t;
+
+constexpr size_t BLOCK_SIZE = 8192;
+constexpr int REPEAT = 200000;
+
+template <typename T>
+double time_stream(std::vector<T> const& values, std::vector<T> & loaded, char * block)
+{
+    boost::timer::cpu_timer timer;
+    for(int r = 0; r < REPEAT; ++r)
+    {
+        bi::stream<bi::basic_array<char>> out(block, BLOCK_SIZE);
+        dump_value(out, (uint16_t)values.size());
+        for(auto const& v : values)
+            dump_value(out, v);
+
+        bi::stream<bi::basic_array_source<char>> in(block, BLOCK_SIZE);
+        uint16_t s;
+        load_value(in, s);
+        loaded.resize(s);
+        for(auto & v : loaded)
+            load_value(in, v);
+    }
+    return timer.elapsed().wall / 1e9;
+}
+
+template <typename T>
+double time_fixed(std::vector<T> const& values, std::vector<T> & loaded, char * block)
+{
+    boost::timer::cpu_timer timer;
+    for(int r = 0; r < REPEAT; ++r)
+    {
+        dump_fixed_array(block, block + BLOCK_SIZE, values);
+        load_fixed_array(block, block + BLOCK_SIZE, loaded);
+    }
+    return timer.elapsed().wall / 1e9;
+}
+
+template <typename T>
+void run(std::string const& name, std::vector<T> const& values)
+{
+    static_assert(fixed_layout<T>::value, "the benchmark compares against fixed_layout");
+
+    std::vector<char> block(BLOCK_SIZE);
+    std::vector<T> loaded;
+
+    double stream_time = time_stream(values, loaded, block.data());
+    std::vector<char> stream_bytes(block);
+    double fixed_time = time_fixed(values, loaded, block.data());
+
+    std::cout << name << ": " << values.size() << " values of " << fixed_layout<T>::size << " bytes"
+        << (fixed_layout<T>::is_memory_image ? " (memory image)" : "") << '\n'
+        << "  stream " << stream_time * 1e9 / REPEAT << " ns per block\n"
+        << "  fixed  " << fixed_time * 1e9 / REPEAT << " ns per block\n"
+        << "  speedup " << stream_time / fixed_time
+        << (stream_bytes == block ? "" : ", MISMATCH between the two encodings") << std::endl;
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> coordinate(-90, 90);
+    std::uniform_int_distribution<int> timestamp(0, 1 << 30);
+
+    std::vector<mongo_types::entry> entries;
+    std::vector<mongo_types::sample_entry> samples;
+    while((entries.size() + 1) * fixed_layout<mongo_types::entry>::size + sizeof(uint16_t) <= BLOCK_SIZE)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", entries.size());
+        entries.emplace_back(coordinate(rng), coordinate(rng), timestamp(rng), oid);
+        samples.emplace_back(entries.back());
+    }
+
+    std::vector<node_entry_t> children;
+    while((children.size() + 1) * fixed_layout<node_entry_t>::size + sizeof(uint16_t) <= BLOCK_SIZE)
+    {
+        node_entry_t e;
+        e.type = node_entry_t::IO_LEAF_TYPE;
+        e.subtree_size = children.size();
+        e.bbox = rtree_t::box_type(mongo_types::point3d(coordinate(rng), coordinate(rng), 0),
+            mongo_types::point3d(coordinate(rng), coordinate(rng), 1));
+        e.bid = children.size();
+        e.min_key.fill(children.size());
+        children.push_back(e);
+    }
+
+    run("entry", entries);
+    run("sample_entry", samples);
+    run("node_entry", children);
+
+    return 0;
+}
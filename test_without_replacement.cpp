@@ -0,0 +1,181 @@
+/*
+Copyright 2017 InitialDLab
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/*
+ * Test of the sample queries without replacement (set_without_replacement)
+ *
+ * a few ranges are drained, with the tree as built, with the mem layers and all
+ * the nodes loaded, and after inserts: the samples must be distinct values within
+ * the range, as many as the naive sample query counts. the time of a fresh sample
+ * must stay bounded while the first half of the largest range is returned
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include <set>
+#include <chrono>
+#include <cstdio>
+
+#include "rtree/rtree.h"
+#include "mongo_types.h"
+
+namespace bg = boost::geometry;
+
+using entry = mongo_types::entry;
+using sample_entry = mongo_types::sample_entry;
+using box = mongo_types::box3d;
+using point = mongo_types::point3d;
+using rtree_t = rtree::rtree<entry, sample_entry>;
+
+constexpr size_t VALUE_COUNT = 200000;
+constexpr size_t INSERT_COUNT = 20000;
+// a fresh sample at half of the range may cost that many times more than at the start
+constexpr double MAX_SLOWDOWN = 10.0;
+
+std::string oid_key(mongo_types::OID const& oid)
+{
+    return std::string((char const*)oid.id.data(), oid.id.size());
+}
+
+double seconds(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the number of ranges that were not drained right
+size_t check(rtree_t & tree, std::vector<entry> const& entries, std::vector<box> const& queries, std::string const& name)
+{
+    size_t failures = 0;
+    for(auto const& query : queries)
+    {
+        std::set<std::string> in_range;
+        for(auto const& e : entries)
+        {
+            if(bg::covered_by(e.get_point(), query))
+                in_range.insert(oid_key(e.oid));
+        }
+        size_t expected = tree.naive_sample_query(query).get_count();
+
+        auto cursor = tree.sample_query(query);
+        cursor.set_without_replacement();
+
+        // in chunks of 1% of the range, the time of each one is kept
+        size_t chunk = std::max<size_t>(1, in_range.size() / 100);
+        std::vector<sample_entry> samples;
+        std::vector<double> chunk_times;
+        while(true)
+        {
+            size_t before = samples.size();
+            double start = seconds();
+            cursor.get_samples(chunk, std::back_inserter(samples));
+            chunk_times.push_back(seconds() - start);
+            if(samples.size() == before)
+                break;
+        }
+
+        std::set<std::string> distinct;
+        size_t out = 0;
+        for(auto const& s : samples)
+        {
+            distinct.insert(oid_key(s.oid));
+            if(!bg::covered_by(s.get_point(), query) || in_range.count(oid_key(s.oid)) == 0)
+                ++out;
+        }
+
+        // the 10 first chunks against the 10 up to half of the range
+        double slowdown = 0.0;
+        if(chunk_times.size() > 50)
+        {
+            double first = 0.0, half = 0.0;
+            for(size_t i = 0; i < 10; ++i)
+            {
+                first += chunk_times[i];
+                half += chunk_times[40 + i];
+            }
+            slowdown = half / first;
+        }
+
+        std::cout << name << ": " << samples.size() << " samples (" << distinct.size() << " distinct, "
+            << out << " out of range) for " << expected << " values, " << in_range.size() << " scanned";
+        if(slowdown > 0.0)
+            std::cout << ", a fresh sample at half the range costs " << slowdown << " times one at the start";
+        std::cout << std::endl;
+
+        if(samples.size() != expected || distinct.size() != samples.size() || out > 0 || slowdown > MAX_SLOWDOWN)
+            ++failures;
+    }
+    return failures;
+}
+
+int main()
+{
+    std::default_random_engine rng(42);
+    std::uniform_real_distribution<float> lat(-80, 80), lon(-170, 170);
+    std::uniform_int_distribution<int> timestamp(0, 1000000);
+
+    std::vector<entry> entries;
+    for(size_t i = 0; i < VALUE_COUNT; ++i)
+    {
+        char oid[25];
+        snprintf(oid, sizeof(oid), "%024zx", i);
+        entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+    }
+
+    std::string filename = "test_without_replacement.tree";
+    rtree_t::build_io_layers(entries.begin(), entries.end(), filename);
+
+    std::vector<box> queries = {
+        box(point(-70, -160, 0), point(70, 160, 1000000)),
+        box(point(-20, -40, 0), point(30, 60, 600000)),
+        box(point(-5, -5, 0), point(5, 5, 800000)),
+        box(point(10, 10, 0), point(12, 12, 1000000)),
+    };
+
+    size_t failures = 0;
+    {
+        rtree_t tree(filename);
+        failures += check(tree, entries, queries, "built");
+        tree.save_mem_nodes();
+    }
+    {
+        rtree_t tree(filename, false, true);
+        failures += check(tree, entries, queries, "mem layers loaded");
+    }
+    {
+        rtree_t tree(filename, true);
+        failures += check(tree, entries, queries, "in memory");
+    }
+    {
+        rtree_t tree(filename);
+        for(size_t i = 0; i < INSERT_COUNT; ++i)
+        {
+            char oid[25];
+            snprintf(oid, sizeof(oid), "%024zx", VALUE_COUNT + i);
+            entries.emplace_back(lat(rng), lon(rng), timestamp(rng), oid);
+            tree.insert(entries.back());
+        }
+        failures += check(tree, entries, queries, "inserted");
+    }
+
+    std::cout << (failures == 0 ? "OK" : "FAILED") << std::endl;
+    return failures == 0 ? 0 : 1;
+}